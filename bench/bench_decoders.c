@@ -0,0 +1,139 @@
+/**
+ *      @file bench_decoders.c
+ *      @author Nestor Hiebl
+ *      @date December 23, 2020
+ *
+ *      @brief Micro-benchmark comparing the fixed layout datetime and duration decoders against the @c sscanf and @c atoi
+ *      based extraction they replaced. The datetime and duration fields of a call record are loaded into memory first, so
+ *      only the decoding itself is timed.
+ *
+ *      https://github.com/NestorHiebl/c_phone_billing_system
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../csv_to_avl_tree.h"
+
+#define DEFAULT_CALL_RECORD "data/phone_record.csv"
+#define DEFAULT_REPETITIONS 10
+
+/**
+ *      Elapsed nanoseconds
+ *      @brief Calculates the nanoseconds between two monotonic clock readings.
+ */
+double elapsed_nanoseconds(struct timespec *start, struct timespec *end) {
+    return ((double) (end->tv_sec - start->tv_sec) * 1e9) + (double) (end->tv_nsec - start->tv_nsec);
+}
+
+int main(int argc, char **argv) {
+    const char *call_record_filename = (argc > 1) ? argv[1] : DEFAULT_CALL_RECORD;
+    size_t repetitions = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_REPETITIONS;
+
+    FILE *call_record = fopen(call_record_filename, "r");
+    if (call_record == NULL) {
+        fprintf(stderr, "Usage: bench_decoders [Call record CSV file] [Repetitions]\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t capacity = 1024;
+    size_t row_count = 0;
+    char (*datetimes)[32] = malloc(capacity * sizeof(*datetimes));
+    char (*durations)[32] = malloc(capacity * sizeof(*durations));
+
+    char csv_line[MAX_CSV_LINE];
+
+    // Keep only the duration and datetime fields of every row
+    while ((datetimes != NULL) && (durations != NULL) && (fgets(csv_line, MAX_CSV_LINE, call_record) != NULL)) {
+        csv_line[strcspn(csv_line, "\n")] = '\0';
+
+        char *tokenizer_state = NULL;
+        strtok_r(csv_line, ",", &tokenizer_state);
+        strtok_r(NULL, ",", &tokenizer_state);
+        char *duration_token = strtok_r(NULL, ",", &tokenizer_state);
+        char *datetime_token = strtok_r(NULL, ",", &tokenizer_state);
+
+        if ((duration_token == NULL) || (datetime_token == NULL) || (strlen(duration_token) >= 32) || (strlen(datetime_token) >= 32)) {
+            continue;
+        }
+
+        if (row_count == capacity) {
+            capacity *= 2;
+            datetimes = realloc(datetimes, capacity * sizeof(*datetimes));
+            durations = realloc(durations, capacity * sizeof(*durations));
+            if ((datetimes == NULL) || (durations == NULL)) {
+                break;
+            }
+        }
+
+        strcpy(datetimes[row_count], datetime_token);
+        strcpy(durations[row_count], duration_token);
+        row_count++;
+    }
+    fclose(call_record);
+
+    if ((datetimes == NULL) || (durations == NULL) || (row_count == 0)) {
+        fprintf(stderr, "No rows could be loaded from \"%s\"\n", call_record_filename);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start;
+    struct timespec end;
+
+    // The checksums keep the compiler from dropping the decoding and show that both variants agree
+    size_t sscanf_checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t repetition = 0; repetition < repetitions; repetition++) {
+        for (size_t i = 0; i < row_count; i++) {
+            size_t year = 0;
+            size_t month = 0;
+            size_t day = 0;
+
+            if (sscanf(datetimes[i], "%4lu-%2lu-%2lu %*d:%*d:%*d", &year, &month, &day) == 3) {
+                sscanf_checksum += year + month + day + (size_t) atoi(durations[i]);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double sscanf_nanoseconds = elapsed_nanoseconds(&start, &end);
+
+    size_t decoder_checksum = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t repetition = 0; repetition < repetitions; repetition++) {
+        for (size_t i = 0; i < row_count; i++) {
+            size_t year = 0;
+            size_t month = 0;
+            size_t day = 0;
+            size_t hour = 0;
+            size_t minute = 0;
+            size_t second = 0;
+            size_t duration = 0;
+
+            if (decode_call_datetime(datetimes[i], strlen(datetimes[i]), &year, &month, &day, &hour, &minute, &second) &&
+                decode_call_duration(durations[i], strlen(durations[i]), &duration)) {
+                decoder_checksum += year + month + day + duration;
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double decoder_nanoseconds = elapsed_nanoseconds(&start, &end);
+
+    double decoded_rows = (double) row_count * (double) repetitions;
+
+    printf( "Rows: %lu, repetitions: %lu\n"
+            "sscanf + atoi: %.1f ns/row (checksum %lu)\n"
+            "decoders:      %.1f ns/row (checksum %lu)\n"
+            "Speedup: %.2fx\n",
+            row_count, repetitions,
+            sscanf_nanoseconds / decoded_rows, sscanf_checksum,
+            decoder_nanoseconds / decoded_rows, decoder_checksum,
+            sscanf_nanoseconds / decoder_nanoseconds);
+
+    free(datetimes);
+    free(durations);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,244 @@
+/**
+ *      @file bench_ingest.c
+ *      @author Nestor Hiebl
+ *      @date December 23, 2020
+ *
+ *      @brief End-to-end benchmark that runs the whole main executable on a call record, usually one written by
+ *      cdr_generate, and reports the rows parsed per second and the peak resident set size. Every run takes place in a
+ *      scratch directory, so the generated cdr and bill files don't end up next to the sources, and the directory is
+ *      removed again afterwards unless asked to keep it.
+ *
+ *      https://github.com/NestorHiebl/c_phone_billing_system
+*/
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define COUNT_BUFFER_SIZE (1 << 20)
+#define DEFAULT_RUN_COUNT 1
+
+/**
+ *      Elapsed seconds
+ *      @brief Calculates the seconds between two monotonic clock readings.
+ */
+double elapsed_seconds(struct timespec *start, struct timespec *end) {
+    return (double) (end->tv_sec - start->tv_sec) + ((double) (end->tv_nsec - start->tv_nsec) / 1e9);
+}
+
+/**
+ *      Count rows
+ *      @brief Counts the rows of a csv file. A final row without a trailing newline counts too.
+ *
+ *      @return The number of rows, 0 if the file could not be read.
+ */
+size_t count_rows(const char *filename) {
+    FILE *csv = fopen(filename, "r");
+    if (csv == NULL) {
+        return 0;
+    }
+
+    char *buffer = malloc(COUNT_BUFFER_SIZE);
+    if (buffer == NULL) {
+        fclose(csv);
+        return 0;
+    }
+
+    size_t row_count = 0;
+    size_t bytes_read = 0;
+    char last_byte = '\n';
+
+    while ((bytes_read = fread(buffer, 1, COUNT_BUFFER_SIZE, csv)) > 0) {
+        const char *current = buffer;
+        const char *end = buffer + bytes_read;
+
+        while ((current = memchr(current, '\n', (size_t) (end - current))) != NULL) {
+            row_count++;
+            current++;
+        }
+        last_byte = buffer[bytes_read - 1];
+    }
+
+    free(buffer);
+    fclose(csv);
+
+    return (last_byte == '\n') ? row_count : row_count + 1;
+}
+
+/**
+ *      Remove scratch entry
+ *      @brief @c nftw callback that removes a single file or directory of the scratch directory.
+ */
+int remove_scratch_entry(const char *path, const struct stat *stats, int type, struct FTW *walk) {
+    (void) stats;
+    (void) type;
+    (void) walk;
+
+    return remove(path);
+}
+
+/**
+ *      Run ingest
+ *      @brief Runs the main executable once inside a scratch directory, with its output discarded.
+ *
+ *      @return The exit status of the executable, -1 if it could not be started.
+ */
+int run_ingest(char **arguments, const char *scratch_directory) {
+    pid_t child = fork();
+
+    if (child < 0) {
+        return -1;
+    }
+
+    if (child == 0) {
+        int null_descriptor = open("/dev/null", O_WRONLY);
+
+        if ((chdir(scratch_directory) != 0) || (null_descriptor < 0)) {
+            _exit(127);
+        }
+        dup2(null_descriptor, STDOUT_FILENO);
+        dup2(null_descriptor, STDERR_FILENO);
+
+        execv(arguments[0], arguments);
+        _exit(127);
+    }
+
+    int status = 0;
+    if (waitpid(child, &status, 0) < 0) {
+        return -1;
+    }
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void print_usage(void) {
+    printf( "Usage: bench_ingest [Options] [Main executable] [Call rate CSV file] [Call record CSV file] [Main options...]\n"
+            "Run the full billing pipeline on a call record and report rows per second and peak RSS.\n"
+            "Options:\n"
+            "\t-n\tNumber of runs (default %d)\n"
+            "\t-k\tKeep the scratch directory with the generated files\n",
+            DEFAULT_RUN_COUNT);
+}
+
+int main(int argc, char **argv) {
+    size_t run_count = DEFAULT_RUN_COUNT;
+    int keep_scratch = 0;
+    int c = 0;
+
+    while ((c = getopt(argc, argv, "+hn:k")) != -1) {
+        switch (c) {
+        case 'h':
+            print_usage();
+            return EXIT_SUCCESS;
+        case 'n':
+            run_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'k':
+            keep_scratch = 1;
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ((argc - optind < 3) || (run_count == 0)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    // The executable runs inside the scratch directory, so every path has to be absolute
+    char *executable = realpath(argv[optind], NULL);
+    char *rate_filename = realpath(argv[optind + 1], NULL);
+    char *call_record_filename = realpath(argv[optind + 2], NULL);
+
+    if ((executable == NULL) || (rate_filename == NULL) || (call_record_filename == NULL)) {
+        fprintf(stderr, "The executable, rate record and call record have to exist\n");
+        return EXIT_FAILURE;
+    }
+
+    size_t row_count = count_rows(call_record_filename);
+    if (row_count == 0) {
+        fprintf(stderr, "No rows found in \"%s\"\n", call_record_filename);
+        return EXIT_FAILURE;
+    }
+
+    int extra_argument_count = argc - optind - 3;
+    char **arguments = calloc((size_t) extra_argument_count + 6, sizeof(char *));
+    if (arguments == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    arguments[0] = executable;
+    arguments[1] = "-r";
+    arguments[2] = rate_filename;
+    arguments[3] = "-c";
+    arguments[4] = call_record_filename;
+    for (int i = 0; i < extra_argument_count; i++) {
+        arguments[5 + i] = argv[optind + 3 + i];
+    }
+
+    char scratch_directory[] = "/tmp/bench_ingest.XXXXXX";
+    if (mkdtemp(scratch_directory) == NULL) {
+        fprintf(stderr, "Could not create a scratch directory\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Rows: %lu, runs: %lu\n", row_count, run_count);
+
+    double best_seconds = 0;
+    int exit_status = 0;
+
+    for (size_t run = 0; run < run_count; run++) {
+        struct timespec start;
+        struct timespec end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        exit_status = run_ingest(arguments, scratch_directory);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (exit_status != 0) {
+            fprintf(stderr, "Run %lu failed with exit status %d\n", run + 1, exit_status);
+            break;
+        }
+
+        double seconds = elapsed_seconds(&start, &end);
+        if ((run == 0) || (seconds < best_seconds)) {
+            best_seconds = seconds;
+        }
+
+        printf("Run %lu: %.2f s, %.0f rows/s\n", run + 1, seconds, (double) row_count / seconds);
+    }
+
+    // Linux reports the peak resident set size of the largest finished child in kilobytes
+    struct rusage usage;
+    getrusage(RUSAGE_CHILDREN, &usage);
+
+    if (exit_status == 0) {
+        printf( "Best: %.2f s, %.0f rows/s\n"
+                "Peak RSS: %.1f MiB\n",
+                best_seconds, (double) row_count / best_seconds, (double) usage.ru_maxrss / 1024.0);
+    }
+
+    if (keep_scratch) {
+        printf("Generated files kept in %s\n", scratch_directory);
+    } else {
+        nftw(scratch_directory, remove_scratch_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+
+    free(arguments);
+    free(executable);
+    free(rate_filename);
+    free(call_record_filename);
+
+    return (exit_status == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,563 @@
+/**
+ *      @file bench_rates.c
+ *      @author Nestor Hiebl
+ *      @date December 23, 2020
+ *
+ *      @brief Micro-benchmark for the longest region code match. The callees of a call record, mixed with random numbers
+ *      that mostly miss the long region codes, are loaded into memory first and then looked up millions of times with the
+ *      rate tree search and with every rate index engine. Reports the build time of every structure, the nanoseconds per
+ *      lookup and, where the kernel allows hardware counters, the cache misses per lookup. Every engine has to arrive at
+ *      the same checksum of matched region codes as the AVL engine, otherwise the run fails. The rate tree search is only
+ *      compared for rate csvs without range rows. The whole calls are then priced with every engine, one by one and with
+ *      @c rate_call_batch , and the batch prices have to match.
+ *
+ *      https://github.com/NestorHiebl/c_phone_billing_system
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "../csv_to_avl_tree.h"
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+#endif
+
+#define DEFAULT_RATES "data/call_rates.csv"
+#define DEFAULT_CALL_RECORD "data/phone_record.csv"
+#define DEFAULT_LOOKUP_COUNT 10000000
+#define DEFAULT_RANDOM_SHARE 10
+#define RANDOM_SEED UINT64_C(0x9E3779B97F4A7C15)
+
+/**
+ *      @typedef Lookup method
+ *
+ *      @brief The ways a callee can be matched against the rates. Every rate engine is looked up through its index,
+ *      @c LOOKUP_TREE is the original rate tree search and @c LOOKUP_CACHE is the trie behind a rate cache. The rate tree
+ *      search does not know about range rows, so its checksum only agrees with the others for rate csvs without them.
+ */
+typedef enum lookup_method {
+
+    LOOKUP_TREE,
+    LOOKUP_INDEX,
+    LOOKUP_CACHE
+
+} lookup_method;
+
+/**
+ *      @typedef Bench calls
+ *
+ *      @brief The valid calls of a call record, one array per field as @c rate_call_batch takes them.
+ *
+ *      @param callees The encoded callee of every call, some of them replaced with random numbers.
+ *      @param durations The duration of every call in seconds.
+ *      @param dates The date of every call, encoded as @c yyyymmdd .
+ *      @param time_slots The hour of the week every call started in.
+ *      @param count The number of calls.
+ */
+typedef struct bench_calls {
+
+    phone_number *callees;
+    size_t *durations;
+    uint32_t *dates;
+    uint8_t *time_slots;
+    size_t count;
+
+} bench_calls;
+
+/**
+ *      Elapsed nanoseconds
+ *      @brief Calculates the nanoseconds between two monotonic clock readings.
+ */
+double elapsed_nanoseconds(struct timespec *start, struct timespec *end) {
+    return ((double) (end->tv_sec - start->tv_sec) * 1e9) + (double) (end->tv_nsec - start->tv_nsec);
+}
+
+/**
+ *      Next random
+ *      @brief Steps a xorshift64 generator, so every run looks up the same numbers.
+ */
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ *      Open cache miss counter
+ *      @brief Opens a disabled hardware counter of the last level cache misses of this thread.
+ *
+ *      @return The counter's file descriptor, -1 if hardware counters are not available.
+ */
+int open_cache_miss_counter(void) {
+    #ifdef __linux__
+        struct perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(attributes);
+        attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+        attributes.disabled = 1;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+
+        return (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+    #else
+        return -1;
+    #endif
+}
+
+/**
+ *      Switch cache miss counter
+ *      @brief Resets and starts the counter, or stops it.
+ */
+void switch_cache_miss_counter(int counter, int enable) {
+    #ifdef __linux__
+        if (counter < 0) {
+            return;
+        }
+        if (enable) {
+            ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+        } else {
+            ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    #else
+        (void) counter;
+        (void) enable;
+    #endif
+}
+
+/**
+ *      Read cache miss counter
+ *      @brief Reads the misses counted between the last start and stop.
+ */
+uint64_t read_cache_miss_counter(int counter) {
+    uint64_t misses = 0;
+
+    if ((counter < 0) || (read(counter, &misses, sizeof(misses)) != (ssize_t) sizeof(misses))) {
+        return 0;
+    }
+    return misses;
+}
+
+/**
+ *      Delete calls
+ *      @brief Frees the arrays of loaded calls.
+ */
+void delete_calls(bench_calls *calls) {
+    free(calls->callees);
+    free(calls->durations);
+    free(calls->dates);
+    free(calls->time_slots);
+
+    calls->callees = NULL;
+    calls->durations = NULL;
+    calls->dates = NULL;
+    calls->time_slots = NULL;
+    calls->count = 0;
+}
+
+/**
+ *      Load calls
+ *      @brief Loads the valid calls of a call record, replacing the callees of a share of them with random numbers of 8 to
+ *      15 digits.
+ *
+ *      @return 1 if any call could be loaded, 0 otherwise.
+ */
+int load_calls(const char *filename, unsigned int random_share, bench_calls *calls) {
+    FILE *call_record = fopen(filename, "r");
+    if (call_record == NULL) {
+        return 0;
+    }
+
+    size_t capacity = 1024;
+    uint64_t random_state = RANDOM_SEED;
+    char csv_line[MAX_CSV_LINE];
+
+    calls->count = 0;
+    calls->callees = malloc(capacity * sizeof(phone_number));
+    calls->durations = malloc(capacity * sizeof(size_t));
+    calls->dates = malloc(capacity * sizeof(uint32_t));
+    calls->time_slots = malloc(capacity * sizeof(uint8_t));
+
+    while ((calls->callees != NULL) && (calls->durations != NULL) && (calls->dates != NULL) && (calls->time_slots != NULL) &&
+           (fgets(csv_line, MAX_CSV_LINE, call_record) != NULL)) {
+        char *tokenizer_state = NULL;
+        strtok_r(csv_line, ",", &tokenizer_state);
+        char *callee_token = strtok_r(NULL, ",", &tokenizer_state);
+        char *duration_token = strtok_r(NULL, ",", &tokenizer_state);
+        char *datetime_token = strtok_r(NULL, ",\r\n", &tokenizer_state);
+
+        phone_number callee;
+        size_t duration = 0;
+        size_t year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+
+        if ((callee_token == NULL) || (duration_token == NULL) || (datetime_token == NULL) ||
+            !(encode_phone_number(callee_token, strlen(callee_token), &callee)) || (callee.digits == 0) ||
+            !(decode_call_duration(duration_token, strlen(duration_token), &duration)) ||
+            !(decode_call_datetime(datetime_token, strlen(datetime_token), &year, &month, &day, &hour, &minute, &second))) {
+            continue;
+        }
+
+        if (next_random(&random_state) % 100 < random_share) {
+            callee.digits = 8 + (unsigned int) (next_random(&random_state) % 8);
+            callee.value = power_of_ten(callee.digits - 1) + (next_random(&random_state) % (9 * power_of_ten(callee.digits - 1)));
+        }
+
+        if (calls->count == capacity) {
+            capacity *= 2;
+            phone_number *new_callees = realloc(calls->callees, capacity * sizeof(phone_number));
+            size_t *new_durations = (new_callees == NULL) ? NULL : realloc(calls->durations, capacity * sizeof(size_t));
+            uint32_t *new_dates = (new_durations == NULL) ? NULL : realloc(calls->dates, capacity * sizeof(uint32_t));
+            uint8_t *new_time_slots = (new_dates == NULL) ? NULL : realloc(calls->time_slots, capacity * sizeof(uint8_t));
+
+            calls->callees = (new_callees == NULL) ? calls->callees : new_callees;
+            calls->durations = (new_durations == NULL) ? calls->durations : new_durations;
+            calls->dates = (new_dates == NULL) ? calls->dates : new_dates;
+            calls->time_slots = (new_time_slots == NULL) ? calls->time_slots : new_time_slots;
+
+            if (new_time_slots == NULL) {
+                capacity /= 2;
+                break;
+            }
+        }
+
+        calls->callees[calls->count] = callee;
+        calls->durations[calls->count] = duration;
+        calls->dates[calls->count] = encode_rate_date(year, month, day);
+        calls->time_slots[calls->count] = (uint8_t) get_time_band_slot(year, month, day, hour);
+        calls->count++;
+    }
+    fclose(call_record);
+
+    if ((calls->callees == NULL) || (calls->durations == NULL) || (calls->dates == NULL) || (calls->time_slots == NULL) || (calls->count == 0)) {
+        delete_calls(calls);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ *      Run lookups
+ *      @brief Looks up the numbers over and over until @c lookup_count lookups have been done. The method never changes
+ *      within a run, so the branch on it is always predicted and only the search itself is timed.
+ *
+ *      @return A checksum of the matched region codes.
+ */
+uint64_t run_lookups(lookup_method method, rate_node *tree, rate_cache *cache, const phone_number *numbers, size_t number_count, size_t lookup_count) {
+    uint64_t checksum = 0;
+    size_t position = 0;
+
+    for (size_t i = 0; i < lookup_count; i++) {
+        phone_number code = { .value = 0, .digits = 0 };
+
+        if (method == LOOKUP_TREE) {
+            const rate_node *node = search_by_longest_region_code_match(tree, numbers[position]);
+            if (node != NULL) {
+                code = node->code;
+            }
+        } else if (method == LOOKUP_INDEX) {
+            const rate_entry *entry = search_rate_index(cache->index, numbers[position]);
+            if (entry != NULL) {
+                code = entry->code;
+            }
+        } else {
+            const rate_entry *entry = search_rate_cache(cache, numbers[position]);
+            if (entry != NULL) {
+                code = entry->code;
+            }
+        }
+
+        checksum += code.value + code.digits;
+
+        position++;
+        if (position == number_count) {
+            position = 0;
+        }
+    }
+
+    return checksum;
+}
+
+/**
+ *      Bench lookups
+ *      @brief Warms up, then times the lookups of a single method and prints a line of results.
+ *
+ *      @return The checksum of the matched region codes.
+ */
+uint64_t bench_lookups(const char *name, double build_milliseconds, lookup_method method, rate_node *tree, rate_cache *cache,
+                   const phone_number *numbers, size_t number_count, size_t lookup_count, int counter) {
+    struct timespec start;
+    struct timespec end;
+
+    run_lookups(method, tree, cache, numbers, number_count, (number_count < lookup_count) ? number_count : lookup_count);
+
+    switch_cache_miss_counter(counter, 1);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t checksum = run_lookups(method, tree, cache, numbers, number_count, lookup_count);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    switch_cache_miss_counter(counter, 0);
+
+    printf("%-14s %10.2f %11.1f", name, build_milliseconds, elapsed_nanoseconds(&start, &end) / (double) lookup_count);
+    if (counter < 0) {
+        printf(" %15s", "n/a");
+    } else {
+        printf(" %15.3f", (double) read_cache_miss_counter(counter) / (double) lookup_count);
+    }
+    printf(" %20" PRIu64 "\n", checksum);
+
+    return checksum;
+}
+
+/**
+ *      Rate calls one by one
+ *      @brief Prices every call on its own, with the same lookup and formula @c insert_call uses.
+ */
+void rate_calls_one_by_one(const rate_index *index, const bench_calls *calls, double *prices) {
+    for (size_t i = 0; i < calls->count; i++) {
+        const rate_entry *entry = search_rate_index(index, calls->callees[i]);
+
+        if (entry == NULL) {
+            prices[i] = 0;
+        } else {
+            prices[i] = find_rate_in_force(index, entry, calls->dates[i]) *
+                        get_time_band_multiplier(index, entry, calls->time_slots[i]) *
+                        calls->durations[i];
+        }
+    }
+}
+
+/**
+ *      Bench batch
+ *      @brief Prices the calls over and over until @c lookup_count calls have been priced, one by one and with
+ *      @c rate_call_batch , and prints a line with the nanoseconds per call of both. Every batch price has to be exactly
+ *      the one by one price, since both take the same rate entry through the same formula.
+ *
+ *      @return 1 if the prices agree, 0 otherwise.
+ */
+int bench_batch(const char *name, const rate_index *index, const bench_calls *calls, size_t lookup_count, double *single_prices, double *batch_prices) {
+    struct timespec start;
+    struct timespec end;
+    size_t repetitions = (lookup_count + calls->count - 1) / calls->count;
+
+    rate_calls_one_by_one(index, calls, single_prices);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < repetitions; i++) {
+        rate_calls_one_by_one(index, calls, single_prices);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double single_nanoseconds = elapsed_nanoseconds(&start, &end) / (double) (repetitions * calls->count);
+
+    rate_call_batch(index, calls->callees, calls->durations, calls->dates, calls->time_slots, calls->count, batch_prices);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < repetitions; i++) {
+        rate_call_batch(index, calls->callees, calls->durations, calls->dates, calls->time_slots, calls->count, batch_prices);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double batch_nanoseconds = elapsed_nanoseconds(&start, &end) / (double) (repetitions * calls->count);
+
+    size_t mismatch_count = 0;
+    for (size_t i = 0; i < calls->count; i++) {
+        mismatch_count += (single_prices[i] != batch_prices[i]);
+    }
+
+    printf("%-14s %11.1f %11.1f %12lu\n", name, single_nanoseconds, batch_nanoseconds, mismatch_count);
+
+    return (mismatch_count == 0);
+}
+
+void print_usage(void) {
+    printf( "Usage: bench_rates [Options] [Call rate CSV file] [Call record CSV file]\n"
+            "Time the longest region code match of every rate engine on the callees of a call record.\n"
+            "Options:\n"
+            "\t-n\tNumber of lookups per engine (default %d)\n"
+            "\t-r\tPercentage of callees replaced with random numbers (default %d)\n",
+            DEFAULT_LOOKUP_COUNT, DEFAULT_RANDOM_SHARE);
+}
+
+int main(int argc, char **argv) {
+    size_t lookup_count = DEFAULT_LOOKUP_COUNT;
+    unsigned int random_share = DEFAULT_RANDOM_SHARE;
+    int c = 0;
+
+    while ((c = getopt(argc, argv, "hn:r:")) != -1) {
+        switch (c) {
+        case 'h':
+            print_usage();
+            return EXIT_SUCCESS;
+        case 'n':
+            lookup_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            random_share = (unsigned int) strtoul(optarg, NULL, 10);
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    const char *rate_filename = (optind < argc) ? argv[optind] : DEFAULT_RATES;
+    const char *call_record_filename = (optind + 1 < argc) ? argv[optind + 1] : DEFAULT_CALL_RECORD;
+
+    if ((lookup_count == 0) || (random_share > 100)) {
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    bench_calls calls;
+    if (!(load_calls(call_record_filename, random_share, &calls))) {
+        fprintf(stderr, "No callees could be loaded from \"%s\"\n", call_record_filename);
+        return EXIT_FAILURE;
+    }
+
+    FILE *call_rates = fopen(rate_filename, "r");
+    if (call_rates == NULL) {
+        fprintf(stderr, "Could not open rate record \"%s\"\n", rate_filename);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start;
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rate_node *range_root = NULL;
+    rate_node *rate_root = parse_rate_csv(call_rates, &range_root);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fclose(call_rates);
+
+    if ((rate_root == NULL) && (range_root == NULL)) {
+        fprintf(stderr, "No valid rates were found in \"%s\"\n", rate_filename);
+        return EXIT_FAILURE;
+    }
+
+    double tree_milliseconds = elapsed_nanoseconds(&start, &end) / 1e6;
+    int counter = open_cache_miss_counter();
+
+    printf( "Rates: %lu, callees: %lu (%u%% random), lookups per engine: %lu\n"
+            "Build times are for the index on top of the tree, the tree itself is built while the csv is parsed.\n\n"
+            "%-14s %10s %11s %15s %20s\n",
+            count_rate_nodes(rate_root), calls.count, random_share, lookup_count,
+            "engine", "build ms", "ns/lookup", "misses/lookup", "checksum");
+
+    uint64_t tree_checksum = bench_lookups("tree", tree_milliseconds, LOOKUP_TREE, rate_root, NULL, calls.callees, calls.count, lookup_count, counter);
+
+    static const char *engine_names[] = { "avl", "trie", "frozen", "hash" };
+    uint64_t avl_checksum = 0;
+    int checksums_agree = 1;
+
+    for (size_t i = 0; i < sizeof(engine_names) / sizeof(engine_names[0]); i++) {
+        rate_engine engine;
+        rate_index rates;
+
+        parse_rate_engine(engine_names[i], &engine);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int built = build_rate_index(&rates, rate_root, range_root, NULL, engine);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        if (!(built)) {
+            fprintf(stderr, "The %s engine could not be built\n", engine_names[i]);
+            return EXIT_FAILURE;
+        }
+
+        rate_cache cache;
+        init_rate_cache(&cache, &rates);
+        uint64_t checksum = bench_lookups(engine_names[i], elapsed_nanoseconds(&start, &end) / 1e6, LOOKUP_INDEX, NULL, &cache, calls.callees, calls.count, lookup_count, counter);
+
+        // The trie is the default engine, it is also timed behind the rate cache every parsing thread uses
+        if ((engine == RATE_ENGINE_TRIE) &&
+            (bench_lookups("trie + cache", 0, LOOKUP_CACHE, NULL, &cache, calls.callees, calls.count, lookup_count, counter) != checksum)) {
+            fprintf(stderr, "The trie behind the rate cache matched different region codes than the trie\n");
+            checksums_agree = 0;
+        }
+
+        // Every engine has to match what the AVL engine, the first one, matched
+        if (engine == RATE_ENGINE_AVL) {
+            avl_checksum = checksum;
+        } else if (checksum != avl_checksum) {
+            fprintf(stderr, "The %s engine matched different region codes than the avl engine\n", engine_names[i]);
+            checksums_agree = 0;
+        }
+
+        delete_rate_cache(&cache);
+        delete_rate_index(&rates);
+    }
+
+    // The rate tree search ignores range rows, it can only be compared when there are none
+    if (range_root == NULL) {
+        if (tree_checksum != avl_checksum) {
+            fprintf(stderr, "The rate tree search matched different region codes than the avl engine\n");
+            checksums_agree = 0;
+        }
+    } else {
+        printf("\nThe rate tree search ignores the %lu range rows, its checksum is not compared.\n", count_rate_nodes(range_root));
+    }
+
+    // The batch rating of the calls, prices included, is checked against rating them one by one like insert_call does
+    double *single_prices = malloc(calls.count * sizeof(double));
+    double *batch_prices = malloc(calls.count * sizeof(double));
+    int prices_agree = 1;
+
+    if ((single_prices == NULL) || (batch_prices == NULL)) {
+        fprintf(stderr, "Not enough memory for the prices of %lu calls\n", calls.count);
+        return EXIT_FAILURE;
+    }
+
+    printf("\n%-14s %11s %11s %12s\n", "engine", "ns/call", "ns/batched", "mismatches");
+
+    for (size_t i = 0; i < sizeof(engine_names) / sizeof(engine_names[0]); i++) {
+        rate_engine engine;
+        rate_index rates;
+
+        parse_rate_engine(engine_names[i], &engine);
+
+        if (!(build_rate_index(&rates, rate_root, range_root, NULL, engine))) {
+            fprintf(stderr, "The %s engine could not be built\n", engine_names[i]);
+            return EXIT_FAILURE;
+        }
+
+        if (!(bench_batch(engine_names[i], &rates, &calls, lookup_count, single_prices, batch_prices))) {
+            prices_agree = 0;
+        }
+
+        delete_rate_index(&rates);
+    }
+
+    free(single_prices);
+    free(batch_prices);
+
+    if (counter < 0) {
+        printf("\nHardware cache miss counters are not available on this system.\n");
+    } else {
+        close(counter);
+    }
+
+    traverse_rates_postorder(rate_root, delete_rate_node);
+    traverse_rates_postorder(range_root, delete_rate_node);
+    delete_region_dictionary();
+    delete_calls(&calls);
+
+    if (!(checksums_agree)) {
+        return EXIT_FAILURE;
+    }
+
+    if (!(prices_agree)) {
+        fprintf(stderr, "\nThe batch prices differ from the prices of calls rated one by one\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
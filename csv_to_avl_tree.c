@@ -8,18 +8,62 @@
  *      https://github.com/NestorHiebl/c_phone_billing_system
 */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include "csv_to_avl_tree.h"
 #include <ctype.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <glob.h>
+#include <pthread.h>
+#include <signal.h>
+#include <zlib.h>
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
 
 #define CURRENT_YEAR 2021
 #define TELEPHONE_INVENTION_YEAR 1876
 
+/**
+ *      @property Diagnostic log
+ *      @brief The log every data error of the process is reported to. Shared by all parsing threads.
+ */
+static diagnostic_log diagnostics = { .lock = PTHREAD_MUTEX_INITIALIZER, .verbose = 0 };
+
+/**
+ *      @property Rate cache statistics
+ *      @brief The hits and misses of every rate cache of the process, added up as the caches are deleted.
+ */
+static rate_cache_statistics rate_cache_totals = { .lock = PTHREAD_MUTEX_INITIALIZER, .hits = 0, .misses = 0 };
+
+/**
+ *      @property Region dictionary
+ *      @brief The names of every region found in the rates, interned so that rates and calls only store their IDs.
+ */
+static region_dictionary regions = { .names = NULL, .count = 0, .slots = NULL, .slot_count = 0 };
+
+/**
+ *      @property Gzip csv registry
+ *      @brief The compressed csv files of the process that are still being read.
+ */
+static gzip_csv_registry gzip_streams = { .lock = PTHREAD_MUTEX_INITIALIZER, .streams = NULL };
+
 /**
  *      Open CSV
  * 
- *      @brief Handles opening a csv file with a given name.
+ *      @brief Handles opening a csv file with a given name. The name "-" opens standard input and named pipes are accepted
+ *      regardless of their extension, so that records can be streamed in from other processes. Files ending in ".csv.gz" are
+ *      opened through @c open_gzip_csv .
  * 
  *      @param filename The filename of the csv file.
  * 
@@ -30,12 +74,28 @@ FILE *open_csv(const char* filename){
         fprintf(stderr, "No filename given, aborting execution\n");
         return NULL;
     }
+
+    // A single dash stands for standard input, e.g. a decompressing pipe
+    if (strcmp(filename, "-") == 0) {
+        return stdin;
+    }
+
+    // Named pipes carry streamed records and don't need the csv extension
+    struct stat file_stats;
+    if ((stat(filename, &file_stats) == 0) && (S_ISFIFO(file_stats.st_mode))) {
+        return fopen(filename, "r");
+    }
     
     size_t filename_len = strlen(filename);
     if (filename_len <= 4) {
         fprintf(stderr, "Filename too short, aborting execution\n");
         return NULL;
     }
+
+    // Compressed csv files are decompressed on the fly
+    if ((filename_len > 7) && (strcmp(&filename[filename_len - 7], ".csv.gz") == 0)) {
+        return open_gzip_csv(filename);
+    }
     
     
     // Checks if the passed filename ends in ".csv"
@@ -54,1060 +114,5787 @@ FILE *open_csv(const char* filename){
 }
 
 /**
- *      Close CSV
+ *      Open gzip csv
  * 
- *      @brief Handles closing a csv file pointer.
+ *      The compressed file is read by a thread that inflates it with zlib and writes the result into a pipe. The returned
+ *      file pointer is the pipe's reading end, so decompression overlaps with parsing and the callers see an ordinary
+ *      non-seekable stream, which @c parse_call_csv already handles. The thread closes the writing end once the whole file
+ *      has been inflated or an error occurred, which the reader sees as the end of the file. Whether it was a real end is
+ *      only known to @c close_csv , which joins the thread and fails for damaged or truncated files.
  * 
- *      @param filename The pointer to csv file.
+ *      @brief Opens a gzip compressed csv file for reading.
  * 
- *      @returns An integer indicator of the function's success
- *      @retval 0 If file closing failed
- *      @retval 1 If file closing was successful
+ *      @param filename The filename of the compressed csv file.
+ * 
+ *      @returns A file pointer to the decompressed data, or NULL if the file is not found or handling has failed.
  */
-int close_csv(FILE *filepointer) {
+FILE *open_gzip_csv(const char *filename) {
+    gzip_csv_stream *stream = malloc(sizeof(gzip_csv_stream));
+    if (stream == NULL) {
+        fprintf(stderr, "Not enough memory to open compressed csv file\n");
+        return NULL;
+    }
 
-    if (fflush(filepointer) != 0) {
-        fprintf(stderr, "File flush failed\n");
-        return 0;
+    stream->compressed = gzopen(filename, "rb");
+    if (stream->compressed == NULL) {
+        printf("Filename invalid, aborting\n");
+        free(stream);
+        return NULL;
     }
+    gzbuffer(stream->compressed, GZIP_BUFFER_SIZE);
 
-    if (fclose(filepointer) != 0) {
-        fprintf(stderr, "File closing failed\n");
-        return 0;
+    int pipe_ends[2];
+    if (pipe(pipe_ends) != 0) {
+        fprintf(stderr, "Could not create a pipe for decompression\n");
+        gzclose(stream->compressed);
+        free(stream);
+        return NULL;
     }
 
-    return 1;
+    stream->write_end = pipe_ends[1];
+    stream->inflated = 0;
+
+    FILE *csv = fdopen(pipe_ends[0], "r");
+    stream->csv = csv;
+
+    if ((csv == NULL) || (pthread_create(&(stream->thread), NULL, decompress_gzip_csv, stream) != 0)) {
+        fprintf(stderr, "Could not start decompressing \"%s\"\n", filename);
+        if (csv != NULL) {
+            fclose(csv);
+        } else {
+            close(pipe_ends[0]);
+        }
+        close(pipe_ends[1]);
+        gzclose(stream->compressed);
+        free(stream);
+        return NULL;
+    }
+
+    // close_csv looks the thread up by the file pointer
+    pthread_mutex_lock(&(gzip_streams.lock));
+    stream->next = gzip_streams.streams;
+    gzip_streams.streams = stream;
+    pthread_mutex_unlock(&(gzip_streams.lock));
+
+    return csv;
 }
 
 /**
- *      Parse call csv
- * 
- *      The iterative logic for parsing rows and fields is based on @c fgets , @c strtok and @c sscanf , respectfully.
- *      Potential error scenarions are:
- *      @li A row in the csv is longer than 1024 characters. The function will notify you, but won't attempt to salvage the row.
- *      @li A field is missing. Strtok ignores consecutive delimiters, so any rows with NaN fields will be discarded.
- *      @li A datetime field is formatted incorrectly. The proper format is @c yyyy-mm-dd @c hh:mm:ss .
- *      No special handling is in place for anonymous calls.
- * 
- *      @brief Builds a full user avl tree with a call linked list starting at each node list based on a csv file pointer.
+ *      Decompress gzip csv
+ *      @brief Thread entry point that inflates a compressed csv into a pipe. Closes the compressed file and the writing end
+ *      and records whether the whole file was inflated in the stream, which is freed by @c close_csv .
  *      
- *      @param filename The @c FILE pointer for the csv.
- * 
- *      @returns A pointer to the root of the generated avl tree.
+ *      @param stream A pointer to the @c gzip_csv_stream to be decompressed.
+ *      @returns @c NULL
  */
-user_node *parse_call_csv(FILE *filename, rate_node *rate_root, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
-
-    char csv_line[MAX_CSV_LINE];
-
-    user_node *root = NULL;
+void *decompress_gzip_csv(void *stream) {
+    gzip_csv_stream *gzip_stream = stream;
+
+    // A reader that stops early closes the pipe, which has to fail the write instead of killing the process
+    sigset_t blocked_signals;
+    sigemptyset(&blocked_signals);
+    sigaddset(&blocked_signals, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &blocked_signals, NULL);
+
+    char *buffer = malloc(GZIP_BUFFER_SIZE);
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory to decompress csv file\n");
+    }
 
-    // Used for debugging
-    size_t line_counter = 1;
-    while (!(feof(filename))) {
-        if ((fgets(csv_line, MAX_CSV_LINE, filename)) != NULL) {
-            
-            // Going smoothly, the line has been loaded in successfuly
+    int bytes_inflated = 0;
+    while ((buffer != NULL) && ((bytes_inflated = gzread(gzip_stream->compressed, buffer, GZIP_BUFFER_SIZE)) > 0)) {
 
-            if (((csv_line[strlen(csv_line) - 1]) == '\n')) {
+        // The pipe may accept less than a whole buffer at once
+        size_t bytes_written = 0;
+        while (bytes_written < (size_t) bytes_inflated) {
+            ssize_t write_result = write(gzip_stream->write_end, buffer + bytes_written, (size_t) bytes_inflated - bytes_written);
+            if (write_result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "Writing decompressed csv data failed, aborting decompression\n");
+                bytes_inflated = -1;
+                break;
+            }
+            bytes_written += (size_t) write_result;
+        }
 
-                // Remove the trailing newline from the csv row
-                csv_line[strlen(csv_line) - 1] = '\0';
-                
-            } else if (feof(filename)) {
-                // We've reached the end of the file
-                // printf("Call file ended\n");    
-            } else {
-                // We're dealing with a really long line
-                printf("Call line longer than 1024 characters\n");
-                line_counter++;
-                continue;
-            } 
-                
-            char *caller_number_token = strtok(csv_line, ",");
-            if (caller_number_token == NULL) {
-                fprintf(stderr, "Call line %lu is empty\n", line_counter);
-                line_counter++;
-                continue;
-            }            
+        if (bytes_inflated < 0) {
+            break;
+        }
+    }
 
-            char *callee_number_token = strtok(NULL, ",");
-            if (callee_number_token == NULL) {
-                fprintf(stderr, "Call line %lu is missing three arguments\n", line_counter);
-                line_counter++;
-                continue;
-            }
-            
-            char *duration_token = strtok(NULL, ",");
-            if (duration_token == NULL) {
-                fprintf(stderr, "Call line %lu is missing two arguments\n", line_counter);
-                line_counter++;
-                continue;
-            }
+    int error_number = Z_OK;
+    gzerror(gzip_stream->compressed, &error_number);
 
-            char *datetime_token = strtok(NULL, ",");
-            if (datetime_token == NULL) {
-                fprintf(stderr, "Call line %lu is missing one argument\n", line_counter);
-                line_counter++;
-                continue;
-            }
-            
-            
-            if (strtok(NULL, ",") != NULL) {
-                fprintf(stderr, "Additional field found on call line %lu\n", line_counter);
-                line_counter++;
-                continue;
-            }            
+    if ((bytes_inflated < 0) && (error_number != Z_OK)) {
+        fprintf(stderr, "Decompressing csv file failed: %s\n", gzerror(gzip_stream->compressed, &error_number));
+    }
 
-            caller_number_token = validate_phone_number(&caller_number_token);
-            callee_number_token = validate_phone_number(&callee_number_token);
-            size_t year_token = 0;
-            size_t month_token = 0;
-            size_t day_token = 0;
+    // A file that ends in the middle of the compressed data is only reported when it is closed
+    int close_result = gzclose(gzip_stream->compressed);
+    if ((bytes_inflated == 0) && (close_result != Z_OK)) {
+        fprintf(stderr, "Decompressing csv file failed: the file is truncated\n");
+    }
 
-            // Date extraction happens here
-            if ((sscanf(datetime_token, "%4lu-%2lu-%2lu %*d:%*d:%*d", &year_token, &month_token, &day_token)) != 3) {
-                fprintf(stderr, "Error: Invalid date found on line %lu\n", line_counter);
-                line_counter++;
-                continue;
-            } else if ((month_token > 12) || (year_token > CURRENT_YEAR) || (year_token < TELEPHONE_INVENTION_YEAR)) {
-                fprintf(stderr, "Error: Invalid year/month found on line %lu\n", line_counter);
-                line_counter++;
-                continue;
-            }
+    gzip_stream->inflated = (buffer != NULL) && (bytes_inflated == 0) && (close_result == Z_OK);
+    free(buffer);
 
-            // printf("Year: %lu, Month: %lu, Day: %lu\n", year_token, month_token, day_token);
-            
-            if ((caller_number_token != NULL) && (callee_number_token != NULL)) {
-                
-                /*********************************************************
-                * The necesarry data has been collected, create the node *
-                *********************************************************/
-                
-                root = add_user_node(root, caller_number_token, callee_number_token, atoi(duration_token), year_token, month_token, day_token, rate_root, total_call_number, total_call_duration, total_call_price);
+    // Signals the end of the file to the reader
+    close(gzip_stream->write_end);
 
-            } else {
-                printf("Invalid caller or callee number found on call line %lu\n", line_counter);
-                line_counter++;
-                continue;
-            }
-            
-        } else {
-            // Couldn't load a line in
-            fprintf(stderr, "Loading line %lu in csv call file failed, aborting\n", line_counter);
-            return root;    
-        }
-        line_counter++;
-    }
-    return root;
+    return NULL;
 }
 
-
 /**
- *      Parse rate csv
+ *      Close CSV
  * 
- *      The iterative logic for parsing rows and fields is based on @c fgets and @c strtok , respectfully. Potential error scenarions are:
- *      @li A row in the csv is longer than 1024 characters. The function will notify you, but won't attempt to salvage the row.
- *      @li A field is missing. Strtok ignores consecutive delimiters, so any rows with NaN fields will be discarded.
+ *      @brief Handles closing a csv file pointer. For compressed files the decompression thread is joined as well, a file
+ *      that could not be inflated completely makes closing fail, since its reader only saw the end of the data.
  * 
- *      @brief Builds a full rate avl tree based on a csv file pointer.
- *      
- *      @param filename The @c FILE pointer for the csv.
+ *      @param filename The pointer to csv file.
  * 
- *      @returns A pointer to the root of the generated avl tree.
+ *      @returns An integer indicator of the function's success
+ *      @retval 0 If file closing failed or a compressed file was damaged
+ *      @retval 1 If file closing was successful
  */
-rate_node *parse_rate_csv(FILE *filename) {
-
-    char csv_line[MAX_CSV_LINE];
-
-    rate_node *root = NULL;
+int close_csv(FILE *filepointer) {
 
-    // Used for debugging
-    size_t line_counter = 1;
-    while (!(feof(filename))) {
-        if ((fgets(csv_line, MAX_CSV_LINE, filename)) != NULL) {
-            
-            // Going smoothly, the line has been loaded in successfuly
+    gzip_csv_stream *gzip_stream = NULL;
 
-            if (((csv_line[strlen(csv_line) - 1]) == '\n')) {
+    pthread_mutex_lock(&(gzip_streams.lock));
+    for (gzip_csv_stream **current = &(gzip_streams.streams); *current != NULL; current = &((*current)->next)) {
+        if ((*current)->csv == filepointer) {
+            gzip_stream = *current;
+            *current = gzip_stream->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&(gzip_streams.lock));
 
-                // Remove the trailing newline from the csv row
-                csv_line[strlen(csv_line) - 1] = '\0';
-                
-            } else if (feof(filename)) {
-                // We've reached the end of the file
-                // printf("File ended\n");    
-            } else {
-                // We're dealing with a really long line
-                printf("Line longer than 1024 characters\n");
-                line_counter++;
-                continue;
-            } 
-                
-            char *region_code_token = strtok(csv_line, ",");
-            if (region_code_token == NULL) {
-                fprintf(stderr, "Line %lu is empty\n", line_counter);
-                line_counter++;
-                continue;
-            }
-            
-            char *region_token = strtok(NULL, ",");
-            if (region_token == NULL) {
-                fprintf(stderr, "Line %lu is missing two arguments\n", line_counter);
-                line_counter++;
-                continue;
-            }
+    int closed = 1;
 
-            char *rate_token = strtok(NULL, ",");
-            if (rate_token == NULL) {
-                fprintf(stderr, "Line %lu is missing one argument\n", line_counter);
-                line_counter++;
-                continue;
-            }
+    if (fflush(filepointer) != 0) {
+        fprintf(stderr, "File flush failed\n");
+        closed = 0;
+    }
 
-            rate_token = validate_rate(rate_token);
-            if (rate_token == NULL) {
-                fprintf(stderr, "Invalid rate found on line %lu\n", line_counter);
-                line_counter++;
-                continue;
-            }
-            
-            double rate_token_d = strtod(rate_token, NULL);
-            
-            if (strtok(NULL, ",") != NULL) {
-                fprintf(stderr, "Additional field found on line %lu\n", line_counter);
-                line_counter++;
-                continue;
-            }
+    // Closing the reading end first stops a decompression thread whose data is no longer read
+    if (fclose(filepointer) != 0) {
+        fprintf(stderr, "File closing failed\n");
+        closed = 0;
+    }
 
-            region_code_token = validate_region_code(&region_code_token);
-            
-            if (region_code_token != NULL) {
-                
-                /*********************************************************
-                * The necesarry data has been collected, create the node *
-                *********************************************************/
-                
-                root = add_rate_node(root, region_code_token, rate_token_d);
+    if (gzip_stream != NULL) {
+        pthread_join(gzip_stream->thread, NULL);
 
-            } else {
-                printf("Invalid region code found on line %lu\n", line_counter);
-                line_counter++;
-                continue;
-            }
-            
-        } else {
-            // Couldn't load a line in
-            fprintf(stderr, "Loading line %lu in csv file failed, aborting\n", line_counter);
-            return root;    
+        if (!(gzip_stream->inflated)) {
+            fprintf(stderr, "The compressed csv file could not be read completely\n");
+            closed = 0;
         }
-        line_counter++;
+        free(gzip_stream);
     }
-    return root;
-}
 
+    return closed;
+}
 
 /**
- *      Generate cdr filename
- *      @brief Generates a filename for a user's monthly cdr record based on the user's number and the year and month.
- *      Note that the returned filename is in a memory block that needs to be freed manually.
- *      
- *      @param user_number The user's number in @c string format.
- *      @param datetime The year of the record multiplied by 100, plus the month of the record.
- *      @return The filename or @c NULL if the function failed.
+ *      Map csv
+ * 
+ *      @brief Maps the whole file behind a csv file pointer into memory in read-only mode. Only regular, non-empty files can be
+ *      mapped - pipes, terminals and empty files make the function fail, in which case the caller should fall back to @c fgets .
+ *      The mapping has to be released with @c unmap_csv .
+ * 
+ *      @param filepointer The @c FILE pointer for the csv.
+ *      @param length Set to the length of the mapped file in bytes.
+ * 
+ *      @returns A pointer to the first byte of the mapped file, or @c NULL if the file could not be mapped.
  */
-char *generate_cdr_filename(char *user_number, size_t datetime) {
-    size_t month = datetime % 100;
-    size_t year = (datetime - month) / 100;
-
-    if ((month > 12) || (year < TELEPHONE_INVENTION_YEAR) || (year > CURRENT_YEAR)) {
-        fprintf(stderr, "Invalid date found in cdr filename generator\n");
+char *map_csv(FILE *filepointer, size_t *length) {
+    if ((filepointer == NULL) || (length == NULL)) {
         return NULL;
-    }    
+    }
 
-    char *cdr_filename = malloc((strlen(user_number) + 20) * sizeof(char) /* 14 bytes are necessarry, 20 for extra breathing room*/);
-    if (cdr_filename == NULL) {
-        fprintf(stderr, "Failed to allocate memory for cdr filename\n");
+    int file_descriptor = fileno(filepointer);
+    if (file_descriptor < 0) {
         return NULL;
     }
-    
-    sprintf(cdr_filename, "%s-%lu-%lu-cdr.txt", user_number, month, year);
-
-    return cdr_filename;
-}
-
-/**
- *      Generate monthly bill filename
- *      @brief Generates a filename for a user's monthly bill based on the user's number and the year and month.
- *      Note that the returned filename is in a memory block that needs to be freed manually.
- *      
- *      @param user_number The user's number in @c string format.
- *      @param datetime The year of the record multiplied by 100, plus the month of the record.
- *      @return The filename or @c NULL if the function failed.
- */
-char *generate_monthly_bill_filename(char *user_number, size_t datetime) {
-    size_t month = datetime % 100;
-    size_t year = (datetime - month) / 100;
 
-    if ((month > 12) || (year < TELEPHONE_INVENTION_YEAR) || (year > CURRENT_YEAR)) {
-        fprintf(stderr, "Invalid date found in cdr filename generator\n");
+    struct stat file_stats;
+    if ((fstat(file_descriptor, &file_stats) != 0) || !(S_ISREG(file_stats.st_mode)) || (file_stats.st_size <= 0)) {
         return NULL;
     }
 
-    char *monthly_bill_filename = malloc((strlen(user_number) + 20) * sizeof(char) /* 9 bytes are necessarry, 20 for extra breathing room*/);
-    if (monthly_bill_filename == NULL) {
-        fprintf(stderr, "Failed to allocate memory for montly bill filename\n");
+    void *mapping = mmap(NULL, (size_t) file_stats.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+    if (mapping == MAP_FAILED) {
         return NULL;
     }
 
-    sprintf(monthly_bill_filename, "%s-%lu-%lu.txt", user_number, month, year);
+    // The file is read front to back exactly once
+    posix_madvise(mapping, (size_t) file_stats.st_size, POSIX_MADV_SEQUENTIAL);
 
-    return monthly_bill_filename;
+    *length = (size_t) file_stats.st_size;
+    return (char *) mapping;
 }
 
 /**
- *      Open monthly cdr bill
- *      @brief Opens a cdr file in write mode based on a filename.
- *      
- *      @param filename The filename of the cdr record to be opened.
- *      @return A file pointer to the file if successfull, otherwise @c NULL .
+ *      Unmap csv
+ * 
+ *      @brief Releases a mapping created by @c map_csv .
+ * 
+ *      @param mapping The pointer returned by @c map_csv .
+ *      @param length The length returned by @c map_csv .
+ * 
+ *      @returns An integer indicator of the function's success
+ *      @retval 0 If unmapping failed
+ *      @retval 1 If unmapping was successful
  */
-FILE *open_monthly_cdr_bill(char *filename) {
-    FILE *cdr_bill = fopen(filename, "w");
-    if (cdr_bill == NULL) {
-        fprintf(stderr, "Could not open file \"%s\", aborting\n", filename);
-        return NULL;
+int unmap_csv(char *mapping, size_t length) {
+    if (munmap(mapping, length) != 0) {
+        fprintf(stderr, "Unmapping csv file failed\n");
+        return 0;
     }
-    return cdr_bill;    
+    return 1;
 }
 
 /**
- *      Close monthly cdr bill
- *      @brief Close a file pointer to a cdr record file.
+ *      Add call records
+ * 
+ *      A path containing any of the characters "*?[" is expanded with @c glob , a directory contributes every file in it that
+ *      ends in ".csv" or ".csv.gz" and anything else is added as it is. Matches are added in alphabetical order. Files are
+ *      only opened once they are parsed, so hundreds of them don't have to be held open at the same time.
+ * 
+ *      @brief Adds one or more call record filenames to a list, based on a filename, directory or glob pattern.
  *      
- *      @param filepointer The file to be closed.
- *      @return 1 if successfull, 0 if not.
+ *      @param records The list the filenames are added to. Has to be zero initialized before its first use.
+ *      @param path The filename, directory or pattern.
+ *      @returns The number of filenames that were added. 0 if the path doesn't exist, matches nothing or memory ran out.
  */
-int close_monthly_cdr_bill(FILE *filepointer) {
-    if (filepointer == NULL) {
-        fprintf(stderr, "Cannot close NULL pointer\n");
-        return 0;
-    }
-    
-    if (fflush(filepointer) != 0) {
-        fprintf(stderr, "Flushing cdr file failed, aborting\n");
+size_t add_call_records(call_record_list *records, const char *path) {
+    if (path == NULL) {
         return 0;
     }
 
-    if (fclose(filepointer) != 0) {
-        fprintf(stderr, "Closing cdr file failed, aborting\n");
-        return 0;
-    }
-    return 1;
-}
+    size_t added = 0;
 
-/*****************************************************************************************************************
- * PATTERN CHECKING FUNCTIONS                                                                                    *
- *****************************************************************************************************************/
+    if (strpbrk(path, "*?[") != NULL) {
+        glob_t matches;
 
-/**
- *      Validate phone number
- *      @brief Checks if a phone number is legal based on E.164 and removes leading zeros. An exception is made for the
- *      string "Anonymous", which is returned unchanged.
- *      
- *      @param phone_number The number to be checked.
- *      @return A pointer to the validated number or NULL if it was found to be invalid.
- */
-char *validate_phone_number(char **phone_number) {
-    if (*phone_number == NULL) {
-        fprintf(stderr, "Cannot validate NULL string\n");
-        return NULL;
+        if (glob(path, 0, NULL, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                added += add_call_record_filename(records, matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
+        return added;
     }
 
-    if (strcmp(*phone_number, "Anonymous") == 0) {
-        return *phone_number;
-    }
-    
-    
-    while (**phone_number == '0') {
-        *phone_number = (*phone_number) + 1;
-    }
+    struct stat path_stats;
+    if ((stat(path, &path_stats) == 0) && (S_ISDIR(path_stats.st_mode))) {
+        struct dirent **entries = NULL;
+        int entry_count = scandir(path, &entries, is_call_record_entry, alphasort);
 
-    size_t phone_number_len = strlen(*phone_number);
+        if (entry_count < 0) {
+            return 0;
+        }
 
-    if (phone_number_len > 15 /* Should be correct according to E.164 */) {
-        fprintf(stderr, "Phone number too long - ");
-        return NULL;
+        for (int i = 0; i < entry_count; i++) {
+            char *filename = malloc(strlen(path) + strlen(entries[i]->d_name) + 2);
+            if (filename != NULL) {
+                sprintf(filename, "%s/%s", path, entries[i]->d_name);
+                added += add_call_record_filename(records, filename);
+                free(filename);
+            }
+            free(entries[i]);
+        }
+        free(entries);
+        return added;
     }
 
-    // Initialize the legality flag as zero to exclude region_codes that don't enter the loop at all (len = 0)
-    _Bool legal = 0;
+    // Standard input and named pipes don't have to pass the existence check
+    if ((strcmp(path, "-") != 0) && (access(path, R_OK) != 0)) {
+        return 0;
+    }
 
-    for (size_t i = 0; i < phone_number_len; i++) {
-        legal = 1;
+    return add_call_record_filename(records, path);
+}
 
-        if (!(isdigit((*phone_number)[i]))) {
-            legal = 0;
-            break;
+/**
+ *      Add call record filename
+ *      @brief Appends a copy of a single filename to a call record list, growing it if necessary.
+ *      
+ *      @param records The list the filename is appended to.
+ *      @param filename The filename to be copied.
+ *      @returns 1 if the filename was added, 0 if there is not enough memory.
+ */
+size_t add_call_record_filename(call_record_list *records, const char *filename) {
+    if (records->count == records->capacity) {
+        size_t new_capacity = (records->capacity == 0) ? 16 : records->capacity * 2;
+        char **new_filenames = realloc(records->filenames, new_capacity * sizeof(char *));
+
+        if (new_filenames == NULL) {
+            fprintf(stderr, "Not enough memory to add call record \"%s\"\n", filename);
+            return 0;
         }
+        records->filenames = new_filenames;
+        records->capacity = new_capacity;
     }
 
-    return legal ? *phone_number : NULL;    
+    char *filename_copy = malloc(strlen(filename) + 1);
+    if (filename_copy == NULL) {
+        fprintf(stderr, "Not enough memory to add call record \"%s\"\n", filename);
+        return 0;
+    }
+    strcpy(filename_copy, filename);
+
+    records->filenames[records->count] = filename_copy;
+    records->count++;
+
+    return 1;
 }
 
 /**
- *      Censor callee number
- *      @brief Replaces the final three digits of a phone number with '*'.
- *      Note that the censored number is in a new memory block that needs to be freed.
+ *      Is call record entry
+ *      @brief Directory filter that accepts entries ending in ".csv" or ".csv.gz". Used by @c add_call_records .
  *      
- *      @param callee_number The number to be cenosored
- *      @return A pointer to the censored number or @c NULL if the function failed.
+ *      @param entry The directory entry.
+ *      @returns 1 if the entry looks like a call record, 0 if not.
  */
-char *censor_calee_number(const char *callee_number) {
-    size_t callee_number_len = strlen(callee_number);
+int is_call_record_entry(const struct dirent *entry) {
+    size_t name_len = strlen(entry->d_name);
 
-    if (callee_number_len < 3) {
-        fprintf(stderr, "Callee number \"%s\" too short to be censored\n", callee_number);
-        return NULL;
+    if ((name_len > 4) && (strcmp(&entry->d_name[name_len - 4], ".csv") == 0)) {
+        return 1;
     }
+    return (name_len > 7) && (strcmp(&entry->d_name[name_len - 7], ".csv.gz") == 0);
+}
 
-    char *callee_number_censored = malloc((callee_number_len + 1) * sizeof(char));
-    if (callee_number_censored == NULL) {
-        fprintf(stderr, "Couldn't allocate memory for censoring a phone number\n");
-        return NULL;
+/**
+ *      Delete call record list
+ *      @brief Frees every filename of a call record list and resets it to its empty state.
+ *      
+ *      @param records The list to be emptied.
+ */
+void delete_call_record_list(call_record_list *records) {
+    for (size_t i = 0; i < records->count; i++) {
+        free(records->filenames[i]);
     }
-    
-    strcpy(callee_number_censored, callee_number);
+    free(records->filenames);
 
-    for (size_t i = callee_number_len - 3; i < callee_number_len; i++) {
-        *(callee_number_censored + i) = '*';
-    }
-    
-    return callee_number_censored;
+    records->filenames = NULL;
+    records->count = 0;
+    records->capacity = 0;
 }
 
 /**
- *      Validate region_code
+ *      Parse call records
  * 
- *      @brief Checks if a given region code is legal in E.164 and formats it by removing leading zeros, if need be.
+ *      A single call record is parsed by @c parse_call_csv with all @c thread_count threads. Several call records are
+ *      shared out between up to @c thread_count reader threads instead, each of which takes the next unparsed file, parses it
+ *      on its own and merges the result into its partial user tree. The partial trees are merged once every file has been
+ *      read. Every call keeps the index of its call record, so @c compare_call_nodes orders calls that started in the same
+ *      second by file and row and the merged lists do not depend on which reader parsed which file.
  * 
- *      @param region_code A double pointer to the region code. May be altered.
- *  
- *      @return A pointer to the valid region code or NULL
+ *      @brief Builds a single user tree from every call record in a list, reading several files at once.
+ *      
+ *      @param records The call records to be parsed.
+ *      @param thread_count The maximum number of threads used for parsing.
+ *      @param failed_records Increased by the number of call records that were opened but could not be read completely,
+ *      such as damaged or truncated compressed files. Their calls up to the error are still in the tree.
+ * 
+ *      @returns A pointer to the root of the generated avl tree.
  */
-char *validate_region_code(char **region_code){
-    if (*region_code == NULL) {
-        fprintf(stderr, "Cannot validate NULL string\n");
+user_node *parse_call_records(call_record_list *records, const rate_index *rates, size_t thread_count, size_t *failed_records, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
+
+    if (records->count == 0) {
         return NULL;
     }
-    
-    // Remove leading zeros
-    while ((**region_code == '0') || (**region_code == '+')) {
-        *region_code = (*region_code) + 1;
+
+    if (records->count == 1) {
+        FILE *call_record = open_csv(records->filenames[0]);
+        if (call_record == NULL) {
+            fprintf(stderr, "Could not open call record \"%s\" - invalid filename\n", records->filenames[0]);
+            return NULL;
+        }
+
+        user_node *root = parse_call_csv(call_record, 0, rates, thread_count, total_call_number, total_call_duration, total_call_price);
+        if (!(close_csv(call_record))) {
+            fprintf(stderr, "Call record \"%s\" could not be read completely\n", records->filenames[0]);
+            (*failed_records)++;
+        }
+        return root;
     }
-    
-    size_t region_code_len = strlen(*region_code);
 
-    if (region_code_len > 11) {
-        // region_code too long, invalid
-        return NULL;
+    // The calling thread reads too, so one thread less is started
+    size_t reader_count = (thread_count < records->count) ? thread_count : records->count;
+    size_t thread_reader_count = (reader_count > 1) ? reader_count - 1 : 0;
+
+    call_record_reader *readers = NULL;
+    pthread_t *threads = NULL;
+    _Bool *thread_started = NULL;
+
+    if (thread_reader_count > 0) {
+        readers = calloc(thread_reader_count, sizeof(call_record_reader));
+        threads = calloc(thread_reader_count, sizeof(pthread_t));
+        thread_started = calloc(thread_reader_count, sizeof(_Bool));
+
+        if ((readers == NULL) || (threads == NULL) || (thread_started == NULL)) {
+            fprintf(stderr, "Not enough memory to start call record readers, reading on a single thread\n");
+            thread_reader_count = 0;
+        }
     }
-    
-    // Initialize the legality flag as zero to exclude region_codes that don't enter the loop at all (len = 0)
-    _Bool legal = 0;
 
-    for (size_t i = 0; i < region_code_len; i++) {
-        legal = 1;
+    size_t next_record = 0;
+    pthread_mutex_t next_record_lock = PTHREAD_MUTEX_INITIALIZER;
 
-        if (!(isdigit((*region_code)[i]))) {
-            legal = 0;
-            break;
+    for (size_t i = 0; i < thread_reader_count; i++) {
+        readers[i].records = records;
+        readers[i].next_record = &next_record;
+        readers[i].next_record_lock = &next_record_lock;
+        readers[i].rates = rates;
+
+        thread_started[i] = (pthread_create(&threads[i], NULL, read_call_records, &readers[i]) == 0);
+    }
+
+    // Whatever the other readers leave over is read here, which also covers failed thread creation
+    call_record_reader main_reader = { .records = records, .next_record = &next_record, .next_record_lock = &next_record_lock,
+                                       .rates = rates, .root = NULL, .failed_records = 0,
+                                       .total_call_number = 0, .total_call_duration = 0, .total_call_price = 0 };
+    read_call_records(&main_reader);
+
+    user_node *root = main_reader.root;
+    *failed_records += main_reader.failed_records;
+    *total_call_number += main_reader.total_call_number;
+    *total_call_duration += main_reader.total_call_duration;
+    *total_call_price += main_reader.total_call_price;
+
+    for (size_t i = 0; i < thread_reader_count; i++) {
+        if (thread_started[i]) {
+            pthread_join(threads[i], NULL);
         }
+
+        root = merge_user_trees(root, readers[i].root);
+        *failed_records += readers[i].failed_records;
+
+        *total_call_number += readers[i].total_call_number;
+        *total_call_duration += readers[i].total_call_duration;
+        *total_call_price += readers[i].total_call_price;
     }
 
-    return legal ? *region_code : NULL;
+    pthread_mutex_destroy(&next_record_lock);
+
+    free(readers);
+    free(threads);
+    free(thread_started);
+
+    return root;
 }
 
 /**
- *      Validate rate
- *      @brief Checks if a string contains a valid call rate. Note that a string of dots will confuse the algorithm
+ *      Read call records
+ *      @brief Thread entry point that keeps taking the next unparsed file of a call record list until none are left, merging
+ *      each one into the reader's partial user tree. Files that cannot be opened are reported and skipped, files that fail
+ *      while being read are counted in the reader's @c failed_records .
  *      
- *      @param rate The rate to be checked.
- *      @returns The unchanged rate string if valid, otherwise NULL.
+ *      @param reader A pointer to the @c call_record_reader .
+ *      @returns @c NULL
  */
-char *validate_rate(char *rate){
-    if (rate == NULL) return NULL;
+void *read_call_records(void *reader) {
+    call_record_reader *current_reader = reader;
+
+    while (1) {
+        pthread_mutex_lock(current_reader->next_record_lock);
+        size_t record_index = *(current_reader->next_record);
+        if (record_index < current_reader->records->count) {
+            (*(current_reader->next_record))++;
+        }
+        pthread_mutex_unlock(current_reader->next_record_lock);
 
-    size_t i = 0;
-    while (*(rate + i) != '\0') {
-        if (!(isdigit(*(rate + i))) && (*(rate + i) != '.')) {
-            return NULL;
+        if (record_index >= current_reader->records->count) {
+            break;
         }
-        i++;
+
+        const char *filename = current_reader->records->filenames[record_index];
+        FILE *call_record = open_csv(filename);
+        if (call_record == NULL) {
+            fprintf(stderr, "Could not open call record \"%s\" - invalid filename, skipping it\n", filename);
+            continue;
+        }
+
+        user_node *record_root = parse_call_csv(call_record, record_index, current_reader->rates, 1, &(current_reader->total_call_number),
+                                                &(current_reader->total_call_duration), &(current_reader->total_call_price));
+        if (!(close_csv(call_record))) {
+            fprintf(stderr, "Call record \"%s\" could not be read completely\n", filename);
+            current_reader->failed_records++;
+        }
+
+        current_reader->root = merge_user_trees(current_reader->root, record_root);
     }
-    return rate;    
+
+    return NULL;
 }
 
 /**
- *      Search by longest region code match
- *      @brief Finds the longest region code match of a number in a rate binary search tree.
+ *      Parse call csv
+ * 
+ *      Regular files are mapped into memory with @c map_csv and walked in place - rows and fields are located by a
+ *      @c csv_scanner without copying or modifying the mapping, so no stdio calls or @c strlen scans happen per row. The mapping is split into
+ *      newline aligned chunks which are parsed by up to @c thread_count worker threads, each building its own partial user tree.
+ *      The partial trees are merged into the first one afterwards. Pipes and other files that cannot be mapped are streamed
+ *      through @c parse_call_stream on the calling thread instead. Potential error scenarions are:
+ *      @li A row in the csv is longer than @c MAX_CSV_LINE - 1 characters. The function will notify you, but won't attempt to salvage the row.
+ *      @li A field is missing or empty. Any rows with NaN fields will be discarded.
+ *      @li A datetime field is formatted incorrectly. The proper format is @c yyyy-mm-dd @c hh:mm:ss .
+ *      @li A duration field is not a plain number of seconds.
+ *      No special handling is in place for anonymous calls.
+ * 
+ *      @brief Builds a full user avl tree with a call linked list starting at each node list based on a csv file pointer.
  *      
- *      @param root The root of the rate tree to be searched for.
- *      @param callee_number The number whose longest region code match is to be found.
- *      @return The rate node with the longest match, or @c NULL if no matches have been found.
+ *      @param filename The @c FILE pointer for the csv.
+ *      @param source The index of the call record, stored with every call for ordering.
+ *      @param thread_count The maximum number of worker threads used for parsing. 1 parses on the calling thread.
  * 
+ *      @returns A pointer to the root of the generated avl tree.
  */
-rate_node *search_by_longest_region_code_match(rate_node *root, const char *callee_number) {
-    if (callee_number == NULL) {
-        fprintf(stderr, "Cannot search for NULL region code, aborting\n");
-        return NULL;
-    }
-    
-    rate_node *current_longest_match = NULL;
+user_node *parse_call_csv(FILE *filename, size_t source, const rate_index *rates, size_t thread_count, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
 
-    size_t attempt_length = 1;
+    user_node *root = NULL;
 
-    while (attempt_length <= strlen(callee_number)) {
-        //The block below copies the n starting digits of the callee number inro an array, then attempts to find a match
-        char callee_number_leading_segement[attempt_length + 1];        
-        strncpy(callee_number_leading_segement, callee_number, attempt_length);
-        callee_number_leading_segement[attempt_length] = '\0';
+    // Used for debugging
+    size_t line_counter = 1;
 
-        // Only save the search results if they are not NULL
-        rate_node *new_attempt = search_rate_tree(root, callee_number_leading_segement);
-        if (new_attempt != NULL) {
-            current_longest_match = new_attempt;
-        }
-        attempt_length++;
+    size_t mapping_length = 0;
+    char *mapping = map_csv(filename, &mapping_length);
+
+    if (mapping == NULL) {
+        // Pipes and other unmappable files are parsed as they arrive
+        return parse_call_stream(filename, source, rates, total_call_number, total_call_duration, total_call_price);
     }
-    //No match has been found
-    return current_longest_match;
-}
 
-/**
- *      Calculate call seconds
- *      @brief Calculate the second component of a call's duration.
- *      
- *      @param duration The duration of a call.
- *      @return The second component of a call.
- */
-size_t calculate_call_seconds(size_t duration) {
-    return duration % 60;
-}
+    // Small files are not worth the thread overhead
+    if (thread_count > (mapping_length / MIN_CHUNK_SIZE) + 1) {
+        thread_count = (mapping_length / MIN_CHUNK_SIZE) + 1;
+    }
 
-/**
- *      Calculate call minutes
- *      @brief Calculate the minute component of a call's duration.
- *      
- *      @param duration The duration of a call.
- *      @return The minute component of a call.
- */
-size_t calculate_call_minutes(size_t duration) {
-    return (duration - (3600 * (duration / 3600))) / 60;
-}
+    if (thread_count <= 1) {
+        rate_cache cache;
+        init_rate_cache(&cache, rates);
 
-/**
- *      Calculate call hours
- *      @brief Calculate the hour component of a call's duration.
- *      
- *      @param duration The duration of a call.
- *      @return The hour component of a call.
- */
-size_t calculate_call_hours(size_t duration) {
-    return duration / 3600;
-}
+        root = parse_call_range(mapping, mapping + mapping_length, source, &line_counter, root, &cache, total_call_number, total_call_duration, total_call_price);
 
-/**
- *      Max
- *      @brief Checks which of two integers is greater.
- *      
- *      @param a The first int to be compared.
- *      @param b The second int to be compared.
- *      @returns @c a if @c a is greater, @c b if @c b is equal or greater.
- */
-int max(int a, int b) {
-    return (a > b) ? a : b;
-}
+        delete_rate_cache(&cache);
+    } else {
+        root = parse_call_chunks(mapping, mapping_length, source, thread_count, rates, total_call_number, total_call_duration, total_call_price);
+    }
 
-/*****************************************************************************************************************
- * CALL LINKED LIST FUNCTIONS                                                                                    *
- *****************************************************************************************************************/
+    unmap_csv(mapping, mapping_length);
+    return root;
+}
 
 /**
- *      Insert call node
+ *      Parse call stream
+ * 
+ *      Data is read with @c read in blocks of up to @c STREAM_BUFFER_SIZE bytes, so whatever a pipe has to offer is consumed
+ *      at once and parsed right away instead of waiting for the writer to finish. Every complete row in the buffer is handed
+ *      to @c parse_call_range and an incomplete final row is carried over to the next read. Rows longer than the whole buffer
+ *      are reported and skipped up to their newline.
  * 
- *      @brief Inserts a new node into the call linked list so that the it remains ordered.
- *      If the head argument is NULL, it initializes a list instead.
+ *      @brief Builds a user tree from a non-seekable call csv stream such as standard input or a named pipe.
  *      
- *      @param head A double pointer to the head of the list, which will be changed dynamically.
- *      @param tail A double pointer to the tail of the list, which will be changed dynamically.
- *      @param callee_number The number that was called, cannot be NULL.
- *      @param duration The duration of the call.
- *      @param year The year the call took place in.
- *      @param month The month the call took place in.
- *      @param rate_root The root of the rate AVL tree in which the relevant region codes are stored.
+ *      @param stream The @c FILE pointer for the stream. Nothing may have been read from it through stdio yet.
+ *      @param source The index of the call record, stored with every call for ordering.
  * 
- *      @returns 1 if the function suceeds, 0 if it fails.
+ *      @returns A pointer to the root of the generated avl tree.
  */
-int insert_call(user_call_list **head, char *callee_number, size_t duration, size_t year, size_t month, size_t day, rate_node *rate_root, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
+user_node *parse_call_stream(FILE *stream, size_t source, const rate_index *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
 
-    if (callee_number == NULL) {
-        fprintf(stderr, "Callee number string empty, aborting\n");
-        return 0;
-    }
-    
-    user_call_list *new_node = malloc(sizeof(user_call_list));
-    if (new_node == NULL) {
-        fprintf(stderr, "Not enough memory to create new call linked list node\n");
-        return 0;
-    }
+    user_node *root = NULL;
 
-    // Initialize callee number
-    new_node->callee = malloc((strlen(callee_number) + 1) * sizeof(char));
-    if (new_node->callee == NULL) {
-        fprintf(stderr, "Not enough memory to initialize callee number\n");
-        return 0;
-    } else {
-        strcpy(new_node->callee, callee_number);    
+    char *buffer = malloc(STREAM_BUFFER_SIZE);
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory for the call record stream buffer, aborting\n");
+        return NULL;
     }
-    
-    new_node->duration = duration;
-    new_node->year = year;
-    new_node->month = month;
-    new_node->day = day;
 
-    rate_node *longest_rate_match = search_by_longest_region_code_match(rate_root, callee_number);
+    int file_descriptor = fileno(stream);
 
-    if (longest_rate_match == NULL) {
-        fprintf(stderr, "No rate match found for the number \"%s\", call price set to zero\n", new_node->callee);
-        new_node->price = 0;
-    } else {
-        new_node->price = (double) longest_rate_match->rate * duration;
+    rate_cache cache;
+    init_rate_cache(&cache, rates);
+
+    // Used for debugging
+    size_t line_counter = 1;
+
+    size_t buffer_fill = 0;
+    _Bool skipping_long_row = 0;
+
+    while (1) {
+        ssize_t bytes_read = read(file_descriptor, buffer + buffer_fill, STREAM_BUFFER_SIZE - buffer_fill);
+
+        if (bytes_read < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Reading line %lu from the call record stream failed, aborting\n", line_counter);
+            break;
+        } else if (bytes_read == 0) {
+            // End of stream
+            break;
+        }
+
+        buffer_fill += (size_t) bytes_read;
+
+        // Only complete rows are parsed, find the last newline
+        size_t complete_length = buffer_fill;
+        while ((complete_length > 0) && (buffer[complete_length - 1] != '\n')) {
+            complete_length--;
+        }
+
+        if (complete_length == 0) {
+            if (buffer_fill == STREAM_BUFFER_SIZE) {
+                // The row doesn't even fit into the buffer
+                if (!skipping_long_row) {
+                    report_diagnostic(DIAGNOSTIC_MALFORMED_CALL_LINE, "Call line %lu is longer than the %d byte stream buffer", line_counter, STREAM_BUFFER_SIZE);
+                    line_counter++;
+                    skipping_long_row = 1;
+                }
+                buffer_fill = 0;
+            }
+            continue;
+        }
+
+        size_t row_start = 0;
+        if (skipping_long_row) {
+            // Drop the rest of the long row
+            row_start = (size_t) ((const char *) memchr(buffer, '\n', complete_length) - buffer) + 1;
+            skipping_long_row = 0;
+        }
+
+        root = parse_call_range(buffer + row_start, buffer + complete_length, source, &line_counter, root, &cache, total_call_number, total_call_duration, total_call_price);
+
+        // Carry the incomplete row over
+        memmove(buffer, buffer + complete_length, buffer_fill - complete_length);
+        buffer_fill -= complete_length;
     }
 
-    // Global counters incremented here
-    (*total_call_number)++;
-    (*total_call_duration) += new_node->duration;
-    (*total_call_price) += new_node->price;
-    
-    if ((*head == NULL)) {
-        // The list is being initialized
+    if ((buffer_fill > 0) && !(skipping_long_row)) {
+        // The final row has no trailing newline
+        root = parse_call_range(buffer, buffer + buffer_fill, source, &line_counter, root, &cache, total_call_number, total_call_duration, total_call_price);
+    }
 
-        new_node->previous = NULL;
-        new_node->next = NULL;
+    delete_rate_cache(&cache);
+    free(buffer);
+    return root;
+}
 
-        *head = new_node;
-    } else {
-        // The node is being appended to an existing list
+/**
+ *      Parse call chunks
+ * 
+ *      The mapping is cut into @c thread_count byte ranges, each of which is extended to the end of the row it stops in. Rows
+ *      are counted per chunk in a first parallel pass so that logged line numbers stay absolute, and parsed in a second one.
+ *      If a worker thread cannot be started its chunk is handled on the calling thread instead.
+ * 
+ *      @brief Parses a mapped call csv on several worker threads and merges their partial user trees.
+ *      
+ *      @param mapping The mapped call csv.
+ *      @param mapping_length The length of the mapping in bytes.
+ *      @param source The index of the call record, stored with every call for ordering.
+ *      @param thread_count The number of chunks and worker threads.
+ * 
+ *      @returns A pointer to the root of the merged user tree.
+ */
+user_node *parse_call_chunks(const char *mapping, size_t mapping_length, size_t source, size_t thread_count, const rate_index *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
+
+    call_csv_chunk *chunks = calloc(thread_count, sizeof(call_csv_chunk));
+    pthread_t *threads = calloc(thread_count, sizeof(pthread_t));
+    _Bool *thread_started = calloc(thread_count, sizeof(_Bool));
+
+    if ((chunks == NULL) || (threads == NULL) || (thread_started == NULL)) {
+        fprintf(stderr, "Not enough memory to split the call record, parsing on a single thread\n");
+        free(chunks);
+        free(threads);
+        free(thread_started);
+        size_t line_counter = 1;
+        rate_cache cache;
+        init_rate_cache(&cache, rates);
+
+        user_node *root = parse_call_range(mapping, mapping + mapping_length, source, &line_counter, NULL, &cache, total_call_number, total_call_duration, total_call_price);
+
+        delete_rate_cache(&cache);
+        return root;
+    }
+
+    const char *mapping_end = mapping + mapping_length;
+    const char *chunk_start = mapping;
+
+    // Cut the mapping into newline aligned chunks
+    for (size_t i = 0; i < thread_count; i++) {
+        const char *chunk_end = mapping + ((mapping_length / thread_count) * (i + 1));
+
+        if ((i == thread_count - 1) || (chunk_end <= chunk_start)) {
+            chunk_end = (i == thread_count - 1) ? mapping_end : chunk_start;
+        } else {
+            const char *newline = memchr(chunk_end - 1, '\n', (size_t) (mapping_end - chunk_end + 1));
+            chunk_end = (newline == NULL) ? mapping_end : newline + 1;
+        }
+
+        chunks[i].start = chunk_start;
+        chunks[i].end = chunk_end;
+        chunks[i].source = source;
+        chunks[i].rates = rates;
+        chunk_start = chunk_end;
+    }
+
+    // First pass - count the rows of every chunk
+    for (size_t i = 0; i < thread_count; i++) {
+        thread_started[i] = (pthread_create(&threads[i], NULL, count_call_chunk_lines, &chunks[i]) == 0);
+        if (!thread_started[i]) {
+            count_call_chunk_lines(&chunks[i]);
+        }
+    }
+
+    size_t first_line = 1;
+    for (size_t i = 0; i < thread_count; i++) {
+        if (thread_started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        chunks[i].first_line = first_line;
+        first_line += chunks[i].line_count;
+    }
+
+    // Second pass - parse every chunk into a partial user tree
+    for (size_t i = 0; i < thread_count; i++) {
+        thread_started[i] = (pthread_create(&threads[i], NULL, parse_call_chunk, &chunks[i]) == 0);
+        if (!thread_started[i]) {
+            parse_call_chunk(&chunks[i]);
+        }
+    }
+
+    user_node *root = NULL;
+    for (size_t i = 0; i < thread_count; i++) {
+        if (thread_started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+
+        // Calls are ordered by time and row, so the merge gives the same lists as a single thread
+        root = merge_user_trees(root, chunks[i].root);
+
+        *total_call_number += chunks[i].total_call_number;
+        *total_call_duration += chunks[i].total_call_duration;
+        *total_call_price += chunks[i].total_call_price;
+    }
+
+    free(chunks);
+    free(threads);
+    free(thread_started);
+
+    return root;
+}
+
+/**
+ *      Count call chunk lines
+ *      @brief Thread entry point that counts the rows of a call csv chunk. A final row without a trailing newline counts too.
+ *      
+ *      @param chunk A pointer to the @c call_csv_chunk to be counted.
+ *      @returns @c NULL
+ */
+void *count_call_chunk_lines(void *chunk) {
+    call_csv_chunk *current_chunk = chunk;
+    const char *current = current_chunk->start;
+
+    current_chunk->line_count = 0;
+
+    while (current < current_chunk->end) {
+        const char *line_end = memchr(current, '\n', (size_t) (current_chunk->end - current));
+        current_chunk->line_count++;
+
+        if (line_end == NULL) {
+            break;
+        }
+        current = line_end + 1;
+    }
+    return NULL;
+}
+
+/**
+ *      Parse call chunk
+ *      @brief Thread entry point that parses a call csv chunk into the chunk's own user tree and totals.
+ *      
+ *      @param chunk A pointer to the @c call_csv_chunk to be parsed.
+ *      @returns @c NULL
+ */
+void *parse_call_chunk(void *chunk) {
+    call_csv_chunk *current_chunk = chunk;
+
+    current_chunk->total_call_number = 0;
+    current_chunk->total_call_duration = 0;
+    current_chunk->total_call_price = 0;
+
+    size_t line_counter = current_chunk->first_line;
+
+    rate_cache cache;
+    init_rate_cache(&cache, current_chunk->rates);
+
+    current_chunk->root = parse_call_range(current_chunk->start, current_chunk->end, current_chunk->source, &line_counter, NULL, &cache,
+                                        &(current_chunk->total_call_number), &(current_chunk->total_call_duration), &(current_chunk->total_call_price));
+
+    delete_rate_cache(&cache);
+    return NULL;
+}
+
+/**
+ *      Parse call range
+ *      @brief Parses every row in a range of a mapped call csv. The range has to start at the beginning of a row. Rows are
+ *      split in place by a @c csv_scanner , the mapping is never copied or modified.
+ *      
+ *      @param start The first byte of the range.
+ *      @param end One past the last byte of the range.
+ *      @param source The index of the call record the range belongs to, stored with every call for ordering.
+ *      @param line_counter The number of the first row in the range, used for logging. Advanced past the range's rows.
+ *      @param root The root of the user tree the calls are added to.
+ *      @returns The user tree's new root.
+ */
+user_node *parse_call_range(const char *start, const char *end, size_t source, size_t *line_counter, user_node *root, rate_cache *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
+
+    csv_scanner scanner;
+    csv_fields fields;
+
+    init_csv_scanner(&scanner, start, (size_t) (end - start));
+
+    const char *row = NULL;
+    while ((row = next_csv_row(&scanner, &fields)) != NULL) {
+
+        if (fields.row_length >= MAX_CSV_LINE) {
+            // We're dealing with a really long line
+            report_diagnostic(DIAGNOSTIC_MALFORMED_CALL_LINE, "Call line %lu is longer than %d characters", *line_counter, MAX_CSV_LINE - 1);
+        } else {
+            root = parse_call_line(row, &fields, source, *line_counter, root, rates, total_call_number, total_call_duration, total_call_price);
+        }
+
+        (*line_counter)++;
+    }
+    return root;
+}
+
+/**
+ *      Parse call line
+ * 
+ *      @brief Validates a single row of the call csv and adds the call to the user tree. Invalid rows are logged and discarded.
+ *      Used by @c parse_call_csv for both the mapped and the streamed reader.
+ *      
+ *      @param row The first byte of the row. Is not modified.
+ *      @param fields The field offsets of the row, as found by @c next_csv_row .
+ *      @param source The index of the call record the row belongs to, stored with the call for ordering.
+ *      @param line_counter The number of the row in the csv, used for logging.
+ *      @param root The root of the user tree the call is added to.
+ * 
+ *      @returns The user tree's new root.
+ */
+user_node *parse_call_line(const char *row, const csv_fields *fields, size_t source, size_t line_counter, user_node *root, rate_cache *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
+
+    decoded_call call;
+
+    if (decode_call_row(row, fields, line_counter, &call)) {
+        call.source = source;
         
-        if (get_call_node_datetime(new_node) <= get_call_node_datetime(*head)) {
-            // The new node comes before root
-            new_node->next = *head;
-            new_node->previous = NULL;
-            (*head)->previous = new_node;
-            *head = new_node;
+        /*********************************************************
+        * The necesarry data has been collected, create the node *
+        *********************************************************/
+        
+        root = add_user_node(root, &call, rates, total_call_number, total_call_duration, total_call_price);
+    }
+
+    return root;
+}
+
+/**
+ *      Decode call row
+ * 
+ *      @brief Validates a single row of the call csv and decodes its fields. Invalid rows are logged. Shared by the call
+ *      record parser and the binary call record converter.
+ *      
+ *      @param row The first byte of the row. Is not modified.
+ *      @param fields The field offsets of the row, as found by @c next_csv_row .
+ *      @param line_counter The number of the row in the csv, used for logging.
+ *      @param call Set to the decoded call.
+ * 
+ *      @returns 1 if the row is valid, 0 if it has to be discarded.
+ */
+int decode_call_row(const char *row, const csv_fields *fields, size_t line_counter, decoded_call *call) {
+
+    if ((fields->count == 1) && (fields->length[0] == 0)) {
+        report_diagnostic(DIAGNOSTIC_MALFORMED_CALL_LINE, "Call line %lu is empty", line_counter);
+        return 0;
+    }
+
+    if (fields->count < 4) {
+        report_diagnostic(DIAGNOSTIC_MALFORMED_CALL_LINE, "Call line %lu is missing %s", line_counter, (fields->count == 1) ? "three arguments" : (fields->count == 2) ? "two arguments" : "one argument");
+        return 0;
+    }
+
+    if (fields->count > 4) {
+        report_diagnostic(DIAGNOSTIC_MALFORMED_CALL_LINE, "Additional field found on call line %lu", line_counter);
+        return 0;
+    }
+
+    if ((fields->length[0] == 0) || (fields->length[1] == 0) || (fields->length[2] == 0) || (fields->length[3] == 0)) {
+        report_diagnostic(DIAGNOSTIC_MALFORMED_CALL_LINE, "Empty field found on call line %lu", line_counter);
+        return 0;
+    }
+
+    // The fields are decoded in place, the row is never copied
+    int caller_valid = encode_phone_number(row + fields->offset[0], fields->length[0], &(call->caller));
+    int callee_valid = encode_phone_number(row + fields->offset[1], fields->length[1], &(call->callee));
+
+    // Date extraction happens here
+    if (!(decode_call_datetime(row + fields->offset[3], fields->length[3], &(call->year), &(call->month), &(call->day), &(call->hour), &(call->minute), &(call->second)))) {
+        report_diagnostic(DIAGNOSTIC_INVALID_DATE, "Error: Invalid date found on line %lu", line_counter);
+        return 0;
+    } else if ((call->year > CURRENT_YEAR) || (call->year < TELEPHONE_INVENTION_YEAR)) {
+        report_diagnostic(DIAGNOSTIC_INVALID_DATE, "Error: Invalid year/month found on line %lu", line_counter);
+        return 0;
+    }
+
+    if (!(decode_call_duration(row + fields->offset[2], fields->length[2], &(call->duration)))) {
+        report_diagnostic(DIAGNOSTIC_INVALID_DURATION, "Error: Invalid duration found on line %lu", line_counter);
+        return 0;
+    }
+
+    if (!(caller_valid) || !(callee_valid)) {
+        report_diagnostic(DIAGNOSTIC_INVALID_NUMBER, "Invalid caller or callee number found on call line %lu", line_counter);
+        return 0;
+    }
+
+    call->line = line_counter;
+
+    return 1;
+}
+
+/**
+ *      Parse rate csv
+ * 
+ *      The iterative logic for parsing rows and fields is based on @c fgets and @c next_csv_row , respectfully. Potential error scenarions are:
+ *      @li A row in the csv is longer than @c MAX_CSV_LINE - 2 characters. The function will notify you, but won't attempt to salvage the row.
+ *      @li A field is missing or empty. Any rows with NaN fields will be discarded.
+ *      @li A range row overlaps another range row of the same length. The one with the higher first block is discarded.
+ * 
+ *      @brief Builds a full rate avl tree based on a csv file pointer. Range rows, whose region code is a block of numbers
+ *      given as its first and last block joined by a dash, go into a separate tree.
+ *      
+ *      @param filename The @c FILE pointer for the csv.
+ *      @param range_root Set to the root of the tree of range rows, @c NULL if there are none.
+ * 
+ *      @returns A pointer to the root of the generated avl tree.
+ */
+rate_node *parse_rate_csv(FILE *filename, rate_node **range_root) {
+
+    char csv_line[MAX_CSV_LINE];
+
+    rate_node *root = NULL;
+    *range_root = NULL;
+
+    // Used for debugging
+    size_t line_counter = 1;
+    while (!(feof(filename))) {
+        if ((fgets(csv_line, MAX_CSV_LINE, filename)) != NULL) {
+            
+            // Going smoothly, the line has been loaded in successfuly
+
+            if (((csv_line[strlen(csv_line) - 1]) == '\n')) {
+
+                // Remove the trailing newline from the csv row
+                csv_line[strlen(csv_line) - 1] = '\0';
+                
+            } else if (feof(filename)) {
+                // We've reached the end of the file
+                // printf("File ended\n");    
+            } else {
+                // We're dealing with a really long line
+                report_diagnostic(DIAGNOSTIC_MALFORMED_RATE_LINE, "Rate line %lu is longer than %d characters", line_counter, MAX_CSV_LINE - 2);
+                line_counter++;
+                continue;
+            } 
+                
+            csv_scanner scanner;
+            csv_fields fields;
+
+            init_csv_scanner(&scanner, csv_line, strlen(csv_line));
+            if ((next_csv_row(&scanner, &fields) == NULL) || ((fields.count == 1) && (fields.length[0] == 0))) {
+                report_diagnostic(DIAGNOSTIC_MALFORMED_RATE_LINE, "Line %lu is empty", line_counter);
+                line_counter++;
+                continue;
+            }
+
+            if (fields.count < 3) {
+                report_diagnostic(DIAGNOSTIC_MALFORMED_RATE_LINE, "Line %lu is missing %s", line_counter, (fields.count == 1) ? "two arguments" : "one argument");
+                line_counter++;
+                continue;
+            }
+
+            if (fields.count > 4) {
+                report_diagnostic(DIAGNOSTIC_MALFORMED_RATE_LINE, "Additional field found on line %lu", line_counter);
+                line_counter++;
+                continue;
+            }
+
+            if ((fields.length[0] == 0) || (fields.length[1] == 0) || (fields.length[2] == 0) || ((fields.count == 4) && (fields.length[3] == 0))) {
+                report_diagnostic(DIAGNOSTIC_MALFORMED_RATE_LINE, "Empty field found on line %lu", line_counter);
+                line_counter++;
+                continue;
+            }
+
+            char region_code_field[MAX_CSV_LINE];
+            char region_code_range[MAX_CSV_LINE];
+            char region_field[MAX_CSV_LINE];
+            char rate_field[MAX_CSV_LINE];
+
+            char *region_code_token = copy_csv_field(csv_line, &fields, 0, region_code_field);
+            char *region_token = copy_csv_field(csv_line, &fields, 1, region_field);
+            char *rate_token = copy_csv_field(csv_line, &fields, 2, rate_field);
+
+            rate_token = validate_rate(rate_token);
+            if (rate_token == NULL) {
+                report_diagnostic(DIAGNOSTIC_INVALID_RATE, "Invalid rate found on line %lu", line_counter);
+                line_counter++;
+                continue;
+            }
+            
+            double rate_token_d = strtod(rate_token, NULL);
+
+            // Rates without an effective date are in force from the beginning
+            uint32_t effective_date = 0;
+            if ((fields.count == 4) && !(decode_effective_date(csv_line + fields.offset[3], fields.length[3], &effective_date))) {
+                report_diagnostic(DIAGNOSTIC_INVALID_EFFECTIVE_DATE, "Invalid effective date found on line %lu", line_counter);
+                line_counter++;
+                continue;
+            }
+
+            int is_range = (strchr(region_code_token, '-') != NULL);
+
+            if (is_range) {
+                region_code_token = validate_region_code_range(region_code_token, region_code_range);
+            } else {
+                region_code_token = validate_region_code(&region_code_token);
+            }
+            
+            if (region_code_token != NULL) {
+                
+                /*********************************************************
+                * The necesarry data has been collected, create the node *
+                *********************************************************/
+                
+                uint32_t region = intern_region_name(region_token);
+                if (region == RATE_REGION_NONE) {
+                    fprintf(stderr, "Not enough memory to store the region of line %lu\n", line_counter);
+                    line_counter++;
+                    continue;
+                }
+
+                if (is_range) {
+                    *range_root = add_rate_node(*range_root, region_code_token, rate_token_d, effective_date, region);
+                } else {
+                    root = add_rate_node(root, region_code_token, rate_token_d, effective_date, region);
+                }
+
+            } else {
+                report_diagnostic(DIAGNOSTIC_INVALID_REGION_CODE, "Invalid region code found on line %lu", line_counter);
+                line_counter++;
+                continue;
+            }
+            
+        } else {
+            // Couldn't load a line in
+            fprintf(stderr, "Loading line %lu in csv file failed, aborting\n", line_counter);
+            break;
+        }
+        line_counter++;
+    }
+
+    *range_root = remove_overlapping_ranges(*range_root);
+
+    return root;
+}
+
+/**
+ *      Parse time band csv
+ * 
+ *      Every row sets the rate multiplier of a region code for a span of weekdays, 1 being Monday, and a span of hours on
+ *      each of them. A span is a single number or the first and last one joined by a dash, spans ending before they start
+ *      wrap around, so "22-6" covers the night. Rows of the same region code are added to the same time band, a later row
+ *      overrides the hours an earlier one already set. Invalid rows are counted and discarded.
+ * 
+ *      @brief Reads the time bands of a time band csv into a table.
+ *      
+ *      @param filename The @c FILE pointer for the csv.
+ *      @param table Set to the time bands found, empty if there are none. Has to be deleted with @c delete_time_band_table .
+ *      @return 1 if successful, 0 if there was not enough memory.
+ */
+int parse_time_band_csv(FILE *filename, time_band_table *table) {
+    char csv_line[MAX_CSV_LINE];
+
+    table->codes = NULL;
+    table->multipliers = NULL;
+    table->count = 0;
+
+    size_t line_counter = 1;
+    for (; fgets(csv_line, MAX_CSV_LINE, filename) != NULL; line_counter++) {
+        size_t line_length = strlen(csv_line);
+
+        if ((line_length > 0) && (csv_line[line_length - 1] == '\n')) {
+            line_length--;
+            csv_line[line_length] = '\0';
+        } else if (!(feof(filename))) {
+            report_diagnostic(DIAGNOSTIC_INVALID_TIME_BAND, "Time band line %lu is longer than %d characters", line_counter, MAX_CSV_LINE - 2);
+
+            // The rest of the line would otherwise be read as the next one
+            int skipped = 0;
+            while ((skipped != EOF) && (skipped != '\n')) {
+                skipped = fgetc(filename);
+            }
+            continue;
+        }
+
+        csv_scanner scanner;
+        csv_fields fields;
+
+        init_csv_scanner(&scanner, csv_line, line_length);
+        if ((next_csv_row(&scanner, &fields) == NULL) || (fields.count != 4) || (fields.length[0] == 0) || (fields.length[3] == 0)) {
+            report_diagnostic(DIAGNOSTIC_INVALID_TIME_BAND, "Time band line %lu does not have four fields", line_counter);
+            continue;
+        }
+
+        char region_code_field[MAX_CSV_LINE];
+        char multiplier_field[MAX_CSV_LINE];
+
+        char *region_code_token = copy_csv_field(csv_line, &fields, 0, region_code_field);
+        char *multiplier_token = copy_csv_field(csv_line, &fields, 3, multiplier_field);
+
+        size_t first_day = 0;
+        size_t last_day = 0;
+        size_t first_hour = 0;
+        size_t last_hour = 0;
+        phone_number code;
+
+        region_code_token = validate_region_code(&region_code_token);
+        multiplier_token = validate_rate(multiplier_token);
+
+        if ((region_code_token == NULL) || !(encode_phone_number(region_code_token, strlen(region_code_token), &code)) ||
+            !(decode_time_band_span(csv_line + fields.offset[1], fields.length[1], 1, 7, &first_day, &last_day)) ||
+            !(decode_time_band_span(csv_line + fields.offset[2], fields.length[2], 0, 23, &first_hour, &last_hour)) ||
+            (multiplier_token == NULL)) {
+            report_diagnostic(DIAGNOSTIC_INVALID_TIME_BAND, "Invalid time band found on line %lu", line_counter);
+            continue;
+        }
+
+        uint32_t band = intern_time_band(table, code);
+        if (band == TIME_BAND_NONE) {
+            fprintf(stderr, "Not enough memory to load the time bands\n");
+            return 0;
+        }
+
+        double multiplier = strtod(multiplier_token, NULL);
+        double *multipliers = &(table->multipliers[(band - 1) * TIME_BAND_SLOT_COUNT]);
+
+        for (size_t day = first_day; ; day = (day % 7) + 1) {
+            for (size_t hour = first_hour; ; hour = (hour + 1) % 24) {
+                multipliers[((day - 1) * 24) + hour] = multiplier;
+                if (hour == last_hour) {
+                    break;
+                }
+            }
+            if (day == last_day) {
+                break;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+/**
+ *      Generate cdr filename
+ *      @brief Generates a filename for a user's monthly cdr record based on the user's number and the year and month.
+ *      Note that the returned filename is in a memory block that needs to be freed manually.
+ *      
+ *      @param user_number The user's number in @c string format.
+ *      @param datetime The year of the record multiplied by 100, plus the month of the record.
+ *      @return The filename or @c NULL if the function failed.
+ */
+char *generate_cdr_filename(char *user_number, size_t datetime) {
+    size_t month = datetime % 100;
+    size_t year = (datetime - month) / 100;
+
+    if ((month > 12) || (year < TELEPHONE_INVENTION_YEAR) || (year > CURRENT_YEAR)) {
+        fprintf(stderr, "Invalid date found in cdr filename generator\n");
+        return NULL;
+    }    
+
+    char *cdr_filename = malloc((strlen(user_number) + 20) * sizeof(char) /* 14 bytes are necessarry, 20 for extra breathing room*/);
+    if (cdr_filename == NULL) {
+        fprintf(stderr, "Failed to allocate memory for cdr filename\n");
+        return NULL;
+    }
+    
+    sprintf(cdr_filename, "%s-%lu-%lu-cdr.txt", user_number, month, year);
+
+    return cdr_filename;
+}
+
+/**
+ *      Generate monthly bill filename
+ *      @brief Generates a filename for a user's monthly bill based on the user's number and the year and month.
+ *      Note that the returned filename is in a memory block that needs to be freed manually.
+ *      
+ *      @param user_number The user's number in @c string format.
+ *      @param datetime The year of the record multiplied by 100, plus the month of the record.
+ *      @return The filename or @c NULL if the function failed.
+ */
+char *generate_monthly_bill_filename(char *user_number, size_t datetime) {
+    size_t month = datetime % 100;
+    size_t year = (datetime - month) / 100;
+
+    if ((month > 12) || (year < TELEPHONE_INVENTION_YEAR) || (year > CURRENT_YEAR)) {
+        fprintf(stderr, "Invalid date found in cdr filename generator\n");
+        return NULL;
+    }
+
+    char *monthly_bill_filename = malloc((strlen(user_number) + 20) * sizeof(char) /* 9 bytes are necessarry, 20 for extra breathing room*/);
+    if (monthly_bill_filename == NULL) {
+        fprintf(stderr, "Failed to allocate memory for montly bill filename\n");
+        return NULL;
+    }
+
+    sprintf(monthly_bill_filename, "%s-%lu-%lu.txt", user_number, month, year);
+
+    return monthly_bill_filename;
+}
+
+/**
+ *      Open monthly cdr bill
+ *      @brief Opens a cdr file based on a filename.
+ *      
+ *      @param filename The filename of the cdr record to be opened.
+ *      @param mode The @c fopen mode, "w" to replace the file or "a" to append to it.
+ *      @return A file pointer to the file if successfull, otherwise @c NULL .
+ */
+FILE *open_monthly_cdr_bill(char *filename, const char *mode) {
+    FILE *cdr_bill = fopen(filename, mode);
+    if (cdr_bill == NULL) {
+        fprintf(stderr, "Could not open file \"%s\", aborting\n", filename);
+        return NULL;
+    }
+    return cdr_bill;    
+}
+
+/**
+ *      Close monthly cdr bill
+ *      @brief Close a file pointer to a cdr record file.
+ *      
+ *      @param filepointer The file to be closed.
+ *      @return 1 if successfull, 0 if not.
+ */
+int close_monthly_cdr_bill(FILE *filepointer) {
+    if (filepointer == NULL) {
+        fprintf(stderr, "Cannot close NULL pointer\n");
+        return 0;
+    }
+    
+    if (fflush(filepointer) != 0) {
+        fprintf(stderr, "Flushing cdr file failed, aborting\n");
+        return 0;
+    }
+
+    if (fclose(filepointer) != 0) {
+        fprintf(stderr, "Closing cdr file failed, aborting\n");
+        return 0;
+    }
+    return 1;
+}
+
+/*****************************************************************************************************************
+ * BINARY CALL RECORD FUNCTIONS                                                                                  *
+ *****************************************************************************************************************/
+
+/**
+ *      Convert call csv
+ * 
+ *      Every valid row of the csv is validated exactly like @c parse_call_csv would and stored as a fixed width
+ *      @c binary_call_record . Invalid rows are logged and left out, so the binary file only holds calls that will be billed.
+ *      The header is written first with a record count of 0 and rewritten once all records are in place.
+ * 
+ *      @brief Converts a call csv into a binary call record file.
+ *      
+ *      @param csv The @c FILE pointer for the call csv. Has to be a regular file.
+ *      @param binary The @c FILE pointer for the binary file, opened for writing in binary mode. Has to be seekable.
+ * 
+ *      @returns The number of records written, or 0 if the conversion failed.
+ */
+size_t convert_call_csv(FILE *csv, FILE *binary) {
+    size_t mapping_length = 0;
+    char *mapping = map_csv(csv, &mapping_length);
+
+    if (mapping == NULL) {
+        fprintf(stderr, "Only regular, non-empty call csv files can be converted\n");
+        return 0;
+    }
+
+    binary_call_header header;
+    init_binary_call_header(&header, 0);
+
+    if (fwrite(&header, sizeof(header), 1, binary) != 1) {
+        fprintf(stderr, "Writing the binary call record header failed, aborting\n");
+        unmap_csv(mapping, mapping_length);
+        return 0;
+    }
+
+    csv_scanner scanner;
+    csv_fields fields;
+    decoded_call call;
+    binary_call_record record;
+
+    size_t line_counter = 1;
+    size_t record_count = 0;
+
+    init_csv_scanner(&scanner, mapping, mapping_length);
+
+    const char *row = NULL;
+    while ((row = next_csv_row(&scanner, &fields)) != NULL) {
+
+        if (fields.row_length >= MAX_CSV_LINE) {
+            // We're dealing with a really long line
+            report_diagnostic(DIAGNOSTIC_MALFORMED_CALL_LINE, "Call line %lu is longer than %d characters", line_counter, MAX_CSV_LINE - 1);
+        } else if (decode_call_row(row, &fields, line_counter, &call)) {
+
+            if (!(encode_binary_call(&call, &record))) {
+                fprintf(stderr, "Call on line %lu cannot be stored in the binary format\n", line_counter);
+            } else if (fwrite(&record, sizeof(record), 1, binary) != 1) {
+                fprintf(stderr, "Writing binary call record %lu failed, aborting\n", record_count);
+                unmap_csv(mapping, mapping_length);
+                return 0;
+            } else {
+                record_count++;
+            }
+        }
+        line_counter++;
+    }
+
+    unmap_csv(mapping, mapping_length);
+
+    // Now that the count is known, rewrite the header
+    init_binary_call_header(&header, record_count);
+
+    if ((fseek(binary, 0, SEEK_SET) != 0) || (fwrite(&header, sizeof(header), 1, binary) != 1)) {
+        fprintf(stderr, "Updating the binary call record header failed, aborting\n");
+        return 0;
+    }
+
+    return record_count;
+}
+
+/**
+ *      Load binary call record
+ * 
+ *      The file is mapped and each record is handed to @c add_user_node as it is - the numbers are already integers, so no
+ *      tokenizing, validation or conversion to text takes place, since all of that has been done by @c convert_call_csv . Records with impossible dates are still skipped
+ *      so that a damaged file cannot break bill generation.
+ * 
+ *      @brief Builds a full user avl tree from a binary call record file.
+ *      
+ *      @param binary The @c FILE pointer for the binary call record file.
+ * 
+ *      @returns A pointer to the root of the generated avl tree, or @c NULL if the file is invalid.
+ */
+user_node *load_binary_call_record(FILE *binary, const rate_index *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
+    size_t mapping_length = 0;
+    char *mapping = map_csv(binary, &mapping_length);
+
+    if (mapping == NULL) {
+        fprintf(stderr, "Binary call record could not be mapped\n");
+        return NULL;
+    }
+
+    const binary_call_header *header = (const binary_call_header *) mapping;
+
+    if (!(check_binary_call_header(header, mapping_length))) {
+        unmap_csv(mapping, mapping_length);
+        return NULL;
+    }
+
+    const binary_call_record *records = (const binary_call_record *) (mapping + sizeof(binary_call_header));
+
+    user_node *root = NULL;
+    decoded_call call;
+
+    rate_cache cache;
+    init_rate_cache(&cache, rates);
+
+    for (uint64_t i = 0; i < header->record_count; i++) {
+        if (!(decode_binary_call(&records[i], &call))) {
+            report_diagnostic(DIAGNOSTIC_INVALID_BINARY_RECORD, "Invalid binary call record %" PRIu64 " skipped", i);
+            continue;
+        }
+
+        // Records keep the order of the rows they were converted from
+        call.source = 0;
+        call.line = (size_t) i + 1;
+
+        root = add_user_node(root, &call, &cache, total_call_number, total_call_duration, total_call_price);
+    }
+
+    delete_rate_cache(&cache);
+    unmap_csv(mapping, mapping_length);
+    return root;
+}
+
+/**
+ *      Init binary call header
+ *      @brief Fills in a binary call record header for the current format version and platform.
+ *      
+ *      @param header The header to be filled in.
+ *      @param record_count The number of records following the header.
+ */
+void init_binary_call_header(binary_call_header *header, uint64_t record_count) {
+    memset(header, 0, sizeof(binary_call_header));
+    memcpy(header->magic, BINARY_CALL_MAGIC, sizeof(header->magic));
+
+    header->version = BINARY_CALL_VERSION;
+    header->record_size = sizeof(binary_call_record);
+    header->byte_order = BINARY_CALL_BYTE_ORDER;
+    header->record_count = record_count;
+}
+
+/**
+ *      Check binary call header
+ *      @brief Checks that a mapped binary call record file was written in the current format on a compatible platform and
+ *      holds as many records as its header claims.
+ *      
+ *      @param header The header at the start of the mapped file.
+ *      @param length The length of the mapped file in bytes.
+ *      @return 1 if the file can be loaded, 0 if not.
+ */
+int check_binary_call_header(const binary_call_header *header, size_t length) {
+    if ((length < sizeof(binary_call_header)) || (memcmp(header->magic, BINARY_CALL_MAGIC, sizeof(header->magic)) != 0)) {
+        fprintf(stderr, "File is not a binary call record\n");
+        return 0;
+    }
+
+    if ((header->version != BINARY_CALL_VERSION) || (header->record_size != sizeof(binary_call_record)) || (header->byte_order != BINARY_CALL_BYTE_ORDER)) {
+        fprintf(stderr, "Binary call record was written by an incompatible version or platform, convert it again\n");
+        return 0;
+    }
+
+    if (header->record_count > (length - sizeof(binary_call_header)) / sizeof(binary_call_record)) {
+        fprintf(stderr, "Binary call record is truncated\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ *      Encode binary call
+ *      @brief Packs a validated call into a binary call record. Anonymous callers are stored as number 0, the same as their
+ *      encoded form, which no valid number can take since leading zeros are removed during validation.
+ *      
+ *      @param call The validated call.
+ *      @param record The record to be filled in.
+ *      @return 1 if successful, 0 if the call does not fit into the format.
+ */
+int encode_binary_call(const decoded_call *call, binary_call_record *record) {
+    if (call->duration > UINT32_MAX) {
+        return 0;
+    }
+
+    memset(record, 0, sizeof(binary_call_record));
+
+    record->caller = call->caller.value;
+    record->callee = call->callee.value;
+    record->duration = (uint32_t) call->duration;
+    record->date = (uint32_t) ((call->year << 9) | (call->month << 5) | call->day);
+    record->time = (uint32_t) ((call->hour * 3600) + (call->minute * 60) + call->second);
+
+    return 1;
+}
+
+/**
+ *      Decode binary call
+ *      @brief Unpacks a binary call record into a call that can be added to the user tree.
+ *      
+ *      @param record The record to be unpacked.
+ *      @param call The call to be filled in.
+ *      @return 1 if successful, 0 if the record holds an impossible date or number.
+ */
+int decode_binary_call(const binary_call_record *record, decoded_call *call) {
+    call->year = record->date >> 9;
+    call->month = (record->date >> 5) & 0xF;
+    call->day = record->date & 0x1F;
+
+    if ((call->month < 1) || (call->month > 12) || (call->day < 1) || (call->year > CURRENT_YEAR) || (call->year < TELEPHONE_INVENTION_YEAR)) {
+        return 0;
+    }
+
+    call->hour = record->time / 3600;
+    call->minute = (record->time / 60) % 60;
+    call->second = record->time % 60;
+    call->duration = record->duration;
+
+    if ((record->caller >= power_of_ten(MAX_PHONE_NUMBER_LENGTH)) || (record->callee >= power_of_ten(MAX_PHONE_NUMBER_LENGTH))) {
+        return 0;
+    }
+
+    // Anonymous numbers are stored as 0, which has no digits
+    call->caller.value = record->caller;
+    call->caller.digits = count_digits(record->caller);
+    call->callee.value = record->callee;
+    call->callee.digits = count_digits(record->callee);
+
+    return 1;
+}
+
+/*****************************************************************************************************************
+ * INCREMENTAL INGEST FUNCTIONS                                                                                  *
+ *****************************************************************************************************************/
+
+/**
+ *      Load ingest checkpoint
+ *      @brief Reads an ingest checkpoint file. A missing file is not an error, it leaves an empty checkpoint so that the
+ *      first incremental run parses the whole call record.
+ *      
+ *      @param filename The filename of the checkpoint.
+ *      @param checkpoint Set to the loaded checkpoint. Has to be released with @c delete_ingest_checkpoint .
+ *      @return 1 if the checkpoint was loaded or doesn't exist yet, 0 if it could not be read.
+ */
+int load_ingest_checkpoint(const char *filename, ingest_checkpoint *checkpoint) {
+    checkpoint->aggregates = NULL;
+    reset_ingest_checkpoint(checkpoint);
+
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        if (errno == ENOENT) {
+            return 1;
+        }
+        fprintf(stderr, "Could not open ingest checkpoint \"%s\"\n", filename);
+        return 0;
+    }
+
+    ingest_checkpoint_header header;
+
+    if ((fread(&header, sizeof(header), 1, file) != 1) || (memcmp(header.magic, INGEST_CHECKPOINT_MAGIC, sizeof(header.magic)) != 0)) {
+        fprintf(stderr, "\"%s\" is not an ingest checkpoint\n", filename);
+        fclose(file);
+        return 0;
+    }
+
+    if ((header.version != INGEST_CHECKPOINT_VERSION) || (header.byte_order != BINARY_CALL_BYTE_ORDER) || (header.aggregate_size != sizeof(monthly_aggregate))) {
+        fprintf(stderr, "Ingest checkpoint \"%s\" was written by an incompatible version or platform\n", filename);
+        fclose(file);
+        return 0;
+    }
+
+    if (header.aggregate_count > (SIZE_MAX / sizeof(monthly_aggregate))) {
+        fprintf(stderr, "Ingest checkpoint \"%s\" is corrupt\n", filename);
+        fclose(file);
+        return 0;
+    }
+
+    size_t aggregate_count = (size_t) header.aggregate_count;
+
+    if (aggregate_count > 0) {
+        checkpoint->aggregates = malloc(aggregate_count * sizeof(monthly_aggregate));
+        if (checkpoint->aggregates == NULL) {
+            fprintf(stderr, "Not enough memory to load ingest checkpoint \"%s\"\n", filename);
+            fclose(file);
+            return 0;
+        }
+
+        if (fread(checkpoint->aggregates, sizeof(monthly_aggregate), aggregate_count, file) != aggregate_count) {
+            fprintf(stderr, "Ingest checkpoint \"%s\" is truncated\n", filename);
+            free(checkpoint->aggregates);
+            checkpoint->aggregates = NULL;
+            fclose(file);
+            return 0;
+        }
+    }
+
+    fclose(file);
+
+    checkpoint->header = header;
+    return 1;
+}
+
+/**
+ *      Save ingest checkpoint
+ *      @brief Writes an ingest checkpoint file. The checkpoint is written next to the old one and renamed over it, so an
+ *      interrupted run never leaves a half written checkpoint behind.
+ *      
+ *      @param filename The filename of the checkpoint.
+ *      @param checkpoint The checkpoint to be written.
+ *      @return 1 if successful, 0 if not.
+ */
+int save_ingest_checkpoint(const char *filename, const ingest_checkpoint *checkpoint) {
+    char *temporary_filename = malloc(strlen(filename) + 5);
+    if (temporary_filename == NULL) {
+        fprintf(stderr, "Not enough memory to save the ingest checkpoint\n");
+        return 0;
+    }
+    sprintf(temporary_filename, "%s.tmp", filename);
+
+    FILE *file = fopen(temporary_filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open \"%s\" for writing\n", temporary_filename);
+        free(temporary_filename);
+        return 0;
+    }
+
+    size_t aggregate_count = (size_t) checkpoint->header.aggregate_count;
+
+    int written = (fwrite(&(checkpoint->header), sizeof(checkpoint->header), 1, file) == 1) &&
+                  ((aggregate_count == 0) || (fwrite(checkpoint->aggregates, sizeof(monthly_aggregate), aggregate_count, file) == aggregate_count));
+
+    if ((fclose(file) != 0) || !(written) || (rename(temporary_filename, filename) != 0)) {
+        fprintf(stderr, "Writing the ingest checkpoint \"%s\" failed\n", filename);
+        remove(temporary_filename);
+        free(temporary_filename);
+        return 0;
+    }
+
+    free(temporary_filename);
+    return 1;
+}
+
+/**
+ *      Reset ingest checkpoint
+ *      @brief Empties a checkpoint, so that the call record is parsed from its first row.
+ *      
+ *      @param checkpoint The checkpoint to be reset.
+ */
+void reset_ingest_checkpoint(ingest_checkpoint *checkpoint) {
+    free(checkpoint->aggregates);
+    checkpoint->aggregates = NULL;
+
+    memset(&(checkpoint->header), 0, sizeof(checkpoint->header));
+    memcpy(checkpoint->header.magic, INGEST_CHECKPOINT_MAGIC, sizeof(checkpoint->header.magic));
+    checkpoint->header.version = INGEST_CHECKPOINT_VERSION;
+    checkpoint->header.byte_order = BINARY_CALL_BYTE_ORDER;
+    checkpoint->header.aggregate_size = sizeof(monthly_aggregate);
+}
+
+/**
+ *      Delete ingest checkpoint
+ *      @brief Frees the aggregates of a checkpoint.
+ *      
+ *      @param checkpoint The checkpoint to be freed.
+ */
+void delete_ingest_checkpoint(ingest_checkpoint *checkpoint) {
+    free(checkpoint->aggregates);
+    checkpoint->aggregates = NULL;
+    checkpoint->header.aggregate_count = 0;
+}
+
+/**
+ *      Parse call csv incremental
+ * 
+ *      Only the bytes appended since the checkpoint was taken are mapped and parsed. A final row without a newline may still
+ *      be in the middle of being written, so it is left for the next run. If the call record was replaced or has become
+ *      shorter than the checkpoint, the bills and cdr files of the checkpoint are deleted, the checkpoint is reset and the
+ *      whole file is parsed again, so no month that is missing from the new file keeps its old files.
+ * 
+ *      @brief Builds a user tree from the calls that were added to a call record since the last checkpoint, and moves the
+ *      checkpoint past them.
+ *      
+ *      @param call_record The @c FILE pointer of the call record. Has to be a regular file.
+ *      @param checkpoint The checkpoint to resume from. Its offsets and totals are advanced, its aggregates are left alone.
+ *      @param root Set to the root of the new calls' user tree, @c NULL if there are none.
+ * 
+ *      @returns 1 if successful, 0 if the call record is not a regular file or could not be mapped.
+ */
+int parse_call_csv_incremental(FILE *call_record, const rate_index *rates, ingest_checkpoint *checkpoint, user_node **root) {
+    *root = NULL;
+
+    struct stat call_record_stats;
+    if ((fstat(fileno(call_record), &call_record_stats) != 0) || !(S_ISREG(call_record_stats.st_mode))) {
+        fprintf(stderr, "Incremental runs need a regular call record file\n");
+        return 0;
+    }
+
+    ingest_checkpoint_header *header = &(checkpoint->header);
+
+    if ((header->byte_offset > 0) && ((header->device != (uint64_t) call_record_stats.st_dev) ||
+        (header->inode != (uint64_t) call_record_stats.st_ino) || (header->byte_offset > (uint64_t) call_record_stats.st_size))) {
+        fprintf(stderr, "The call record was replaced or truncated since the last checkpoint, parsing it from the start\n");
+        delete_checkpoint_files(checkpoint);
+        reset_ingest_checkpoint(checkpoint);
+    }
+
+    header->device = (uint64_t) call_record_stats.st_dev;
+    header->inode = (uint64_t) call_record_stats.st_ino;
+
+    if (header->byte_offset == (uint64_t) call_record_stats.st_size) {
+        // Nothing has been appended
+        return 1;
+    }
+
+    size_t mapping_length = 0;
+    char *mapping = map_csv(call_record, &mapping_length);
+    if (mapping == NULL) {
+        fprintf(stderr, "The call record could not be mapped\n");
+        return 0;
+    }
+
+    const char *start = mapping + header->byte_offset;
+    const char *end = mapping + mapping_length;
+
+    // A row that is still being appended is left for the next run
+    while ((end > start) && (end[-1] != '\n')) {
+        end--;
+    }
+
+    size_t line_counter = (size_t) header->line_count + 1;
+    size_t total_call_number = 0;
+    size_t total_call_duration = 0;
+    double total_call_price = 0;
+
+    rate_cache cache;
+    init_rate_cache(&cache, rates);
+
+    *root = parse_call_range(start, end, 0, &line_counter, NULL, &cache, &total_call_number, &total_call_duration, &total_call_price);
+
+    delete_rate_cache(&cache);
+
+    header->byte_offset = (uint64_t) (end - mapping);
+    header->line_count = (uint64_t) (line_counter - 1);
+    header->total_call_number += total_call_number;
+    header->total_call_duration += total_call_duration;
+    header->total_call_price += total_call_price;
+
+    unmap_csv(mapping, mapping_length);
+    return 1;
+}
+
+/**
+ *      Delete checkpoint files
+ *      @brief Deletes the bill and cdr file of every month in a checkpoint. Files that are already gone are skipped.
+ *      
+ *      @param checkpoint The checkpoint whose files are to be deleted.
+ */
+void delete_checkpoint_files(const ingest_checkpoint *checkpoint) {
+    for (size_t i = 0; i < (size_t) checkpoint->header.aggregate_count; i++) {
+        const monthly_aggregate *aggregate = &(checkpoint->aggregates[i]);
+
+        phone_number caller = { .value = aggregate->caller, .digits = aggregate->caller_digits };
+        char caller_number_string[MAX_PHONE_NUMBER_LENGTH + 1];
+        format_phone_number(caller, caller_number_string);
+
+        char *cdr_filename = generate_cdr_filename(caller_number_string, aggregate->datetime);
+        char *bill_filename = generate_monthly_bill_filename(caller_number_string, aggregate->datetime);
+
+        if (cdr_filename != NULL) {
+            remove(cdr_filename);
+        }
+        if (bill_filename != NULL) {
+            remove(bill_filename);
+        }
+
+        free(cdr_filename);
+        free(bill_filename);
+    }
+}
+
+/**
+ *      Update ingest checkpoint
+ * 
+ *      The new calls are summed up per user and month and merged into the checkpoint's sorted aggregates in a single pass.
+ *      Every month the new calls fall into gets its new calls appended to its cdr file and its bill rewritten from the
+ *      merged totals, files of other months are left untouched. The cdr file is cut back to the length recorded in the
+ *      checkpoint first, so the calls of a run that failed before saving its checkpoint are not written twice.
+ * 
+ *      @brief Adds the calls of a user tree to a checkpoint's monthly aggregates and writes the affected cdr files and bills.
+ *      The checkpoint has to be saved afterwards to commit them.
+ *      
+ *      @param checkpoint The checkpoint to be updated.
+ *      @param root The root of the new calls' user tree. May be @c NULL .
+ *      @return 1 if successful, 0 if there was not enough memory or a file could not be written.
+ */
+int update_ingest_checkpoint(ingest_checkpoint *checkpoint, user_node *root) {
+    monthly_aggregate *new_aggregates = NULL;
+    user_call_list **first_calls = NULL;
+    size_t new_count = 0;
+    size_t new_capacity = 0;
+
+    if (!(collect_monthly_aggregates(root, &new_aggregates, &first_calls, &new_count, &new_capacity))) {
+        free(new_aggregates);
+        free(first_calls);
+        return 0;
+    }
+
+    if (new_count == 0) {
+        return 1;
+    }
+
+    size_t old_count = (size_t) checkpoint->header.aggregate_count;
+    monthly_aggregate *merged_aggregates = malloc((old_count + new_count) * sizeof(monthly_aggregate));
+    if (merged_aggregates == NULL) {
+        fprintf(stderr, "Not enough memory to update the ingest checkpoint\n");
+        free(new_aggregates);
+        free(first_calls);
+        return 0;
+    }
+
+    size_t old_index = 0;
+    size_t new_index = 0;
+    size_t merged_count = 0;
+
+    while ((old_index < old_count) || (new_index < new_count)) {
+        int comparison = (old_index == old_count) ? 1 : (new_index == new_count) ? -1 :
+                         compare_monthly_aggregates(&(checkpoint->aggregates[old_index]), &(new_aggregates[new_index]));
+
+        if (comparison < 0) {
+            merged_aggregates[merged_count++] = checkpoint->aggregates[old_index++];
+            continue;
+        }
+
+        monthly_aggregate *merged = &(merged_aggregates[merged_count++]);
+        user_call_list *first_call = first_calls[new_index];
+        *merged = new_aggregates[new_index++];
+
+        uint64_t committed_length = 0;
+
+        if (comparison == 0) {
+            merged->call_count += checkpoint->aggregates[old_index].call_count;
+            merged->call_duration += checkpoint->aggregates[old_index].call_duration;
+            merged->bill += checkpoint->aggregates[old_index].bill;
+            committed_length = checkpoint->aggregates[old_index].cdr_length;
+            old_index++;
+        }
+
+        phone_number caller = { .value = merged->caller, .digits = merged->caller_digits };
+        char caller_number_string[MAX_PHONE_NUMBER_LENGTH + 1];
+        format_phone_number(caller, caller_number_string);
+
+        if (!(append_monthly_cdr_file(caller_number_string, merged->datetime, first_call, committed_length, &(merged->cdr_length))) ||
+            !(write_monthly_bill(caller_number_string, merged->datetime, (size_t) merged->call_count, (size_t) merged->call_duration, merged->bill))) {
+            free(new_aggregates);
+            free(first_calls);
+            free(merged_aggregates);
+            return 0;
+        }
+    }
+
+    free(new_aggregates);
+    free(first_calls);
+    free(checkpoint->aggregates);
+
+    checkpoint->aggregates = merged_aggregates;
+    checkpoint->header.aggregate_count = merged_count;
+
+    return 1;
+}
+
+/**
+ *      Collect monthly aggregates
+ *      @brief Recursively sums up the calls of every user in a tree per month, appending the results to a growing array.
+ *      Users are visited in order and their call lists are ordered by month, so the array comes out sorted.
+ *      
+ *      @param node The root of the user tree. May be @c NULL .
+ *      @param aggregates The array the aggregates are appended to. Reallocated as needed.
+ *      @param first_calls The array the first call of every aggregate's month is appended to. Grows along with @c aggregates .
+ *      @param count The number of aggregates in the array.
+ *      @param capacity The number of aggregates there is room for.
+ *      @return 1 if successful, 0 if there was not enough memory.
+ */
+int collect_monthly_aggregates(user_node *node, monthly_aggregate **aggregates, user_call_list ***first_calls, size_t *count, size_t *capacity) {
+    if (node == NULL) {
+        return 1;
+    }
+
+    if (!(collect_monthly_aggregates(node->left, aggregates, first_calls, count, capacity))) {
+        return 0;
+    }
+
+    user_call_list *current_call = node->call_list_head;
+
+    while (current_call != NULL) {
+        uint32_t datetime = (uint32_t) get_call_node_datetime(current_call);
+
+        if ((*count == 0) || ((*aggregates)[*count - 1].datetime != datetime) || ((*aggregates)[*count - 1].caller != node->key.value) ||
+            ((*aggregates)[*count - 1].caller_digits != node->key.digits)) {
+
+            if (*count == *capacity) {
+                size_t new_capacity = (*capacity == 0) ? 1024 : *capacity * 2;
+                monthly_aggregate *new_aggregates = realloc(*aggregates, new_capacity * sizeof(monthly_aggregate));
+                if (new_aggregates == NULL) {
+                    fprintf(stderr, "Not enough memory to collect monthly aggregates\n");
+                    return 0;
+                }
+                *aggregates = new_aggregates;
+
+                user_call_list **new_first_calls = realloc(*first_calls, new_capacity * sizeof(user_call_list *));
+                if (new_first_calls == NULL) {
+                    fprintf(stderr, "Not enough memory to collect monthly aggregates\n");
+                    return 0;
+                }
+                *first_calls = new_first_calls;
+                *capacity = new_capacity;
+            }
+
+            monthly_aggregate *aggregate = &((*aggregates)[*count]);
+            memset(aggregate, 0, sizeof(monthly_aggregate));
+            aggregate->caller = node->key.value;
+            aggregate->caller_digits = node->key.digits;
+            aggregate->datetime = datetime;
+            (*first_calls)[*count] = current_call;
+            (*count)++;
+        }
+
+        monthly_aggregate *aggregate = &((*aggregates)[*count - 1]);
+        aggregate->call_count++;
+        aggregate->call_duration += current_call->duration;
+        aggregate->bill += current_call->price;
+
+        current_call = current_call->next;
+    }
+
+    return collect_monthly_aggregates(node->right, aggregates, first_calls, count, capacity);
+}
+
+/**
+ *      Append monthly cdr file
+ *      @brief Cuts a user's cdr file of a month back to its committed length and appends the month's new calls to it.
+ *      
+ *      @param user_number The user's number.
+ *      @param datetime The month, as returned by @c get_call_node_datetime .
+ *      @param first_call The first new call of the month. Calls are written until the month changes.
+ *      @param committed_length The length of the file as of the last saved checkpoint, 0 for a month without one.
+ *      @param cdr_length Set to the length of the file after the new calls were appended.
+ *      @return 1 if successful, 0 if the file could not be written.
+ */
+int append_monthly_cdr_file(char *user_number, size_t datetime, user_call_list *first_call, uint64_t committed_length, uint64_t *cdr_length) {
+    char *filename = generate_cdr_filename(user_number, datetime);
+    if (filename == NULL) {
+        return 0;
+    }
+
+    // Writes in append mode always go to the end, which is where the file is cut off
+    FILE *cdr_file = open_monthly_cdr_bill(filename, "a");
+    if ((cdr_file == NULL) || (ftruncate(fileno(cdr_file), (off_t) committed_length) != 0)) {
+        fprintf(stderr, "Could not prepare cdr file \"%s\" for new calls\n", filename);
+        if (cdr_file != NULL) {
+            fclose(cdr_file);
+        }
+        free(filename);
+        return 0;
+    }
+
+    int written = 1;
+    for (user_call_list *call = first_call; (call != NULL) && (get_call_node_datetime(call) == datetime); call = call->next) {
+        written = written && write_cdr_row(cdr_file, user_number, call);
+    }
+
+    struct stat cdr_file_stats;
+    written = written && (fflush(cdr_file) == 0) && (fstat(fileno(cdr_file), &cdr_file_stats) == 0);
+
+    if (!(close_monthly_cdr_bill(cdr_file)) || !(written)) {
+        fprintf(stderr, "Writing cdr file \"%s\" failed\n", filename);
+        free(filename);
+        return 0;
+    }
+
+    *cdr_length = (uint64_t) cdr_file_stats.st_size;
+    free(filename);
+    return 1;
+}
+
+/**
+ *      Compare monthly aggregates
+ *      @brief Orders monthly aggregates by caller, as ordered by @c compare_phone_numbers , and then by month.
+ *      
+ *      @param a The first aggregate.
+ *      @param b The second aggregate.
+ *      @return A negative value if @c a comes first, a positive value if @c b comes first and 0 if they are equal.
+ */
+int compare_monthly_aggregates(const monthly_aggregate *a, const monthly_aggregate *b) {
+    phone_number a_caller = { .value = a->caller, .digits = a->caller_digits };
+    phone_number b_caller = { .value = b->caller, .digits = b->caller_digits };
+
+    int comparison = compare_phone_numbers(a_caller, b_caller);
+    if (comparison != 0) {
+        return comparison;
+    }
+
+    return (a->datetime > b->datetime) - (a->datetime < b->datetime);
+}
+
+/*****************************************************************************************************************
+ * CSV SCANNING FUNCTIONS                                                                                        *
+ *****************************************************************************************************************/
+
+/**
+ *      Init csv scanner
+ *      @brief Prepares a scanner over a buffer of csv rows and scans its first block.
+ *      
+ *      @param scanner The scanner to be initialized.
+ *      @param buffer The first byte of the first row. The buffer is never modified.
+ *      @param length The length of the buffer in bytes.
+ */
+void init_csv_scanner(csv_scanner *scanner, const char *buffer, size_t length) {
+    scanner->buffer = buffer;
+    scanner->length = length;
+    scanner->row_offset = 0;
+    scanner->block_offset = 0;
+    scanner->delimiter_mask = (length > 0) ? scan_csv_block(buffer, length) : 0;
+}
+
+/**
+ *      Scan csv block
+ * 
+ *      Compares a whole block against ',' and '\n' at once - with two 32 byte compares on AVX2, four 16 byte compares on
+ *      SSE2 and a plain loop otherwise. Blocks shorter than @c CSV_BLOCK_SIZE , which only occur at the very end of a
+ *      buffer, are always scanned with the loop so that nothing past the buffer is read.
+ * 
+ *      @brief Finds every comma and newline in a block of up to @c CSV_BLOCK_SIZE bytes.
+ *      
+ *      @param block The first byte of the block.
+ *      @param length The number of bytes left in the buffer, starting at @c block .
+ *      @return A mask with bit @c i set if byte @c i of the block is a comma or a newline.
+ */
+uint64_t scan_csv_block(const char *block, size_t length) {
+    uint64_t delimiter_mask = 0;
+
+    if (length >= CSV_BLOCK_SIZE) {
+#if defined(__AVX2__)
+        const __m256i commas = _mm256_set1_epi8(',');
+        const __m256i newlines = _mm256_set1_epi8('\n');
+
+        for (size_t i = 0; i < CSV_BLOCK_SIZE; i += 32) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i *) (block + i));
+            __m256i delimiters = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, commas), _mm256_cmpeq_epi8(bytes, newlines));
+            delimiter_mask |= ((uint64_t) (uint32_t) _mm256_movemask_epi8(delimiters)) << i;
+        }
+        return delimiter_mask;
+#elif defined(__SSE2__)
+        const __m128i commas = _mm_set1_epi8(',');
+        const __m128i newlines = _mm_set1_epi8('\n');
+
+        for (size_t i = 0; i < CSV_BLOCK_SIZE; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i));
+            __m128i delimiters = _mm_or_si128(_mm_cmpeq_epi8(bytes, commas), _mm_cmpeq_epi8(bytes, newlines));
+            delimiter_mask |= ((uint64_t) (uint32_t) _mm_movemask_epi8(delimiters)) << i;
+        }
+        return delimiter_mask;
+#endif
+    }
+
+    if (length > CSV_BLOCK_SIZE) {
+        length = CSV_BLOCK_SIZE;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        if ((block[i] == ',') || (block[i] == '\n')) {
+            delimiter_mask |= ((uint64_t) 1) << i;
+        }
+    }
+    return delimiter_mask;
+}
+
+/**
+ *      Next csv row
+ * 
+ *      The scanner keeps the delimiter mask of its current block between calls, so every block is compared only once no
+ *      matter how many rows it holds. Empty fields are reported with a length of 0 instead of being skipped like @c strtok
+ *      would. Only the first @c MAX_CSV_FIELDS fields of a row get offsets, but all of them are counted.
+ * 
+ *      @brief Finds the next row of a scanner's buffer and the offsets of its fields.
+ *      
+ *      @param scanner The scanner, initialized with @c init_csv_scanner .
+ *      @param fields Set to the field offsets and lengths of the row, relative to the row's first byte.
+ *      @return A pointer to the first byte of the row, or @c NULL if the buffer has been fully scanned.
+ */
+const char *next_csv_row(csv_scanner *scanner, csv_fields *fields) {
+    if (scanner->row_offset >= scanner->length) {
+        return NULL;
+    }
+
+    const char *row = scanner->buffer + scanner->row_offset;
+
+    fields->count = 1;
+    fields->offset[0] = 0;
+
+    while (1) {
+        while (scanner->delimiter_mask == 0) {
+            scanner->block_offset += CSV_BLOCK_SIZE;
+
+            if (scanner->block_offset >= scanner->length) {
+                // The final row has no trailing newline
+                size_t row_length = scanner->length - scanner->row_offset;
+
+                close_csv_field(fields, row_length);
+                fields->row_length = row_length;
+                scanner->row_offset = scanner->length;
+
+                return row;
+            }
+
+            scanner->delimiter_mask = scan_csv_block(scanner->buffer + scanner->block_offset, scanner->length - scanner->block_offset);
+        }
+
+        size_t delimiter_offset = scanner->block_offset + (size_t) count_trailing_zeros(scanner->delimiter_mask);
+        size_t position = delimiter_offset - scanner->row_offset;
+
+        // Clear the lowest set bit, the delimiter has been consumed
+        scanner->delimiter_mask &= scanner->delimiter_mask - 1;
+
+        close_csv_field(fields, position);
+
+        if (scanner->buffer[delimiter_offset] == '\n') {
+            fields->row_length = position;
+            scanner->row_offset = delimiter_offset + 1;
+
+            return row;
+        }
+
+        if (fields->count < MAX_CSV_FIELDS) {
+            fields->offset[fields->count] = position + 1;
+        }
+        fields->count++;
+    }
+}
+
+/**
+ *      Close csv field
+ *      @brief Sets the length of the most recently opened field of a row, if it is one of the fields that get offsets.
+ *      
+ *      @param fields The fields of the row.
+ *      @param position The offset of the delimiter that ends the field, relative to the row's first byte.
+ */
+void close_csv_field(csv_fields *fields, size_t position) {
+    size_t index = fields->count - 1;
+
+    if (index < MAX_CSV_FIELDS) {
+        fields->length[index] = position - fields->offset[index];
+    }
+}
+
+/**
+ *      Copy csv field
+ *      @brief Copies a single field of a row into a buffer and terminates it, so that it can be passed to the validators.
+ *      
+ *      @param row The first byte of the row.
+ *      @param fields The field offsets of the row.
+ *      @param index The index of the field to be copied. Has to be lower than @c MAX_CSV_FIELDS and the field count.
+ *      @param buffer The destination, at least @c MAX_CSV_LINE bytes long. Fields are never longer than a row.
+ *      @return A pointer to the buffer.
+ */
+char *copy_csv_field(const char *row, const csv_fields *fields, size_t index, char *buffer) {
+    size_t length = fields->length[index];
+
+    if (length >= MAX_CSV_LINE) {
+        length = MAX_CSV_LINE - 1;
+    }
+
+    memcpy(buffer, row + fields->offset[index], length);
+    buffer[length] = '\0';
+
+    return buffer;
+}
+
+/**
+ *      Count trailing zeros
+ *      @brief Finds the index of the lowest set bit of a non-zero mask.
+ *      
+ *      @param mask The mask, cannot be 0.
+ *      @return The number of zero bits below the lowest set bit.
+ */
+int count_trailing_zeros(uint64_t mask) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(mask);
+#else
+    int count = 0;
+
+    while (!(mask & 1)) {
+        mask >>= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+/*****************************************************************************************************************
+ * DIAGNOSTICS FUNCTIONS                                                                                         *
+ *****************************************************************************************************************/
+
+/**
+ *      Set diagnostic verbosity
+ *      @brief Chooses between aggregated diagnostics and writing every single one to stderr as it is reported. Has to be
+ *      called before the parsing threads are started.
+ *      
+ *      @param verbose 1 to log every diagnostic, 0 to only keep counts and samples for the summary.
+ */
+void set_diagnostic_verbosity(int verbose) {
+    pthread_mutex_lock(&(diagnostics.lock));
+    diagnostics.verbose = verbose;
+    pthread_mutex_unlock(&(diagnostics.lock));
+}
+
+/**
+ *      Add diagnostic count
+ *      @brief Counts an error of a category. The count is atomic where the compiler supports it, so parsing threads
+ *      reporting at the same time do not queue up on the lock of the log.
+ *      
+ *      @param category The category of the error.
+ *      @return The number of errors reported in the category before this one.
+ */
+size_t add_diagnostic_count(diagnostic_category category) {
+#if defined(__GNUC__)
+    return __atomic_fetch_add(&(diagnostics.count[category]), 1, __ATOMIC_RELAXED);
+#else
+    pthread_mutex_lock(&(diagnostics.lock));
+    size_t count = diagnostics.count[category]++;
+    pthread_mutex_unlock(&(diagnostics.lock));
+
+    return count;
+#endif
+}
+
+/**
+ *      Diagnostic message needed
+ *      @brief Checks whether the next error of a category would be logged or kept as a sample. Callers whose message
+ *      arguments are costly to build can count the error with @c count_diagnostic instead if it is not.
+ *      
+ *      @param category The category of the error.
+ *      @return 1 if the message of the next error is used, 0 otherwise.
+ */
+int diagnostic_message_needed(diagnostic_category category) {
+    return diagnostics.verbose || (get_diagnostic_count(category) < DIAGNOSTIC_SAMPLE_COUNT);
+}
+
+/**
+ *      Count diagnostic
+ *      @brief Counts a data error without a message, for errors past the samples of their category. Can be called from
+ *      any thread.
+ *      
+ *      @param category The category of the error.
+ */
+void count_diagnostic(diagnostic_category category) {
+    add_diagnostic_count(category);
+}
+
+/**
+ *      Report diagnostic
+ * 
+ *      Unless verbose logging is on, the message is only formatted while its category still has room for samples, so
+ *      reporting thousands of identical errors costs little more than counting them. Every sample slot is handed out
+ *      once by the count, so only verbose logging takes the lock, to keep the lines on stderr whole.
+ * 
+ *      @brief Counts a data error and keeps its message if it is one of the first @c DIAGNOSTIC_SAMPLE_COUNT of its category.
+ *      Can be called from any thread.
+ *      
+ *      @param category The category of the error.
+ *      @param format A @c printf style format for the message, without a trailing newline.
+ */
+void report_diagnostic(diagnostic_category category, const char *format, ...) {
+    va_list arguments;
+
+    size_t sample_index = add_diagnostic_count(category);
+
+    if (diagnostics.verbose) {
+        pthread_mutex_lock(&(diagnostics.lock));
+        va_start(arguments, format);
+        vfprintf(stderr, format, arguments);
+        va_end(arguments);
+        fputc('\n', stderr);
+        pthread_mutex_unlock(&(diagnostics.lock));
+    } else if (sample_index < DIAGNOSTIC_SAMPLE_COUNT) {
+        va_start(arguments, format);
+        vsnprintf(diagnostics.sample[category][sample_index], DIAGNOSTIC_MESSAGE_LENGTH, format, arguments);
+        va_end(arguments);
+    }
+}
+
+/**
+ *      Get diagnostic count
+ *      @brief Gets the number of errors that have been reported in a category.
+ *      
+ *      @param category The category.
+ *      @return The number of errors reported so far.
+ */
+size_t get_diagnostic_count(diagnostic_category category) {
+#if defined(__GNUC__)
+    return __atomic_load_n(&(diagnostics.count[category]), __ATOMIC_RELAXED);
+#else
+    pthread_mutex_lock(&(diagnostics.lock));
+    size_t count = diagnostics.count[category];
+    pthread_mutex_unlock(&(diagnostics.lock));
+
+    return count;
+#endif
+}
+
+/**
+ *      Get diagnostic category name
+ *      @brief Gets the description of a diagnostic category used in the summary.
+ *      
+ *      @param category The category.
+ *      @return A constant string describing the category.
+ */
+const char *get_diagnostic_category_name(diagnostic_category category) {
+    static const char *category_names[DIAGNOSTIC_CATEGORY_COUNT] = {
+        "Malformed call lines",
+        "Invalid call dates",
+        "Invalid call durations",
+        "Invalid caller or callee numbers",
+        "Calls without a rate match",
+        "Malformed rate lines",
+        "Invalid rates",
+        "Invalid region codes",
+        "Duplicate region codes",
+        "Invalid binary call records",
+        "Invalid rate effective dates",
+        "Invalid time bands"
+    };
+
+    return category_names[category];
+}
+
+/**
+ *      Print diagnostic summary
+ *      @brief Prints the number of errors per category, each followed by its first few messages unless they were already
+ *      logged verbosely. Categories without errors are left out.
+ *      
+ *      @param stream The stream to print to.
+ */
+void print_diagnostic_summary(FILE *stream) {
+    pthread_mutex_lock(&(diagnostics.lock));
+
+    size_t total_count = 0;
+    for (size_t category = 0; category < DIAGNOSTIC_CATEGORY_COUNT; category++) {
+        total_count += diagnostics.count[category];
+    }
+
+    if (total_count > 0) {
+        fprintf(stream, "\nDiagnostics summary (%lu in total):\n", total_count);
+    }
+
+    for (size_t category = 0; category < DIAGNOSTIC_CATEGORY_COUNT; category++) {
+        size_t count = diagnostics.count[category];
+        if (count == 0) {
+            continue;
+        }
+
+        fprintf(stream, "%s: %lu\n", get_diagnostic_category_name((diagnostic_category) category), count);
+
+        if (diagnostics.verbose) {
+            continue;
+        }
+
+        size_t sample_count = (count < DIAGNOSTIC_SAMPLE_COUNT) ? count : DIAGNOSTIC_SAMPLE_COUNT;
+        for (size_t i = 0; i < sample_count; i++) {
+            fprintf(stream, "\t%s\n", diagnostics.sample[category][i]);
+        }
+        if (count > sample_count) {
+            fprintf(stream, "\t... %lu more, pass -v to log all of them\n", count - sample_count);
+        }
+    }
+
+    pthread_mutex_unlock(&(diagnostics.lock));
+}
+
+/*****************************************************************************************************************
+ * PATTERN CHECKING FUNCTIONS                                                                                    *
+ *****************************************************************************************************************/
+
+/**
+ *      Validate phone number
+ *      @brief Checks if a phone number is legal based on E.164 and removes leading zeros. An exception is made for the
+ *      string "Anonymous", which is returned unchanged.
+ *      
+ *      @param phone_number The number to be checked.
+ *      @return A pointer to the validated number or NULL if it was found to be invalid.
+ */
+char *validate_phone_number(char **phone_number) {
+    if (*phone_number == NULL) {
+        fprintf(stderr, "Cannot validate NULL string\n");
+        return NULL;
+    }
+
+    if (strcmp(*phone_number, "Anonymous") == 0) {
+        return *phone_number;
+    }
+    
+    
+    while (**phone_number == '0') {
+        *phone_number = (*phone_number) + 1;
+    }
+
+    size_t phone_number_len = strlen(*phone_number);
+
+    if (phone_number_len > 15 /* Should be correct according to E.164 */) {
+        fprintf(stderr, "Phone number too long - ");
+        return NULL;
+    }
+
+    // Initialize the legality flag as zero to exclude region_codes that don't enter the loop at all (len = 0)
+    _Bool legal = 0;
+
+    for (size_t i = 0; i < phone_number_len; i++) {
+        legal = 1;
+
+        if (!(isdigit((*phone_number)[i]))) {
+            legal = 0;
+            break;
+        }
+    }
+
+    return legal ? *phone_number : NULL;    
+}
+
+/**
+ *      Encode phone number
+ * 
+ *      Validation and conversion happen in the same pass over the digits, following the same rules as
+ *      @c validate_phone_number : "Anonymous" is accepted, leading zeros are removed and at most 15 digits may remain.
+ *      The number doesn't have to be terminated, so fields can be encoded straight from a csv row.
+ * 
+ *      @brief Validates a phone number and converts it into its integer form.
+ *      
+ *      @param number The first character of the number.
+ *      @param length The length of the number in characters.
+ *      @param encoded Set to the encoded number. Anonymous numbers are encoded with a value and digit count of 0.
+ *      @return 1 if the number is valid, 0 if not.
+ */
+int encode_phone_number(const char *number, size_t length, phone_number *encoded) {
+    if (number == NULL) {
+        fprintf(stderr, "Cannot validate NULL string\n");
+        return 0;
+    }
+
+    if ((length == 9) && (memcmp(number, "Anonymous", 9) == 0)) {
+        encoded->value = 0;
+        encoded->digits = 0;
+        return 1;
+    }
+
+    // Remove leading zeros
+    while ((length > 0) && (*number == '0')) {
+        number++;
+        length--;
+    }
+
+    // Too long numbers are reported by the caller along with the line they were found on
+    if (length > MAX_PHONE_NUMBER_LENGTH /* Should be correct according to E.164 */) {
+        return 0;
+    }
+
+    if (length == 0) {
+        return 0;
+    }
+
+    uint64_t value = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        uint64_t digit = (uint64_t) ((unsigned char) number[i] - '0');
+        if (digit > 9) {
+            return 0;
+        }
+        value = (value * 10) + digit;
+    }
+
+    encoded->value = value;
+    encoded->digits = (unsigned int) length;
+
+    return 1;
+}
+
+/**
+ *      Format phone number
+ *      @brief Writes the decimal form of an encoded phone number into a buffer.
+ *      
+ *      @param number The encoded number.
+ *      @param buffer The destination, at least @c MAX_PHONE_NUMBER_LENGTH + 1 characters long.
+ *      @return A pointer to the buffer.
+ */
+char *format_phone_number(phone_number number, char *buffer) {
+    if (number.digits == 0) {
+        strcpy(buffer, "Anonymous");
+        return buffer;
+    }
+
+    uint64_t value = number.value;
+
+    // Fill the digits from the back
+    for (unsigned int i = number.digits; i > 0; i--) {
+        buffer[i - 1] = (char) ('0' + (value % 10));
+        value /= 10;
+    }
+    buffer[number.digits] = '\0';
+
+    return buffer;
+}
+
+/**
+ *      Compare phone numbers
+ * 
+ *      The shorter number is scaled up by a power of ten so that both have the same number of digits, which orders
+ *      encoded numbers exactly like @c strcmp orders their decimal strings - a prefix comes directly before the numbers
+ *      it is a prefix of. Anonymous numbers come last, like the string "Anonymous" does after the digits.
+ * 
+ *      @brief Compares two encoded phone numbers or region codes.
+ *      
+ *      @param a The first number.
+ *      @param b The second number.
+ *      @return A negative value if @c a comes first, a positive value if @c b comes first and 0 if they are equal.
+ */
+int compare_phone_numbers(phone_number a, phone_number b) {
+    uint64_t a_scaled = a.value;
+    uint64_t b_scaled = b.value;
+
+    if ((a.digits == 0) || (b.digits == 0)) {
+        return (a.digits == 0) - (b.digits == 0);
+    }
+
+    if (a.digits < b.digits) {
+        a_scaled *= power_of_ten(b.digits - a.digits);
+    } else {
+        b_scaled *= power_of_ten(a.digits - b.digits);
+    }
+
+    if (a_scaled != b_scaled) {
+        return (a_scaled < b_scaled) ? -1 : 1;
+    }
+
+    return (a.digits > b.digits) - (a.digits < b.digits);
+}
+
+/**
+ *      Phone number prefix
+ *      @brief Gets the leading digits of an encoded phone number without converting it to text.
+ *      
+ *      @param number The encoded number.
+ *      @param length The number of leading digits, at most the number's digit count.
+ *      @return The encoded prefix.
+ */
+phone_number phone_number_prefix(phone_number number, unsigned int length) {
+    phone_number prefix;
+
+    prefix.value = number.value / power_of_ten(number.digits - length);
+    prefix.digits = length;
+
+    return prefix;
+}
+
+/**
+ *      Power of ten
+ *      @brief Looks up a power of ten that fits into 64 bits.
+ *      
+ *      @param exponent The exponent, at most 19.
+ *      @return 10 to the power of @c exponent .
+ */
+uint64_t power_of_ten(unsigned int exponent) {
+    static const uint64_t powers_of_ten[] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL,
+        10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+        10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+    };
+
+    return powers_of_ten[exponent];
+}
+
+/**
+ *      Count digits
+ *      @brief Counts the decimal digits of a number. 0 has no digits, which matches the encoding of anonymous numbers.
+ *      
+ *      @param value The number.
+ *      @return The number of decimal digits.
+ */
+unsigned int count_digits(uint64_t value) {
+    unsigned int digits = 0;
+
+    while (value > 0) {
+        value /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+/**
+ *      Censor callee number
+ *      @brief Writes a phone number with its final three digits replaced by '*' into a buffer. Numbers with fewer than three
+ *      digits are replaced completely.
+ *      
+ *      @param callee_number The encoded number to be censored.
+ *      @param buffer The destination, at least @c MAX_PHONE_NUMBER_LENGTH + 1 characters long.
+ *      @return A pointer to the censored number in the buffer.
+ */
+char *censor_calee_number(phone_number callee_number, char *buffer) {
+    format_phone_number(callee_number, buffer);
+
+    size_t callee_number_len = strlen(buffer);
+    size_t censored_digits = (callee_number_len < 3) ? callee_number_len : 3;
+
+    for (size_t i = callee_number_len - censored_digits; i < callee_number_len; i++) {
+        buffer[i] = '*';
+    }
+    
+    return buffer;
+}
+
+/**
+ *      Validate region_code
+ * 
+ *      @brief Checks if a given region code is legal in E.164 and formats it by removing leading zeros, if need be.
+ * 
+ *      @param region_code A double pointer to the region code. May be altered.
+ *  
+ *      @return A pointer to the valid region code or NULL
+ */
+char *validate_region_code(char **region_code){
+    if (*region_code == NULL) {
+        fprintf(stderr, "Cannot validate NULL string\n");
+        return NULL;
+    }
+    
+    // Remove leading zeros
+    while ((**region_code == '0') || (**region_code == '+')) {
+        *region_code = (*region_code) + 1;
+    }
+    
+    size_t region_code_len = strlen(*region_code);
+
+    if (region_code_len > MAX_REGION_CODE_LENGTH) {
+        // region_code too long, invalid
+        return NULL;
+    }
+    
+    // Initialize the legality flag as zero to exclude region_codes that don't enter the loop at all (len = 0)
+    _Bool legal = 0;
+
+    for (size_t i = 0; i < region_code_len; i++) {
+        legal = 1;
+
+        if (!(isdigit((*region_code)[i]))) {
+            legal = 0;
+            break;
+        }
+    }
+
+    return legal ? *region_code : NULL;
+}
+
+/**
+ *      Validate region code range
+ * 
+ *      @brief Checks if a range row's region code - its first and last block of numbers joined by a dash - holds two legal
+ *      region codes of the same length, the first not greater than the last.
+ * 
+ *      @param range The region code of the range row. Is altered.
+ *      @param buffer Set to the range with the leading zeros of both blocks removed, at least as long as @c range .
+ *  
+ *      @return @c buffer if the range is valid, otherwise NULL.
+ */
+char *validate_region_code_range(char *range, char *buffer) {
+    char *separator = strchr(range, '-');
+    if (separator == NULL) {
+        return NULL;
+    }
+    *separator = '\0';
+
+    char *first = range;
+    char *last = separator + 1;
+
+    first = validate_region_code(&first);
+    last = validate_region_code(&last);
+
+    if ((first == NULL) || (last == NULL) || (strlen(first) != strlen(last)) || (strcmp(first, last) > 0)) {
+        return NULL;
+    }
+
+    sprintf(buffer, "%s-%s", first, last);
+    return buffer;
+}
+
+/**
+ *      Validate rate
+ *      @brief Checks if a string contains a valid call rate. Note that a string of dots will confuse the algorithm
+ *      
+ *      @param rate The rate to be checked.
+ *      @returns The unchanged rate string if valid, otherwise NULL.
+ */
+char *validate_rate(char *rate){
+    if (rate == NULL) return NULL;
+
+    size_t i = 0;
+    while (*(rate + i) != '\0') {
+        if (!(isdigit(*(rate + i))) && (*(rate + i) != '.')) {
+            return NULL;
+        }
+        i++;
+    }
+    return rate;    
+}
+
+/**
+ *      Decode call datetime
+ * 
+ *      Replaces the previous @c sscanf based extraction. Every byte is checked against the fixed @c yyyy-mm-dd @c hh:mm:ss
+ *      layout exactly once, so no format string or locale is interpreted per call. Unlike @c sscanf , single digit fields,
+ *      trailing characters and month or day zero are rejected.
+ * 
+ *      @brief Validates and decodes a call datetime in a single pass.
+ *      
+ *      @param datetime The datetime to be decoded. Does not have to be terminated.
+ *      @param length The length of the datetime in bytes.
+ *      @param year Set to the year of the call.
+ *      @param month Set to the month of the call, between 1 and 12.
+ *      @param day Set to the day of the call, between 1 and 31.
+ *      @param hour Set to the hour of the call, between 0 and 23.
+ *      @param minute Set to the minute of the call, between 0 and 59.
+ *      @param second Set to the second of the call, between 0 and 59.
+ *      @return 1 if the datetime is valid, 0 if not. The output parameters are only written on success.
+ */
+int decode_call_datetime(const char *datetime, size_t length, size_t *year, size_t *month, size_t *day, size_t *hour, size_t *minute, size_t *second) {
+    // Digit positions of "yyyy-mm-dd hh:mm:ss"
+    static const char layout[] = "dddd-dd-dd dd:dd:dd";
+    size_t digits[14];
+
+    if ((datetime == NULL) || (length != sizeof(layout) - 1)) {
+        return 0;
+    }
+
+    size_t digit_count = 0;
+
+    for (size_t i = 0; i < sizeof(layout) - 1; i++) {
+        if (layout[i] == 'd') {
+            // Unsigned subtraction turns anything below '0' into a large value as well
+            size_t digit = (size_t) ((unsigned char) datetime[i] - '0');
+            if (digit > 9) {
+                return 0;
+            }
+            digits[digit_count++] = digit;
+        } else if (datetime[i] != layout[i]) {
+            return 0;
+        }
+    }
+
+    size_t decoded_month = (digits[4] * 10) + digits[5];
+    size_t decoded_day = (digits[6] * 10) + digits[7];
+    size_t decoded_hour = (digits[8] * 10) + digits[9];
+    size_t decoded_minute = (digits[10] * 10) + digits[11];
+    size_t decoded_second = (digits[12] * 10) + digits[13];
+
+    if ((decoded_month < 1) || (decoded_month > 12) || (decoded_day < 1) || (decoded_day > 31) ||
+        (decoded_hour > 23) || (decoded_minute > 59) || (decoded_second > 59)) {
+        return 0;
+    }
+
+    *year = (digits[0] * 1000) + (digits[1] * 100) + (digits[2] * 10) + digits[3];
+    *month = decoded_month;
+    *day = decoded_day;
+    *hour = decoded_hour;
+    *minute = decoded_minute;
+    *second = decoded_second;
+
+    return 1;
+}
+
+/**
+ *      Decode call duration
+ *      @brief Validates and decodes a call duration in seconds. Replaces @c atoi , which silently turned signs, garbage and
+ *      overflowing values into a duration. Only a non-empty string of digits that fits into a @c size_t is accepted.
+ *      
+ *      @param duration The duration to be decoded. Does not have to be terminated.
+ *      @param length The length of the duration in bytes.
+ *      @param decoded_duration Set to the duration in seconds.
+ *      @return 1 if the duration is valid, 0 if not. The output parameter is only written on success.
+ */
+int decode_call_duration(const char *duration, size_t length, size_t *decoded_duration) {
+    if ((duration == NULL) || (length == 0)) {
+        return 0;
+    }
+
+    size_t value = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        size_t digit = (size_t) ((unsigned char) duration[i] - '0');
+        if ((digit > 9) || (value > (SIZE_MAX - digit) / 10)) {
+            return 0;
+        }
+        value = (value * 10) + digit;
+    }
+
+    *decoded_duration = value;
+    return 1;
+}
+
+/**
+ *      Decode effective date
+ *      @brief Decodes the effective date of a rate, which has to be laid out exactly as @c yyyy-mm-dd .
+ *      
+ *      @param date The first character of the date. Does not have to be null terminated.
+ *      @param length The length of the date.
+ *      @param encoded_date Set to the date encoded as @c yyyymmdd .
+ *      @return 1 if the date is valid, 0 if not.
+ */
+int decode_effective_date(const char *date, size_t length, uint32_t *encoded_date) {
+    // Digit positions of "yyyy-mm-dd"
+    static const char layout[] = "dddd-dd-dd";
+    size_t digits[8];
+
+    if ((date == NULL) || (length != sizeof(layout) - 1)) {
+        return 0;
+    }
+
+    size_t digit_count = 0;
+
+    for (size_t i = 0; i < sizeof(layout) - 1; i++) {
+        if (layout[i] == 'd') {
+            size_t digit = (size_t) ((unsigned char) date[i] - '0');
+            if (digit > 9) {
+                return 0;
+            }
+            digits[digit_count++] = digit;
+        } else if (date[i] != layout[i]) {
+            return 0;
+        }
+    }
+
+    size_t year = (digits[0] * 1000) + (digits[1] * 100) + (digits[2] * 10) + digits[3];
+    size_t month = (digits[4] * 10) + digits[5];
+    size_t day = (digits[6] * 10) + digits[7];
+
+    if ((year == 0) || (month < 1) || (month > 12) || (day < 1) || (day > 31)) {
+        return 0;
+    }
+
+    *encoded_date = encode_rate_date(year, month, day);
+    return 1;
+}
+
+/**
+ *      Encode rate date
+ *      @brief Encodes a date as the integer @c yyyymmdd , so that later dates compare as larger integers.
+ *      
+ *      @param year The year.
+ *      @param month The month.
+ *      @param day The day.
+ *      @return The encoded date.
+ */
+uint32_t encode_rate_date(size_t year, size_t month, size_t day) {
+    return (uint32_t) ((year * 10000) + (month * 100) + day);
+}
+
+/**
+ *      Decode time band span
+ *      @brief Decodes a span of weekdays or hours in a time band csv, either a single number or the first and last number
+ *      joined by a dash. Every number has one or two digits.
+ *      
+ *      @param span The first character of the span. Does not have to be null terminated.
+ *      @param length The length of the span.
+ *      @param lowest The lowest number allowed.
+ *      @param highest The highest number allowed.
+ *      @param first Set to the first number of the span.
+ *      @param last Set to the last number of the span, which is smaller than the first if the span wraps around.
+ *      @return 1 if the span is valid, 0 if not.
+ */
+int decode_time_band_span(const char *span, size_t length, size_t lowest, size_t highest, size_t *first, size_t *last) {
+    size_t values[2] = { 0, 0 };
+    size_t current = 0;
+    size_t digit_count = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        size_t digit = (size_t) ((unsigned char) span[i] - '0');
+
+        if ((digit <= 9) && (digit_count < 2)) {
+            values[current] = (values[current] * 10) + digit;
+            digit_count++;
+        } else if ((span[i] == '-') && (current == 0) && (digit_count > 0)) {
+            current = 1;
+            digit_count = 0;
+        } else {
+            return 0;
+        }
+    }
+
+    if (digit_count == 0) {
+        return 0;
+    }
+    if (current == 0) {
+        values[1] = values[0];
+    }
+
+    if ((values[0] < lowest) || (values[0] > highest) || (values[1] < lowest) || (values[1] > highest)) {
+        return 0;
+    }
+
+    *first = values[0];
+    *last = values[1];
+    return 1;
+}
+
+/**
+ *      Get time band slot
+ *      @brief Gets the hour of the week a call started in, counted from the first hour of Monday, as used to index the
+ *      multipliers of a time band. The weekday is worked out with Sakamoto's method.
+ *      
+ *      @param year The year of the call.
+ *      @param month The month of the call, between 1 and 12.
+ *      @param day The day of the call.
+ *      @param hour The hour of the call, between 0 and 23.
+ *      @return The hour of the week, below @c TIME_BAND_SLOT_COUNT .
+ */
+size_t get_time_band_slot(size_t year, size_t month, size_t day, size_t hour) {
+    static const size_t month_offsets[12] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+
+    // January and February count as months of the year before. 400 years are a whole number of weeks, adding them keeps
+    // year 0 from wrapping around
+    size_t shifted_year = year + 400 - (month < 3);
+    size_t weekday_from_sunday = (shifted_year + (shifted_year / 4) - (shifted_year / 100) + (shifted_year / 400) + month_offsets[month - 1] + day) % 7;
+
+    return (((weekday_from_sunday + 6) % 7) * 24) + hour;
+}
+
+/**
+ *      Search by longest region code match
+ *      @brief Finds the longest region code match of a number in a rate binary search tree. The prefixes of the number are
+ *      taken from its integer form, so nothing is copied or converted to text.
+ *      
+ *      @param root The root of the rate tree to be searched for.
+ *      @param callee_number The encoded number whose longest region code match is to be found.
+ *      @return The rate node with the longest match, or @c NULL if no matches have been found.
+ * 
+ */
+rate_node *search_by_longest_region_code_match(rate_node *root, phone_number callee_number) {
+    rate_node *current_longest_match = NULL;
+
+    for (unsigned int attempt_length = 1; attempt_length <= callee_number.digits; attempt_length++) {
+        // Only save the search results if they are not NULL
+        rate_node *new_attempt = search_rate_tree(root, phone_number_prefix(callee_number, attempt_length));
+        if (new_attempt != NULL) {
+            current_longest_match = new_attempt;
+        }
+    }
+    //No match has been found
+    return current_longest_match;
+}
+
+/**
+ *      Calculate call seconds
+ *      @brief Calculate the second component of a call's duration.
+ *      
+ *      @param duration The duration of a call.
+ *      @return The second component of a call.
+ */
+size_t calculate_call_seconds(size_t duration) {
+    return duration % 60;
+}
+
+/**
+ *      Calculate call minutes
+ *      @brief Calculate the minute component of a call's duration.
+ *      
+ *      @param duration The duration of a call.
+ *      @return The minute component of a call.
+ */
+size_t calculate_call_minutes(size_t duration) {
+    return (duration - (3600 * (duration / 3600))) / 60;
+}
+
+/**
+ *      Calculate call hours
+ *      @brief Calculate the hour component of a call's duration.
+ *      
+ *      @param duration The duration of a call.
+ *      @return The hour component of a call.
+ */
+size_t calculate_call_hours(size_t duration) {
+    return duration / 3600;
+}
+
+/**
+ *      Max
+ *      @brief Checks which of two integers is greater.
+ *      
+ *      @param a The first int to be compared.
+ *      @param b The second int to be compared.
+ *      @returns @c a if @c a is greater, @c b if @c b is equal or greater.
+ */
+int max(int a, int b) {
+    return (a > b) ? a : b;
+}
+
+/*****************************************************************************************************************
+ * CALL LINKED LIST FUNCTIONS                                                                                    *
+ *****************************************************************************************************************/
+
+/**
+ *      Insert call node
+ * 
+ *      @brief Inserts a new node into the call linked list so that the it remains ordered by @c compare_call_nodes .
+ *      If the head argument is NULL, it initializes a list instead. The search starts at the call inserted last, since
+ *      call records are written in blocks of consecutive calls and the next call of a user usually belongs right after it.
+ *      
+ *      @param head A double pointer to the head of the list, which will be changed dynamically.
+ *      @param last A double pointer to the call inserted last, set to the new node. May point to any node of the list.
+ *      @param call The call to be inserted. Its hour picks the multiplier of the rate's time band.
+ *      @param rates The rate cache of the parsing thread, the longest region code match is looked up through it.
+ * 
+ *      @returns 1 if the function suceeds, 0 if it fails.
+ */
+int insert_call(user_call_list **head, user_call_list **last, const decoded_call *call, rate_cache *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
+
+    user_call_list *new_node = malloc(sizeof(user_call_list));
+    if (new_node == NULL) {
+        fprintf(stderr, "Not enough memory to create new call linked list node\n");
+        return 0;
+    }
+
+    // The callee is stored in its integer form, no copy has to be allocated
+    phone_number callee_number = call->callee;
+    new_node->callee = callee_number;
+    
+    new_node->duration = call->duration;
+    new_node->year = call->year;
+    new_node->month = call->month;
+    new_node->day = call->day;
+    new_node->hour = call->hour;
+    new_node->minute = call->minute;
+    new_node->second = call->second;
+    new_node->source = call->source;
+    new_node->line = call->line;
+
+    const rate_entry *longest_rate_match = search_rate_cache(rates, callee_number);
+
+    if (longest_rate_match == NULL) {
+        if (diagnostic_message_needed(DIAGNOSTIC_NO_RATE_MATCH)) {
+            char callee_number_string[MAX_PHONE_NUMBER_LENGTH + 1];
+            report_diagnostic(DIAGNOSTIC_NO_RATE_MATCH, "No rate match found for the number \"%s\", call price set to zero", format_phone_number(callee_number, callee_number_string));
+        } else {
+            count_diagnostic(DIAGNOSTIC_NO_RATE_MATCH);
+        }
+        new_node->price = 0;
+        new_node->region = RATE_REGION_NONE;
+    } else {
+        new_node->region = longest_rate_match->region;
+        new_node->price = find_rate_in_force(rates->index, longest_rate_match, encode_rate_date(call->year, call->month, call->day)) *
+                          get_time_band_multiplier(rates->index, longest_rate_match, get_time_band_slot(call->year, call->month, call->day, call->hour)) *
+                          call->duration;
+    }
+
+    // Global counters incremented here
+    (*total_call_number)++;
+    (*total_call_duration) += new_node->duration;
+    (*total_call_price) += new_node->price;
+    
+    if ((*head == NULL)) {
+        // The list is being initialized
+
+        new_node->previous = NULL;
+        new_node->next = NULL;
+
+        *head = new_node;
+    } else {
+        // The node is being inserted into an existing list, find the last node that comes before it
+        user_call_list *current = *last;
+
+        if (compare_call_nodes(current, new_node) > 0) {
+            do {
+                current = current->previous;
+            } while ((current != NULL) && (compare_call_nodes(current, new_node) > 0));
+        } else {
+            while ((current->next != NULL) && (compare_call_nodes(current->next, new_node) <= 0)) {
+                current = current->next;
+            }
+        }
+
+        if (current == NULL) {
+            // The new node comes before root
+            new_node->next = *head;
+            new_node->previous = NULL;
+            (*head)->previous = new_node;
+            *head = new_node;
+        } else {
+            new_node->previous = current;
+            new_node->next = current->next;
+
+            if (current->next != NULL) {
+                current->next->previous = new_node;
+            }
+            current->next = new_node;
+        }
+    }
+
+    *last = new_node;
+    return 1;
+}
+
+/**
+ *      Merge call lists
+ * 
+ *      @brief Merges two call linked lists ordered by @c compare_call_nodes into one ordered list. No nodes are allocated or
+ *      freed. Since the order is total, the result does not depend on which list is passed first.
+ *      
+ *      @param first The head of the first list. May be @c NULL .
+ *      @param second The head of the second list. May be @c NULL .
+ * 
+ *      @returns The head of the merged list.
+ */
+user_call_list *merge_call_lists(user_call_list *first, user_call_list *second) {
+    user_call_list *head = NULL;
+    user_call_list *tail = NULL;
+
+    while ((first != NULL) || (second != NULL)) {
+        user_call_list *next = NULL;
+
+        if ((second == NULL) || ((first != NULL) && (compare_call_nodes(first, second) <= 0))) {
+            next = first;
+            first = first->next;
+        } else {
+            next = second;
+            second = second->next;
+        }
+
+        next->previous = tail;
+        next->next = NULL;
+
+        if (tail == NULL) {
+            head = next;
+        } else {
+            tail->next = next;
+        }
+        tail = next;
+    }
+    return head;
+}
+
+/**
+ *      Get call node datetime
+ *      @brief Get the call node datetime.
+ *      
+ *      @param node The call whose datetime is to be returned.
+ *      @return The year of the call multiplied by 100 plus the month of the call.
+ */
+size_t get_call_node_datetime(user_call_list *node) {
+    return (node == NULL) ? 0 : (node->year * 100) + node->month;
+}
+
+/**
+ *      Get call node timestamp
+ *      @brief Get the full start time of a call node.
+ *      
+ *      @param node The call whose start time is to be returned.
+ *      @return The start time of the call encoded as @c yyyymmddhhmmss .
+ */
+uint64_t get_call_node_timestamp(const user_call_list *node) {
+    uint64_t date = ((uint64_t) node->year * 10000) + (node->month * 100) + node->day;
+    return (date * 1000000) + (node->hour * 10000) + (node->minute * 100) + node->second;
+}
+
+/**
+ *      Compare call nodes
+ * 
+ *      Calls are ordered by their start time and calls that started in the same second by the call record and row they were
+ *      read from. The order is total, so inserting calls one by one and merging the partial lists of several threads or
+ *      readers lead to the same list, no matter which thread parsed which part.
+ * 
+ *      @brief Compares two calls for their order in a call linked list.
+ *      
+ *      @param a The first call.
+ *      @param b The second call.
+ *      @return A negative value if @c a comes first, a positive value if @c b comes first and 0 if they are equal.
+ */
+int compare_call_nodes(const user_call_list *a, const user_call_list *b) {
+    uint64_t a_timestamp = get_call_node_timestamp(a);
+    uint64_t b_timestamp = get_call_node_timestamp(b);
+
+    if (a_timestamp != b_timestamp) {
+        return (a_timestamp < b_timestamp) ? -1 : 1;
+    }
+
+    if (a->source != b->source) {
+        return (a->source < b->source) ? -1 : 1;
+    }
+
+    return (a->line > b->line) - (a->line < b->line);
+}
+
+/**
+ *      Print user call list
+ * 
+ *      @brief Prints a slice of a call linked list. If both indexes are set to 0, prints the entire list instead.
+ * 
+ *      @param head The head of the linked list.
+ *      @param start_index The starting index of the list slice.
+ *      @param end_index The ending index of the list slice.
+ */
+void print_call_list(user_call_list *head, size_t start_index, size_t end_index) {
+    if (head == NULL) {
+        fprintf(stderr, "Cannot print NULL list, aborting\n");
+        return;
+    } else if (start_index > end_index) {
+        fprintf(stderr, "Starting index larger than ending index, aborting");
+        return;
+    }
+    
+    
+    char callee_number_string[MAX_PHONE_NUMBER_LENGTH + 1];
+
+    user_call_list *current = head;
+    if ((start_index == 0) && (end_index == 0)) {
+        // If no start and end indexes were given print the whole list
+
+        while (current != NULL) {
+        printf( "The called number is: \"%s\", "
+                "The price of the call is: %.2f, "
+                "and it took place in month %lu of %lu.\n", format_phone_number(current->callee, callee_number_string), current->price, current->month, current->year);
+        current = current->next;
+        }    
+    } else {
+        // Print list from start index to end index
+        size_t i = 0;
+
+        while (current != NULL) {
+            if (i >= start_index) {
+                // If we've reached the start index, print the node
+                printf( "The called number is: \"%s\","
+                        "The price of the call is: %.2f,\n"
+                        "and it took place in month %lu of %lu.\n", format_phone_number(current->callee, callee_number_string), current->price, current->month, current->year);
+            }
+
+            if (i > end_index) {
+                // If we've exceeded the end index, exit the while loop
+                break;
+            }
+            i++;
+            current = current->next;
+        }
+    }
+    return;   
+}
+
+/**
+ *      Delete call linked list     
+ * 
+ *      @brief Deletes a call linked list, freeing the memory it took up.
+ * 
+ *      @param head A double pointer to the head of the list. Will be set to NULL.
+ *      @return 1 if successful, 0 if not. 
+ */
+int delete_call_list(user_call_list **head) {
+    if (*head == NULL) {
+        fprintf(stderr, "Cannot delete NULL list, aborting\n");
+        return 0;
+    }
+
+    user_call_list *current = *head;
+
+    while (*head != NULL) {
+        current = *head;
+
+        *head = (*head)->next;
+        free(current);
+        current = NULL;
+    }
+    
+    return 1;
+}
+
+/*****************************************************************************************************************
+ * AVL RATE TREE FUNCTIONS                                                                                       *
+ ****************************************************************************************************************/
+
+/**
+ *      Insert rate tree node
+ * 
+ *      @brief Recursively inserts a new rate node to the rate AVL tree. The tree is automatically rebalanced in the process.
+ *      Interfacing with the rate AVL tree should only be done through this function and the traversals. If the region code
+ *      is already in the tree, the rate is added to its node as another version.
+ *      
+ *      @param node A pointer to the tree root. May change due to rebalancing.
+ *      @param region_code The region_code string, cannot be NULL.
+ *      @param rate The rate associated with the region_code.
+ *      @param effective_date The date the rate is in force from, encoded as @c yyyymmdd . 0 if it has none.
+ *      @param region The ID of the region the code belongs to.
+ * 
+ *      @returns The tree's new root.
+ */
+rate_node *add_rate_node(rate_node *node, const char *region_code, double rate, uint32_t effective_date, uint32_t region) {
+    if (region_code == NULL) {
+        fprintf(stderr, "Number string empty, aborting\n");
+        return NULL;
+    }
+
+    if (node == NULL){
+        return make_rate_node(region_code, rate, effective_date, region);
+    }
+
+    if (strcmp(region_code, node->region_code) < 0) {
+        // Going left
+        node->left = add_rate_node(node->left, region_code, rate, effective_date, region);
+    } else if (strcmp(region_code, node->region_code) > 0) {
+        // Going right
+        node->right = add_rate_node(node->right, region_code, rate, effective_date, region);
+    } else {
+        // Only a rate with a date of its own is a new version
+        if (!(add_rate_version(node, rate, effective_date))) {
+            report_diagnostic(DIAGNOSTIC_DUPLICATE_REGION_CODE, "Error: region code \"%s\" already found in tree", region_code);
+        }
+        return node;
+    }
+    
+    // Update node height
+    node->height = 1 + max(get_rate_node_height(node->left), get_rate_node_height(node->right));
+
+    // Get node balance    
+    int balance = get_rate_node_balance(node);
+
+    // Imbalance is in left child's left subtree
+    if ((balance > 1) && (strcmp(region_code, node->left->region_code) < 0)) {
+        return right_rotate_rate(node);
+    }
+
+    // Imbalance is in right child's right subtree
+    if ((balance < -1) && (strcmp(region_code, node->right->region_code) > 0)) {
+        return left_rotate_rate(node);
+    }
+    
+    // Imbalance is in left child's right subtree
+    if ((balance > 1) && (strcmp(region_code, node->left->region_code) > 0)) {
+        node->left = left_rotate_rate(node->left);
+        return right_rotate_rate(node);
+    }
+
+    // Imbalance is in right child's left subtree
+    if ((balance < -1) && (strcmp(region_code, node->right->region_code) < 0)) {
+        node->right = right_rotate_rate(node->right);
+        return left_rotate_rate(node);
+    }
+
+    // Return the current node, unchanged
+    return node;    
+}
+
+/**
+ *      Make rate node
+ *      @brief Initializes a new rate node and returns a pointer to it. Is called internally by @c add_rate_node.
+ *      
+ *      @param region_code The region_code string, cannot be NULL. May be a range of two blocks joined by a dash.
+ *      @param rate The rate associated with the region_code.
+ *      @param effective_date The date the rate is in force from, encoded as @c yyyymmdd . 0 if it has none.
+ *      @param region The ID of the region the code belongs to.
+ *      @returns A pointer to the new rate node, or NULL if there was an error.
+ */
+rate_node *make_rate_node(const char *region_code, double rate, uint32_t effective_date, uint32_t region) {
+    if (region_code == NULL) {
+        fprintf(stderr, "Number string empty, aborting\n");
+        return NULL;
+    }
+
+    rate_node *newNode = malloc(sizeof(rate_node));
+    if (newNode == NULL) {
+        fprintf(stderr, "Not enough memory to create new rate node, aborting\n");
+        return NULL;
+    }
+    
+    newNode->region_code = malloc((strlen(region_code) + 1) * sizeof(char));
+    if (newNode->region_code == NULL) {
+        fprintf(stderr, "Not enough memory to initialize region code field, aborting\n");
+        free(newNode);
+        newNode = NULL;
+        return NULL;
+    } else {
+        strcpy(newNode->region_code, region_code);
+    }
+
+    // Range rows hold their first block in the code and their last one in the range end
+    const char *range_separator = strchr(region_code, '-');
+    size_t code_length = (range_separator == NULL) ? strlen(region_code) : (size_t) (range_separator - region_code);
+
+    newNode->range_end.value = 0;
+    newNode->range_end.digits = 0;
+
+    if (!(encode_phone_number(region_code, code_length, &(newNode->code))) ||
+        ((range_separator != NULL) && !(encode_phone_number(range_separator + 1, strlen(range_separator + 1), &(newNode->range_end))))) {
+        fprintf(stderr, "Region code \"%s\" cannot be encoded, aborting\n", region_code);
+        free(newNode->region_code);
+        free(newNode);
+        return NULL;
+    }
+    
+    newNode->versions = malloc(sizeof(rate_version));
+    if (newNode->versions == NULL) {
+        fprintf(stderr, "Not enough memory to initialize rate versions, aborting\n");
+        free(newNode->region_code);
+        free(newNode);
+        return NULL;
+    }
+    newNode->versions[0].effective_date = effective_date;
+    newNode->versions[0].rate = rate;
+    newNode->version_count = 1;
+
+    newNode->rate = rate;
+    newNode->region = region;
+    newNode->time_band = TIME_BAND_NONE;
+
+    newNode->entry_index = 0;
+    newNode->height = 1;
+
+    newNode->left = NULL;
+    newNode->right = NULL;
+
+    return newNode;
+}
+
+/**
+ *      Add rate version
+ *      @brief Adds another version of a rate to an existing rate node, keeping the versions ordered by effective date. The
+ *      node's rate stays the one of its earliest version.
+ *      
+ *      @param node The node of the region code.
+ *      @param rate The rate of the new version.
+ *      @param effective_date The date the new version is in force from, encoded as @c yyyymmdd . 0 if it has none.
+ *      @returns 1 if the version was added, 0 if the node already has a version with the same date or there was not enough
+ *      memory.
+ */
+int add_rate_version(rate_node *node, double rate, uint32_t effective_date) {
+    size_t position = node->version_count;
+
+    while ((position > 0) && (node->versions[position - 1].effective_date > effective_date)) {
+        position--;
+    }
+
+    if ((position > 0) && (node->versions[position - 1].effective_date == effective_date)) {
+        return 0;
+    }
+
+    rate_version *new_versions = realloc(node->versions, (node->version_count + 1) * sizeof(rate_version));
+    if (new_versions == NULL) {
+        fprintf(stderr, "Not enough memory to add a rate version\n");
+        return 0;
+    }
+    node->versions = new_versions;
+
+    memmove(&(node->versions[position + 1]), &(node->versions[position]), (node->version_count - position) * sizeof(rate_version));
+    node->versions[position].effective_date = effective_date;
+    node->versions[position].rate = rate;
+    node->version_count++;
+
+    node->rate = node->versions[0].rate;
+
+    return 1;
+}
+
+/**
+ *      Right rotate rate node
+ *      @brief Performs a right rotation around a given node's left child. Should only be called by the @c add_rate_node function.
+ *      
+ *      @param node The node to be right rotated
+ *      @returns The passed node's left child, which is the new subtree root.
+ */
+rate_node *right_rotate_rate(rate_node *node) {
+    rate_node *leftChild = node->left;
+    rate_node * leftChildRight = leftChild->right;
+
+    // Rotate around left child
+    leftChild->right = node;
+    node->left = leftChildRight;
+
+    // Update heights
+    node->height = 1 + max(get_rate_node_height(node->left), get_rate_node_height(node->right));
+    leftChild->height = 1 + max(get_rate_node_height(leftChild->left), get_rate_node_height(leftChild->right));
+
+    // The left child is now the subtree root
+    return leftChild;
+}
+
+/**
+ *      Left rotate rate node
+ *      @brief Performs a left rotation around a given node's right child. Should only be called by the @c add_rate_node function.
+ *      
+ *      @param node The node to be left rotated
+ *      @returns The passed node's right child, which is the new subtree root.
+ */
+rate_node *left_rotate_rate(rate_node *node) {
+        rate_node *rightChild = node->right;
+        rate_node * rightChildLeft = rightChild->left;
+
+        // Rotate around right child
+        rightChild->left = node;
+        node->right = rightChildLeft;
+
+        // Update heights
+        node->height = 1 + max(get_rate_node_height(node->left), get_rate_node_height(node->right));
+        rightChild->height = 1 + max(get_rate_node_height(rightChild->left), get_rate_node_height(rightChild->right));
+
+        // The right child is now the subtree root
+        return rightChild;
+}
+
+/**
+ *      Traverse rates inorder
+ *      @brief Traverses a given rate tree inorder. Useful for printing.
+ *      
+ *      @param node The root of the tree
+ *      @param visit The function to be performed upon visiting
+ */
+void traverse_rates_inorder(rate_node *node, void (*visit) (rate_node*)) {
+    if (node == NULL) return;
+
+    traverse_rates_inorder(node->left, visit);
+    visit(node);
+    traverse_rates_inorder(node->right, visit);
+}
+
+/**
+ *      Traverse rates postorder
+ *      @brief Traverses a given rate tree postorder. Useful for deletition.
+ *      
+ *      @param node The root of the tree
+ *      @param visit The function to be performed upon visiting
+ */
+void traverse_rates_postorder(rate_node *node, void (*visit) (rate_node*)) {
+    if (node == NULL) return;
+
+    traverse_rates_postorder(node->left, visit);
+    traverse_rates_postorder(node->right, visit);
+    visit(node);
+}
+
+/**
+ *      Print rate node
+ *      @brief Prints a single node in a rate AVL tree. Can be used for traversals.
+ *      
+ *      @param node The node to be printed
+ */
+void print_rate_node(rate_node *node) {
+    if (node == NULL) {
+        printf("Node is NULL\n");
+        return;
+    }
+    printf("Key: %s, Region: %s, Rate: %f\n", node->region_code, get_region_name(node->region), node->rate);
+    return;
+}
+
+/**
+ *      Delete rate node
+ *      @brief Deletes a single node from a rate AVL tree. Can be used for (postorder) traversals.
+ *      
+ *      @param node The node to be deleted
+ */
+void delete_rate_node(rate_node *node) {
+    if (node == NULL) {
+        fprintf(stderr, "Cannot delete NULL node\n");
+        return;
+    }
+    free(node->region_code);
+    node->region_code = NULL;
+    free(node->versions);
+    node->versions = NULL;
+    node->left = NULL;
+    node->right = NULL;
+
+    free(node);
+}
+
+/**
+ *      Get rate node height
+ *      @brief Get the rate node height
+ *      
+ *      @param node The node whose height is to be checked
+ *      @returns @c 0 if the node is @c NULL, otherwise its height
+ */
+int get_rate_node_height(rate_node *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    return node->height;    
+}
+
+/**
+ *      Get rate node balance
+ *      @brief Get the rate node balance
+ *      
+ *      @param node The node whose balance is to be checked
+ *      @returns @c 0 if the node is @c NULL, otherwise its balance
+ */
+int get_rate_node_balance(rate_node *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    return get_rate_node_height(node->left) - get_rate_node_height(node->right);    
+}
+
+/**
+ *      Search rate tree
+ *      @brief Search through rate tree, based on a given encoded region code. @c compare_phone_numbers orders encoded region
+ *      codes like @c strcmp orders their strings, so the tree built by @c add_rate_node can be searched without any text.
+ *      
+ *      @param root The root of the tree to be searched.
+ *      @param region_code The encoded region code to search for.
+ *      @return The rate node with the appropriate region code, or @c NULL if no node was found.
+ */
+rate_node *search_rate_tree(rate_node *root, phone_number region_code) {
+    while (root != NULL) {
+        int comparison = compare_phone_numbers(region_code, root->code);
+
+        if (comparison == 0) {
+            return root;
+        }
+
+        root = (comparison < 0) ? root->left : root->right;
+    }
+    return NULL;
+}
+
+/**
+ *      Prune rate tree
+ * 
+ *      Region codes are ordered like their strings, so every region code comes right after its prefixes and before anything
+ *      that does not start with it. Walking the nodes in order while keeping a stack of the region codes that enclose the
+ *      current one gives every node its nearest shorter region code in a single pass. A node is redundant if that region
+ *      code has the same region and exactly the same versions, since every number it matches would be billed the same
+ *      without it. Sibling region codes are not merged into their common prefix, the prefix itself dialled as a whole number
+ *      would get a rate it did not have before. Range rows with a length between the two region codes could match instead
+ *      of the shorter one, so region codes with such ranges in between are kept as well.
+ * 
+ *      @brief Removes every region code whose rates and region are the same as those of its nearest shorter region code,
+ *      and rebuilds the rest into a balanced tree. Every call is billed exactly as before.
+ *      
+ *      @param root The root of the rate tree.
+ *      @param range_root The root of the tree of range rows. May be @c NULL .
+ *      @param pruned_count Set to the number of region codes removed.
+ *      @return The root of the pruned tree. The unchanged tree if there was not enough memory.
+ */
+rate_node *prune_rate_tree(rate_node *root, rate_node *range_root, size_t *pruned_count) {
+    *pruned_count = 0;
+
+    uint32_t range_lengths = get_rate_range_lengths(range_root);
+
+    size_t node_count = count_rate_nodes(root);
+    rate_node **nodes = malloc(node_count * sizeof(rate_node *));
+    if (nodes == NULL) {
+        return root;
+    }
+
+    collect_rate_nodes(root, nodes, 0);
+
+    // Every enclosing region code is longer than the one before it, so there are never more of them than digits
+    rate_node *ancestors[MAX_REGION_CODE_LENGTH];
+    size_t ancestor_count = 0;
+    size_t kept_count = 0;
+
+    for (size_t i = 0; i < node_count; i++) {
+        rate_node *node = nodes[i];
+
+        while ((ancestor_count > 0) && !(is_region_code_prefix(ancestors[ancestor_count - 1]->code, node->code))) {
+            ancestor_count--;
+        }
+
+        if ((ancestor_count > 0) && have_same_rates(ancestors[ancestor_count - 1], node) &&
+            !(range_lengths & ~((UINT32_C(2) << ancestors[ancestor_count - 1]->code.digits) - 1) & ((UINT32_C(2) << node->code.digits) - 1))) {
+            delete_rate_node(node);
+            (*pruned_count)++;
+            continue;
+        }
+
+        ancestors[ancestor_count] = node;
+        ancestor_count++;
+        nodes[kept_count] = node;
+        kept_count++;
+    }
+
+    root = link_rate_nodes(nodes, kept_count);
+    free(nodes);
+
+    return root;
+}
+
+/**
+ *      Collect rate nodes
+ *      @brief Recursively writes the nodes of a rate tree into an array in order.
+ *      
+ *      @param node The root of the tree. May be @c NULL .
+ *      @param nodes The array the nodes are written to, large enough for every node.
+ *      @param count The number of nodes already written.
+ *      @return The number of nodes written afterwards.
+ */
+size_t collect_rate_nodes(rate_node *node, rate_node **nodes, size_t count) {
+    if (node == NULL) {
+        return count;
+    }
+
+    count = collect_rate_nodes(node->left, nodes, count);
+    nodes[count] = node;
+    count++;
+
+    return collect_rate_nodes(node->right, nodes, count);
+}
+
+/**
+ *      Link rate nodes
+ *      @brief Recursively links an ordered array of rate nodes into a balanced tree, which is a valid AVL tree.
+ *      
+ *      @param nodes The nodes, ordered by region code.
+ *      @param count The number of nodes.
+ *      @return The root of the tree, @c NULL if there are no nodes.
+ */
+rate_node *link_rate_nodes(rate_node **nodes, size_t count) {
+    if (count == 0) {
+        return NULL;
+    }
+
+    size_t middle = count / 2;
+    rate_node *node = nodes[middle];
+
+    node->left = link_rate_nodes(nodes, middle);
+    node->right = link_rate_nodes(nodes + middle + 1, count - middle - 1);
+    node->height = 1 + max(get_rate_node_height(node->left), get_rate_node_height(node->right));
+
+    return node;
+}
+
+/**
+ *      Is region code prefix
+ *      @brief Checks whether a region code is a shorter prefix of another one.
+ *      
+ *      @param prefix The possible prefix.
+ *      @param code The region code.
+ *      @return 1 if @c code starts with @c prefix and is longer, 0 if not.
+ */
+int is_region_code_prefix(phone_number prefix, phone_number code) {
+    return (prefix.digits < code.digits) && (phone_number_prefix(code, prefix.digits).value == prefix.value);
+}
+
+/**
+ *      Have same rates
+ *      @brief Checks whether two rate nodes bill every call the same, that is whether they have the same region, the
+ *      same time band and the same versions.
+ *      
+ *      @param a The first node.
+ *      @param b The second node.
+ *      @return 1 if they bill the same, 0 if not.
+ */
+int have_same_rates(const rate_node *a, const rate_node *b) {
+    if ((a->region != b->region) || (a->time_band != b->time_band) || (a->version_count != b->version_count)) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < a->version_count; i++) {
+        if ((a->versions[i].effective_date != b->versions[i].effective_date) || (a->versions[i].rate != b->versions[i].rate)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ *      Get rate range lengths
+ *      @brief Recursively collects the lengths of the range rows in a tree.
+ *      
+ *      @param range_root The root of the tree of range rows. May be @c NULL .
+ *      @return A bit for every length in use.
+ */
+uint32_t get_rate_range_lengths(rate_node *range_root) {
+    if (range_root == NULL) {
+        return 0;
+    }
+    return get_rate_range_lengths(range_root->left) | (UINT32_C(1) << range_root->code.digits) | get_rate_range_lengths(range_root->right);
+}
+
+/**
+ *      Remove overlapping ranges
+ * 
+ *      Ranges of different lengths may overlap, the longer one is the closer match. Ranges of the same length cover the same
+ *      numbers with the same precedence, so an overlap between them would be ambiguous.
+ * 
+ *      @brief Removes every range row that overlaps one of the same length with a lower first block, and rebuilds the rest
+ *      into a balanced tree.
+ *      
+ *      @param range_root The root of the tree of range rows. May be @c NULL .
+ *      @return The root of the remaining tree. The unchanged tree if there was not enough memory.
+ */
+rate_node *remove_overlapping_ranges(rate_node *range_root) {
+    size_t range_count = count_rate_nodes(range_root);
+    if (range_count == 0) {
+        return range_root;
+    }
+
+    rate_node **ranges = malloc(range_count * sizeof(rate_node *));
+    if (ranges == NULL) {
+        return range_root;
+    }
+
+    collect_rate_nodes(range_root, ranges, 0);
+    qsort(ranges, range_count, sizeof(rate_node *), compare_rate_ranges);
+
+    size_t kept_count = 0;
+
+    for (size_t i = 0; i < range_count; i++) {
+        rate_node *previous = (kept_count > 0) ? ranges[kept_count - 1] : NULL;
+
+        if ((previous != NULL) && (previous->code.digits == ranges[i]->code.digits) && (previous->range_end.value >= ranges[i]->code.value)) {
+            report_diagnostic(DIAGNOSTIC_DUPLICATE_REGION_CODE, "Error: region code range \"%s\" overlaps \"%s\"", ranges[i]->region_code, previous->region_code);
+            delete_rate_node(ranges[i]);
+            continue;
+        }
+
+        ranges[kept_count] = ranges[i];
+        kept_count++;
+    }
+
+    // The tree is ordered by the region code strings, not by length and first block
+    qsort(ranges, kept_count, sizeof(rate_node *), compare_region_code_strings);
+    range_root = link_rate_nodes(ranges, kept_count);
+    free(ranges);
+
+    return range_root;
+}
+
+/**
+ *      Compare rate ranges
+ *      @brief @c qsort comparison of two range rows by length, then by first block.
+ *      
+ *      @param a A pointer to the first @c rate_node pointer.
+ *      @param b A pointer to the second @c rate_node pointer.
+ *      @return A negative number, zero or a positive number if @c a comes before, with or after @c b .
+ */
+int compare_rate_ranges(const void *a, const void *b) {
+    const rate_node *first = *((rate_node * const *) a);
+    const rate_node *second = *((rate_node * const *) b);
+
+    if (first->code.digits != second->code.digits) {
+        return (first->code.digits < second->code.digits) ? -1 : 1;
+    }
+    if (first->code.value != second->code.value) {
+        return (first->code.value < second->code.value) ? -1 : 1;
+    }
+    return 0;
+}
+
+/**
+ *      Compare region code strings
+ *      @brief @c qsort comparison of two rate nodes in the order of the rate tree.
+ *      
+ *      @param a A pointer to the first @c rate_node pointer.
+ *      @param b A pointer to the second @c rate_node pointer.
+ *      @return The result of @c strcmp on their region codes.
+ */
+int compare_region_code_strings(const void *a, const void *b) {
+    return strcmp((*((rate_node * const *) a))->region_code, (*((rate_node * const *) b))->region_code);
+}
+
+/*****************************************************************************************************************
+ * RATE INDEX FUNCTIONS                                                                                          *
+ ****************************************************************************************************************/
+
+/**
+ *      Build rate index
+ * 
+ *      @brief Builds the structure calls are rated with from a fully loaded rate tree. The rates are copied into an array in
+ *      region code order, which the chosen engine's lookup structure refers to. The tree is kept, the AVL engine searches it.
+ *      Range rows are appended to the array and searched by every engine alike. The multipliers of the time bands are
+ *      copied, the nodes already refer to their bands.
+ *      
+ *      @param index The index to be built.
+ *      @param root The root of the rate tree. Must not change while the index is in use.
+ *      @param range_root The root of the tree of range rows. May be @c NULL .
+ *      @param time_bands The time bands applied to both trees. May be @c NULL if there are none.
+ *      @param engine The lookup structure to be built.
+ *      @return 1 if successful, 0 if there was not enough memory.
+ */
+int build_rate_index(rate_index *index, rate_node *root, rate_node *range_root, const time_band_table *time_bands, rate_engine engine) {
+    size_t range_row_count = count_rate_nodes(range_root);
+
+    index->engine = engine;
+    index->tree = root;
+    index->entries = NULL;
+    index->entry_count = count_rate_nodes(root);
+    index->versions = NULL;
+    index->version_count = 0;
+    index->range_count = 0;
+    index->range_highs = NULL;
+    index->time_band_count = (time_bands == NULL) ? 0 : time_bands->count;
+    index->trie = NULL;
+    index->trie_node_count = 0;
+    index->frozen_keys = NULL;
+    index->frozen_ranks = NULL;
+    index->frozen_parents = NULL;
+    memset(index->hash_tables, 0, sizeof(index->hash_tables));
+    memset(index->hash_length_masks, 0, sizeof(index->hash_length_masks));
+    index->hash_length_mask = 0;
+    index->compiled = 0;
+
+    index->time_bands = malloc((index->time_band_count + 1) * TIME_BAND_SLOT_COUNT * sizeof(double));
+    if (index->time_bands == NULL) {
+        fprintf(stderr, "Not enough memory to build the rate index\n");
+        return 0;
+    }
+    for (size_t slot = 0; slot < TIME_BAND_SLOT_COUNT; slot++) {
+        index->time_bands[slot] = 1;
+    }
+    if (index->time_band_count > 0) {
+        memcpy(&(index->time_bands[TIME_BAND_SLOT_COUNT]), time_bands->multipliers, time_bands->count * TIME_BAND_SLOT_COUNT * sizeof(double));
+    }
+
+    if (index->entry_count + range_row_count > 0) {
+        index->entries = malloc((index->entry_count + range_row_count) * sizeof(rate_entry));
+        index->versions = malloc((count_rate_versions(root) + count_rate_versions(range_root)) * sizeof(rate_version));
+        index->range_highs = malloc((range_row_count + 1) * sizeof(uint64_t));
+        if ((index->entries == NULL) || (index->versions == NULL) || (index->range_highs == NULL)) {
+            fprintf(stderr, "Not enough memory to build the rate index\n");
+            return 0;
+        }
+        collect_rate_entries(root, index, 0);
+
+        if (!(collect_rate_ranges(range_root, index, range_row_count))) {
+            fprintf(stderr, "Not enough memory to build the rate index\n");
+            return 0;
+        }
+    }
+    index_rate_ranges(index);
+
+    if (engine == RATE_ENGINE_TRIE) {
+        return build_rate_trie(index);
+    } else if (engine == RATE_ENGINE_FROZEN) {
+        return freeze_rate_index(index);
+    } else if (engine == RATE_ENGINE_HASH) {
+        return build_rate_hash_tables(index);
+    }
+
+    return 1;
+}
+
+/**
+ *      Load rate index from csv
+ * 
+ *      The rates are parsed and checked, the time bands, if any, are given rates of their own where they need them and
+ *      applied to both trees, and only then is the rate tree pruned, so region codes with a band of their own are kept.
+ *      Errors are printed along the way, the diagnostics of the rows are left to the caller's summary.
+ * 
+ *      @brief Loads a rate csv and an optional time band csv and builds a rate index from them.
+ *      
+ *      @param rate_filename The rate csv.
+ *      @param time_band_filename The time band csv. May be @c NULL .
+ *      @param engine The lookup structure to be built.
+ *      @param index The index to be built.
+ *      @param rate_root Set to the root of the rate tree, which has to be kept while the index is in use.
+ *      @param range_root Set to the root of the tree of range rows.
+ *      @return 1 if successful, 0 if a file could not be read or held no valid rates, or there was not enough memory.
+ */
+int load_rate_index_from_csv(const char *rate_filename, const char *time_band_filename, rate_engine engine, rate_index *index, rate_node **rate_root, rate_node **range_root) {
+    *rate_root = NULL;
+    *range_root = NULL;
+
+    FILE *call_rates = open_csv(rate_filename);
+    if (call_rates == NULL) {
+        fprintf(stderr, "Could not open rate record \"%s\" - invalid filename\n", rate_filename);
+        return 0;
+    }
+
+    *rate_root = parse_rate_csv(call_rates, range_root);
+    if (!(close_csv(call_rates))) {
+        fprintf(stderr, "Error: The rate record could not be read completely\n");
+        return 0;
+    }
+
+    if ((*rate_root == NULL) && (*range_root == NULL)) {
+        fprintf(stderr, "Error: No valid rates were found in the rate record\n");
+        return 0;
+    }
+
+    time_band_table time_bands = { .codes = NULL, .multipliers = NULL, .count = 0 };
+
+    if (time_band_filename != NULL) {
+        FILE *time_band_csv = open_csv(time_band_filename);
+        if (time_band_csv == NULL) {
+            fprintf(stderr, "Could not open time band record \"%s\" - invalid filename\n", time_band_filename);
+            return 0;
+        }
+
+        int loaded = parse_time_band_csv(time_band_csv, &time_bands);
+        if (!(close_csv(time_band_csv)) || !(loaded)) {
+            return 0;
+        }
+        printf("Loaded %lu time bands\n", time_bands.count);
+
+        *rate_root = add_time_band_rates(*rate_root, *range_root, &time_bands);
+        apply_time_bands(*rate_root, &time_bands);
+        apply_time_bands(*range_root, &time_bands);
+    }
+
+    size_t pruned_count = 0;
+    *rate_root = prune_rate_tree(*rate_root, *range_root, &pruned_count);
+    printf("Pruned %lu region codes billed the same as a shorter one\n", pruned_count);
+
+    int built = build_rate_index(index, *rate_root, *range_root, &time_bands, engine);
+    delete_time_band_table(&time_bands);
+
+    return built;
+}
+
+/**
+ *      Delete rate index
+ *      @brief Frees the lookup structures of a rate index. The rate tree it was built from and the arrays of a compiled
+ *      rate table are left alone.
+ *      
+ *      @param index The index to be freed.
+ */
+void delete_rate_index(rate_index *index) {
+    if (!(index->compiled)) {
+        free(index->entries);
+        free(index->versions);
+        free(index->range_highs);
+        free(index->time_bands);
+        free(index->frozen_keys);
+        free(index->frozen_ranks);
+        free(index->frozen_parents);
+    }
+    free(index->trie);
+    for (unsigned int i = 0; i <= MAX_REGION_CODE_LENGTH; i++) {
+        free(index->hash_tables[i].slots);
+    }
+
+    index->entries = NULL;
+    index->entry_count = 0;
+    index->versions = NULL;
+    index->version_count = 0;
+    index->range_count = 0;
+    index->range_highs = NULL;
+    memset(index->range_starts, 0, sizeof(index->range_starts));
+    index->range_length_mask = 0;
+    index->time_bands = NULL;
+    index->time_band_count = 0;
+    index->trie = NULL;
+    index->trie_node_count = 0;
+    index->frozen_keys = NULL;
+    index->frozen_ranks = NULL;
+    index->frozen_parents = NULL;
+    memset(index->hash_tables, 0, sizeof(index->hash_tables));
+    memset(index->hash_length_masks, 0, sizeof(index->hash_length_masks));
+    index->hash_length_mask = 0;
+    index->compiled = 0;
+}
+
+/**
+ *      Search rate index
+ *      @brief Finds the rate of the longest region code that a number starts with, using the index's engine. Range rows
+ *      longer than that region code are checked afterwards.
+ *      
+ *      @param index The rate index.
+ *      @param callee_number The encoded number whose rate is to be found.
+ *      @return The matching rate entry, or @c NULL if no region code matches.
+ */
+const rate_entry *search_rate_index(const rate_index *index, phone_number callee_number) {
+    const rate_entry *longest_match = NULL;
+
+    if (index->engine == RATE_ENGINE_TRIE) {
+        longest_match = search_rate_trie(index, callee_number);
+    } else if (index->engine == RATE_ENGINE_FROZEN) {
+        longest_match = search_rate_frozen(index, callee_number);
+    } else if (index->engine == RATE_ENGINE_HASH) {
+        longest_match = search_rate_hash(index, callee_number);
+    } else {
+        rate_node *longest_rate_match = search_by_longest_region_code_match(index->tree, callee_number);
+        longest_match = (longest_rate_match == NULL) ? NULL : &(index->entries[longest_rate_match->entry_index]);
+    }
+
+    return (index->range_length_mask == 0) ? longest_match : search_rate_ranges(index, callee_number, longest_match);
+}
+
+/**
+ *      Search rate ranges
+ * 
+ *      Only lengths longer than the region code already found can improve on it, a range row of the same length loses to
+ *      the region code. Within each length the range rows are ordered and don't overlap, so a binary search for the last
+ *      one starting at or before the number's block is enough.
+ * 
+ *      @brief Finds the longest range row whose block of numbers holds a number, if it is longer than a given match.
+ *      
+ *      @param index The rate index.
+ *      @param callee_number The encoded number.
+ *      @param longest_match The longest region code match found by the engine. May be @c NULL .
+ *      @return The matching range row's entry, or @c longest_match if no longer range row matches.
+ */
+const rate_entry *search_rate_ranges(const rate_index *index, phone_number callee_number, const rate_entry *longest_match) {
+    const rate_entry *ranges = &(index->entries[index->entry_count]);
+    unsigned int shortest = (longest_match == NULL) ? 1 : longest_match->code.digits + 1;
+    unsigned int longest = (callee_number.digits < MAX_REGION_CODE_LENGTH) ? callee_number.digits : MAX_REGION_CODE_LENGTH;
+
+    for (unsigned int length = longest; length >= shortest; length--) {
+        if (!(index->range_length_mask & (1u << length))) {
+            continue;
+        }
+
+        uint64_t block = phone_number_prefix(callee_number, length).value;
+        size_t low = index->range_starts[length];
+        size_t high = index->range_starts[length + 1];
+
+        // Find the first range row starting after the block, the one before it is the only one that can hold it
+        while (low < high) {
+            size_t middle = low + ((high - low) / 2);
+
+            if (ranges[middle].code.value <= block) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+
+        if ((low > index->range_starts[length]) && (block <= index->range_highs[low - 1])) {
+            return &(ranges[low - 1]);
+        }
+    }
+
+    return longest_match;
+}
+
+/**
+ *      Find rate in force
+ *      @brief Finds the rate of an entry that is in force on a given date - the latest version that took effect on or before
+ *      it - by binary search over the entry's versions. Dates before the earliest version get the earliest rate.
+ *      
+ *      @param index The rate index the entry belongs to.
+ *      @param entry The rate entry, as found by a lookup.
+ *      @param date The date of the call, encoded as @c yyyymmdd .
+ *      @return The rate in force.
+ */
+double find_rate_in_force(const rate_index *index, const rate_entry *entry, uint32_t date) {
+    if (entry->version_count == 1) {
+        return entry->rate;
+    }
+
+    const rate_version *versions = &(index->versions[entry->first_version]);
+    size_t low = 1;
+    size_t high = entry->version_count;
+
+    // Find the first version that takes effect after the date, the one before it is in force
+    while (low < high) {
+        size_t middle = low + ((high - low) / 2);
+
+        if (versions[middle].effective_date <= date) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return versions[low - 1].rate;
+}
+
+/**
+ *      Get time band multiplier
+ *      @brief Looks up the multiplier of an entry's rate in a given hour of the week. Entries without a time band are in
+ *      @c TIME_BAND_NONE , whose multipliers are all 1, so every call takes the same path without a branch.
+ *      
+ *      @param index The rate index the entry belongs to.
+ *      @param entry The rate entry, as found by a lookup.
+ *      @param slot The hour of the week, as returned by @c get_time_band_slot .
+ *      @return The multiplier.
+ */
+double get_time_band_multiplier(const rate_index *index, const rate_entry *entry, size_t slot) {
+    return index->time_bands[((size_t) entry->time_band * TIME_BAND_SLOT_COUNT) + slot];
+}
+
+/**
+ *      Rate call batch
+ * 
+ *      For the AVL engine the calls are first grouped by the leading digits of their callees with a counting sort, which
+ *      keeps the order of the calls within each group. Looking the callees up group by group means consecutive searches
+ *      walk the same tree nodes, which are still in the cache from the search before, and repeated calls to the same number
+ *      often end up next to each other and are only looked up once. The prices are written back to the positions of their
+ *      calls, so the grouping is invisible to the caller. The trie, frozen and hash engines touch only a few cache lines per
+ *      search no matter the order and gain nothing from the extra pass, so for them, and if there is not enough memory for
+ *      grouping, the calls are rated in their original order.
+ * 
+ *      @brief Rates a whole batch of calls in a single call.
+ *      
+ *      @param index The rate index.
+ *      @param callees The encoded callee of every call.
+ *      @param durations The duration of every call in seconds.
+ *      @param dates The date of every call, encoded as @c yyyymmdd , to pick the rate in force. May be @c NULL , then the
+ *      earliest rate of every region is used.
+ *      @param time_slots The hour of the week every call started in, as returned by @c get_time_band_slot , to pick the
+ *      multiplier of the rate's time band. May be @c NULL , then the time bands are ignored.
+ *      @param count The number of calls.
+ *      @param prices Set to the price of every call, 0 for calls without a rate match.
+ *      @return The number of calls without a rate match.
+ */
+size_t rate_call_batch(const rate_index *index, const phone_number *callees, const size_t *durations, const uint32_t *dates, const uint8_t *time_slots, size_t count, double *prices) {
+    size_t unmatched_count = 0;
+    size_t *group_starts = NULL;
+    uint16_t *groups = NULL;
+    size_t *order = NULL;
+    phone_number *grouped_callees = NULL;
+
+    if (index->engine == RATE_ENGINE_AVL) {
+        group_starts = calloc(RATE_BATCH_GROUP_COUNT + 1, sizeof(size_t));
+        groups = malloc(count * sizeof(uint16_t));
+        order = malloc(count * sizeof(size_t));
+        grouped_callees = malloc(count * sizeof(phone_number));
+    }
+
+    if ((group_starts == NULL) || (groups == NULL) || (order == NULL) || (grouped_callees == NULL)) {
+        free(group_starts);
+        free(groups);
+        free(order);
+        free(grouped_callees);
+
+        for (size_t i = 0; i < count; i++) {
+            const rate_entry *entry = search_rate_index(index, callees[i]);
+
+            if (entry == NULL) {
+                prices[i] = 0;
+            } else {
+                prices[i] = ((dates == NULL) ? entry->rate : find_rate_in_force(index, entry, dates[i])) *
+                            ((time_slots == NULL) ? 1 : get_time_band_multiplier(index, entry, time_slots[i])) * durations[i];
+            }
+            unmatched_count += (entry == NULL);
+        }
+        return unmatched_count;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        groups[i] = (uint16_t) get_leading_digits(callees[i], RATE_BATCH_GROUP_LENGTH);
+        group_starts[groups[i] + 1]++;
+    }
+    for (size_t group = 0; group < RATE_BATCH_GROUP_COUNT; group++) {
+        group_starts[group + 1] += group_starts[group];
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t position = group_starts[groups[i]]++;
+        order[position] = i;
+        grouped_callees[position] = callees[i];
+    }
+
+    const rate_entry *entry = NULL;
+
+    for (size_t i = 0; i < count; i++) {
+        if ((i == 0) || (grouped_callees[i].value != grouped_callees[i - 1].value) || (grouped_callees[i].digits != grouped_callees[i - 1].digits)) {
+            entry = search_rate_index(index, grouped_callees[i]);
+        }
+
+        size_t call = order[i];
+        if (entry == NULL) {
+            prices[call] = 0;
+        } else {
+            prices[call] = ((dates == NULL) ? entry->rate : find_rate_in_force(index, entry, dates[call])) *
+                           ((time_slots == NULL) ? 1 : get_time_band_multiplier(index, entry, time_slots[call])) * durations[call];
+        }
+        unmatched_count += (entry == NULL);
+    }
+
+    free(group_starts);
+    free(groups);
+    free(order);
+    free(grouped_callees);
+
+    return unmatched_count;
+}
+
+/**
+ *      Get leading digits
+ *      @brief Gets the first digits of an encoded number as an integer. Numbers shorter than that are padded with zeros.
+ *      
+ *      @param number The encoded number.
+ *      @param length The number of leading digits.
+ *      @return The leading digits, less than 10 to the power of @c length .
+ */
+uint64_t get_leading_digits(phone_number number, unsigned int length) {
+    if (number.digits >= length) {
+        return number.value / power_of_ten(number.digits - length);
+    }
+    return number.value * power_of_ten(length - number.digits);
+}
+
+/**
+ *      Parse rate engine
+ *      @brief Translates the name of a rate engine, as passed on the command line, into its value.
+ *      
+ *      @param name Either "avl", "trie", "frozen" or "hash".
+ *      @param engine Set to the named engine.
+ *      @return 1 if the name is known, 0 if not.
+ */
+int parse_rate_engine(const char *name, rate_engine *engine) {
+    if (strcmp(name, "avl") == 0) {
+        *engine = RATE_ENGINE_AVL;
+    } else if (strcmp(name, "trie") == 0) {
+        *engine = RATE_ENGINE_TRIE;
+    } else if (strcmp(name, "frozen") == 0) {
+        *engine = RATE_ENGINE_FROZEN;
+    } else if (strcmp(name, "hash") == 0) {
+        *engine = RATE_ENGINE_HASH;
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ *      Load compiled rate index
+ * 
+ *      Nothing is parsed, validated or copied but the region names, which are interned into the region dictionary - the
+ *      index refers to the constant arrays of the table directly. The frozen
+ *      engine uses them as they are, the trie and hash engines build their structures from the entries. The AVL engine
+ *      needs the rate tree and cannot be used.
+ * 
+ *      @brief Sets up a rate index from a rate table that was compiled into the executable.
+ *      
+ *      @param index The index to be set up.
+ *      @param table The compiled rate table. Has to outlive the index.
+ *      @param engine The lookup structure to be used.
+ *      @return 1 if successful, 0 if the engine is not available or there was not enough memory.
+ */
+int load_compiled_rate_index(rate_index *index, const compiled_rate_table *table, rate_engine engine) {
+    if (engine == RATE_ENGINE_AVL) {
+        fprintf(stderr, "The avl rate engine needs a rate csv, it cannot use compiled rates\n");
+        return 0;
+    }
+
+    index->engine = engine;
+    index->tree = NULL;
+    index->entry_count = table->entry_count;
+    index->version_count = table->version_count;
+    index->range_count = table->range_count;
+    index->time_band_count = table->time_band_count;
+    index->trie = NULL;
+    index->trie_node_count = 0;
+    memset(index->hash_tables, 0, sizeof(index->hash_tables));
+    memset(index->hash_length_masks, 0, sizeof(index->hash_length_masks));
+    index->hash_length_mask = 0;
+    index->compiled = 1;
+
+    if (!(load_region_names(table->region_names, table->region_names_length, table->region_count))) {
+        fprintf(stderr, "The region names of the rate table are damaged\n");
+        return 0;
+    }
+
+    // The arrays are only ever read through an index that holds them
+    index->entries = (rate_entry *) table->entries;
+    index->versions = (rate_version *) table->versions;
+    index->range_highs = (uint64_t *) table->range_highs;
+    index->time_bands = (double *) table->time_bands;
+    index->frozen_keys = (uint64_t *) table->frozen_keys;
+    index->frozen_ranks = (uint32_t *) table->frozen_ranks;
+    index->frozen_parents = (uint32_t *) table->frozen_parents;
+
+    if (!(index_rate_ranges(index))) {
+        fprintf(stderr, "The range rows of the rate table are damaged\n");
+        return 0;
+    }
+
+    if (engine == RATE_ENGINE_TRIE) {
+        return build_rate_trie(index);
+    } else if (engine == RATE_ENGINE_HASH) {
+        return build_rate_hash_tables(index);
+    }
+
+    return 1;
+}
+
+/**
+ *      Write compiled rate table
+ * 
+ *      The source defines a @c compiled_rate_table named @c compiled_rates along with its arrays. Rates are written with 17
+ *      significant digits, so they compile to exactly the values parsed from the csv.
+ * 
+ *      @brief Writes the entries and frozen arrays of a rate index, along with the region names, as constant C source.
+ *      
+ *      @param source The file the C source is written to.
+ *      @param index A rate index built with the frozen engine.
+ *      @param rate_filename The name of the rate csv the index was built from, kept in the table.
+ *      @return 1 if successful, 0 if the index is not frozen or writing failed.
+ */
+int write_compiled_rate_table(FILE *source, const rate_index *index, const char *rate_filename) {
+    if ((index->engine != RATE_ENGINE_FROZEN) || ((index->entry_count == 0) && (index->range_count == 0))) {
+        return 0;
+    }
+
+    fprintf(source, "/**\n"
+                    " *      @file compiled_rates.c\n"
+                    " *\n"
+                    " *      @brief Rate table compiled by rate_compile. Do not edit, compile the rate csv again instead.\n"
+                    " */\n"
+                    "\n"
+                    "#include \"csv_to_avl_tree.h\"\n"
+                    "\n");
+
+    fprintf(source, "static const rate_entry compiled_rate_entries[%lu] = {\n", index->entry_count + index->range_count);
+    for (size_t i = 0; i < index->entry_count + index->range_count; i++) {
+        fprintf(source, "    { { UINT64_C(%" PRIu64 "), %u }, %.17g, %" PRIu32 ", %" PRIu32 ", %" PRIu32 ", %" PRIu32 " },\n", index->entries[i].code.value,
+                index->entries[i].code.digits, index->entries[i].rate, index->entries[i].first_version, index->entries[i].version_count,
+                index->entries[i].region, index->entries[i].time_band);
+    }
+    fprintf(source, "};\n\n");
+
+    fprintf(source, "static const rate_version compiled_rate_versions[%lu] = {\n", index->version_count);
+    for (size_t i = 0; i < index->version_count; i++) {
+        fprintf(source, "    { %" PRIu32 ", %.17g },\n", index->versions[i].effective_date, index->versions[i].rate);
+    }
+    fprintf(source, "};\n\n");
+
+    // C has no empty arrays, without range rows a single unused last block is written
+    fprintf(source, "static const uint64_t compiled_rate_range_highs[%lu] = {\n", (index->range_count > 0) ? index->range_count : 1);
+    for (size_t i = 0; i < index->range_count; i++) {
+        fprintf(source, "    UINT64_C(%" PRIu64 "),\n", index->range_highs[i]);
+    }
+    if (index->range_count == 0) {
+        fprintf(source, "    UINT64_C(0),\n");
+    }
+    fprintf(source, "};\n\n");
+
+    fprintf(source, "static const double compiled_time_bands[%lu] = {\n", (index->time_band_count + 1) * TIME_BAND_SLOT_COUNT);
+    for (size_t i = 0; i < (index->time_band_count + 1) * TIME_BAND_SLOT_COUNT; i += 24) {
+        fprintf(source, "   ");
+        for (size_t hour = 0; hour < 24; hour++) {
+            fprintf(source, " %.17g,", index->time_bands[i + hour]);
+        }
+        fprintf(source, "\n");
+    }
+    fprintf(source, "};\n\n");
+
+    // A single string literal this long would exceed what C99 compilers have to support, so the names are written byte by byte
+    fprintf(source, "static const char compiled_region_names[%lu] = {\n", get_region_names_length());
+    for (size_t region = 0; region < regions.count; region++) {
+        fprintf(source, "   ");
+        for (const unsigned char *current = (const unsigned char *) regions.names[region]; *current != '\0'; current++) {
+            fprintf(source, " %u,", *current);
+        }
+        fprintf(source, " 0,\n");
+    }
+    fprintf(source, "};\n\n");
+
+    // Position 0 of the Eytzinger arrays is never read, it is written out anyway so that positions stay the same
+    fprintf(source, "static const uint64_t compiled_rate_keys[%lu] = {\n", index->entry_count + 1);
+    fprintf(source, "    UINT64_C(0),\n");
+    for (size_t i = 1; i <= index->entry_count; i++) {
+        fprintf(source, "    UINT64_C(%" PRIu64 "),\n", index->frozen_keys[i]);
+    }
+    fprintf(source, "};\n\n");
+
+    fprintf(source, "static const uint32_t compiled_rate_ranks[%lu] = {\n", index->entry_count + 1);
+    fprintf(source, "    0,\n");
+    for (size_t i = 1; i <= index->entry_count; i++) {
+        fprintf(source, "    %" PRIu32 ",\n", index->frozen_ranks[i]);
+    }
+    fprintf(source, "};\n\n");
+
+    fprintf(source, "static const uint32_t compiled_rate_parents[%lu] = {\n", (index->entry_count > 0) ? index->entry_count : 1);
+    for (size_t i = 0; i < index->entry_count; i++) {
+        fprintf(source, "    %" PRIu32 ",\n", index->frozen_parents[i]);
+    }
+    if (index->entry_count == 0) {
+        fprintf(source, "    0,\n");
+    }
+    fprintf(source, "};\n\n");
+
+    fprintf(source, "const compiled_rate_table compiled_rates = {\n"
+                    "    .entry_count = %lu,\n"
+                    "    .entries = compiled_rate_entries,\n"
+                    "    .range_count = %lu,\n"
+                    "    .range_highs = compiled_rate_range_highs,\n"
+                    "    .time_band_count = %lu,\n"
+                    "    .time_bands = compiled_time_bands,\n"
+                    "    .version_count = %lu,\n"
+                    "    .versions = compiled_rate_versions,\n"
+                    "    .region_count = %lu,\n"
+                    "    .region_names_length = %lu,\n"
+                    "    .region_names = compiled_region_names,\n"
+                    "    .frozen_keys = compiled_rate_keys,\n"
+                    "    .frozen_ranks = compiled_rate_ranks,\n"
+                    "    .frozen_parents = compiled_rate_parents,\n"
+                    "    .source = ", index->entry_count, index->range_count, index->time_band_count, index->version_count, regions.count, get_region_names_length());
+    write_c_string_literal(source, rate_filename);
+    fprintf(source, "\n};\n");
+
+    return !(ferror(source));
+}
+
+/**
+ *      Write C string literal
+ *      @brief Writes a string as a quoted C string literal, escaping quotes, backslashes and control characters.
+ *      
+ *      @param source The file the literal is written to.
+ *      @param string The string to be written.
+ */
+void write_c_string_literal(FILE *source, const char *string) {
+    fputc('"', source);
+    for (const unsigned char *current = (const unsigned char *) string; *current != '\0'; current++) {
+        if ((*current == '"') || (*current == '\\')) {
+            fprintf(source, "\\%c", *current);
+        } else if (*current < 0x20) {
+            fprintf(source, "\\%03o", *current);
+        } else {
+            fputc(*current, source);
+        }
+    }
+    fputc('"', source);
+}
+
+/**
+ *      Init rate snapshot header
+ *      @brief Fills in a rate snapshot header for the current format version and platform, laying out the arrays one after
+ *      another at aligned offsets.
+ *      
+ *      @param header The header to be filled in.
+ *      @param entry_count The number of rates in the snapshot, not counting range rows.
+ *      @param range_count The number of range rows in the snapshot.
+ *      @param version_count The number of rate versions in the snapshot.
+ *      @param time_band_count The number of time bands in the snapshot, not counting @c TIME_BAND_NONE .
+ *      @param region_count The number of regions in the snapshot.
+ *      @param region_names_length The length of the region names in bytes.
+ */
+void init_rate_snapshot_header(rate_snapshot_header *header, uint64_t entry_count, uint64_t range_count, uint64_t version_count, uint64_t time_band_count, uint64_t region_count, uint64_t region_names_length) {
+    memset(header, 0, sizeof(rate_snapshot_header));
+    memcpy(header->magic, RATE_SNAPSHOT_MAGIC, sizeof(header->magic));
+
+    header->version = RATE_SNAPSHOT_VERSION;
+    header->entry_size = sizeof(rate_entry);
+    header->byte_order = BINARY_CALL_BYTE_ORDER;
+    header->entry_count = entry_count;
+    header->range_count = range_count;
+    header->time_band_count = time_band_count;
+    header->version_count = version_count;
+    header->region_count = region_count;
+    header->region_names_length = region_names_length;
+
+    header->keys_offset = align_rate_snapshot_offset(sizeof(rate_snapshot_header));
+    header->entries_offset = align_rate_snapshot_offset(header->keys_offset + ((entry_count + 1) * sizeof(uint64_t)));
+    header->ranks_offset = align_rate_snapshot_offset(header->entries_offset + ((entry_count + range_count) * sizeof(rate_entry)));
+    header->parents_offset = align_rate_snapshot_offset(header->ranks_offset + ((entry_count + 1) * sizeof(uint32_t)));
+    header->versions_offset = align_rate_snapshot_offset(header->parents_offset + (entry_count * sizeof(uint32_t)));
+    header->range_highs_offset = align_rate_snapshot_offset(header->versions_offset + (version_count * sizeof(rate_version)));
+    header->time_bands_offset = align_rate_snapshot_offset(header->range_highs_offset + (range_count * sizeof(uint64_t)));
+    header->region_names_offset = align_rate_snapshot_offset(header->time_bands_offset + ((time_band_count + 1) * TIME_BAND_SLOT_COUNT * sizeof(double)));
+}
+
+/**
+ *      Check rate snapshot header
+ *      @brief Checks that a mapped file is a rate snapshot written by a compatible version and platform, and that every
+ *      array it describes lies within the file.
+ *      
+ *      @param header The header at the start of the mapping.
+ *      @param length The length of the mapping in bytes.
+ *      @return 1 if the snapshot can be used, 0 if not.
+ */
+int check_rate_snapshot_header(const rate_snapshot_header *header, size_t length) {
+    if ((length < sizeof(rate_snapshot_header)) || (memcmp(header->magic, RATE_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)) {
+        fprintf(stderr, "File is not a rate snapshot\n");
+        return 0;
+    }
+
+    if ((header->version != RATE_SNAPSHOT_VERSION) || (header->entry_size != sizeof(rate_entry)) || (header->byte_order != BINARY_CALL_BYTE_ORDER)) {
+        fprintf(stderr, "Rate snapshot was written by an incompatible version or platform, write it again\n");
+        return 0;
+    }
+
+    // Every array is at least four bytes per rate, which also keeps the size calculations below from overflowing
+    if (((header->entry_count == 0) && (header->range_count == 0)) || (header->entry_count > length / sizeof(uint32_t)) ||
+        (header->range_count > length / sizeof(rate_entry)) || (header->time_band_count > length / (TIME_BAND_SLOT_COUNT * sizeof(double))) ||
+        (header->version_count < header->entry_count + header->range_count) || (header->version_count > length / sizeof(rate_version)) ||
+        (header->region_count == 0) || (header->region_count > header->region_names_length) || (header->region_names_length > length)) {
+        fprintf(stderr, "Rate snapshot is empty or truncated\n");
+        return 0;
+    }
+
+    rate_snapshot_header expected;
+    init_rate_snapshot_header(&expected, header->entry_count, header->range_count, header->version_count, header->time_band_count,
+                              header->region_count, header->region_names_length);
+
+    if ((header->keys_offset != expected.keys_offset) || (header->entries_offset != expected.entries_offset) ||
+        (header->ranks_offset != expected.ranks_offset) || (header->parents_offset != expected.parents_offset) ||
+        (header->versions_offset != expected.versions_offset) || (header->range_highs_offset != expected.range_highs_offset) ||
+        (header->time_bands_offset != expected.time_bands_offset) || (header->region_names_offset != expected.region_names_offset) ||
+        (header->region_names_offset + header->region_names_length > length)) {
+        fprintf(stderr, "Rate snapshot is truncated\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ *      Write rate snapshot
+ *      @brief Writes the entries and frozen arrays of a rate index, along with the region names, to a rate snapshot file.
+ *      
+ *      @param snapshot The file the snapshot is written to, opened in binary mode.
+ *      @param index A rate index built with the frozen engine.
+ *      @return 1 if successful, 0 if the index is not frozen or writing failed.
+ */
+int write_rate_snapshot(FILE *snapshot, const rate_index *index) {
+    if ((index->engine != RATE_ENGINE_FROZEN) || ((index->entry_count == 0) && (index->range_count == 0))) {
+        return 0;
+    }
+
+    rate_snapshot_header header;
+    init_rate_snapshot_header(&header, index->entry_count, index->range_count, index->version_count, index->time_band_count, regions.count,
+                              get_region_names_length());
+
+    const void *arrays[7] = { index->frozen_keys, index->entries, index->frozen_ranks, index->frozen_parents, index->versions,
+                              index->range_highs, index->time_bands };
+    const uint64_t offsets[7] = { header.keys_offset, header.entries_offset, header.ranks_offset, header.parents_offset,
+                                  header.versions_offset, header.range_highs_offset, header.time_bands_offset };
+    const size_t sizes[7] = { (index->entry_count + 1) * sizeof(uint64_t), (index->entry_count + index->range_count) * sizeof(rate_entry),
+                              (index->entry_count + 1) * sizeof(uint32_t), index->entry_count * sizeof(uint32_t),
+                              index->version_count * sizeof(rate_version), index->range_count * sizeof(uint64_t),
+                              (index->time_band_count + 1) * TIME_BAND_SLOT_COUNT * sizeof(double) };
+
+    static const char padding[RATE_SNAPSHOT_ALIGNMENT] = {0};
+    uint64_t position = sizeof(rate_snapshot_header);
+
+    if (fwrite(&header, sizeof(rate_snapshot_header), 1, snapshot) != 1) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < 7; i++) {
+        size_t padding_length = (size_t) (offsets[i] - position);
+
+        if ((fwrite(padding, 1, padding_length, snapshot) != padding_length) || (fwrite(arrays[i], 1, sizes[i], snapshot) != sizes[i])) {
+            return 0;
+        }
+        position = offsets[i] + sizes[i];
+    }
+
+    size_t padding_length = (size_t) (header.region_names_offset - position);
+    if (fwrite(padding, 1, padding_length, snapshot) != padding_length) {
+        return 0;
+    }
+
+    for (size_t region = 0; region < regions.count; region++) {
+        size_t name_length = strlen(regions.names[region]) + 1;
+
+        if (fwrite(regions.names[region], 1, name_length, snapshot) != name_length) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ *      Map rate snapshot
+ * 
+ *      The arrays are used where they lie in the mapping, nothing is copied or rebuilt. Since the mapping is read only,
+ *      every process billing from the same snapshot shares the page cache's copy of it. The ranks, parents, region code
+ *      lengths, regions, time bands and version ranges are checked once and the range rows when the index is loaded, so a damaged file
+ *      cannot make a lookup read outside of the arrays.
+ * 
+ *      @brief Maps a rate snapshot file and points a compiled rate table at its arrays, ready for @c load_compiled_rate_index .
+ *      
+ *      @param snapshot The @c FILE pointer of the snapshot.
+ *      @param length Set to the length of the mapping.
+ *      @param table Set to the arrays of the snapshot.
+ *      @return The mapping, to be released with @c unmap_csv once the index is deleted, or @c NULL if the file is invalid.
+ */
+char *map_rate_snapshot(FILE *snapshot, size_t *length, compiled_rate_table *table) {
+    char *mapping = map_csv(snapshot, length);
+
+    if (mapping == NULL) {
+        fprintf(stderr, "Rate snapshot could not be mapped\n");
+        return NULL;
+    }
+
+    // Lookups jump around the whole file, read it in right away
+    posix_madvise(mapping, *length, POSIX_MADV_WILLNEED);
+
+    const rate_snapshot_header *header = (const rate_snapshot_header *) mapping;
+
+    if (!(check_rate_snapshot_header(header, *length))) {
+        unmap_csv(mapping, *length);
+        return NULL;
+    }
+
+    table->entry_count = (size_t) header->entry_count;
+    table->entries = (const rate_entry *) (mapping + header->entries_offset);
+    table->range_count = (size_t) header->range_count;
+    table->range_highs = (const uint64_t *) (mapping + header->range_highs_offset);
+    table->time_band_count = (size_t) header->time_band_count;
+    table->time_bands = (const double *) (mapping + header->time_bands_offset);
+    table->version_count = (size_t) header->version_count;
+    table->versions = (const rate_version *) (mapping + header->versions_offset);
+    table->region_count = (size_t) header->region_count;
+    table->region_names_length = (size_t) header->region_names_length;
+    table->region_names = mapping + header->region_names_offset;
+    table->frozen_keys = (const uint64_t *) (mapping + header->keys_offset);
+    table->frozen_ranks = (const uint32_t *) (mapping + header->ranks_offset);
+    table->frozen_parents = (const uint32_t *) (mapping + header->parents_offset);
+    table->source = NULL;
+
+    for (size_t i = 0; i < table->entry_count + table->range_count; i++) {
+        // Ranks point into the entries and every parent comes before its child, so parent chains always end
+        if (((i < table->entry_count) && ((table->frozen_ranks[i + 1] >= table->entry_count) || (table->frozen_parents[i] > i))) ||
+            (table->entries[i].code.digits == 0) || (table->entries[i].code.digits > MAX_REGION_CODE_LENGTH) ||
+            (table->entries[i].version_count == 0) || (table->entries[i].region >= table->region_count) ||
+            (table->entries[i].time_band > table->time_band_count) ||
+            ((uint64_t) table->entries[i].first_version + table->entries[i].version_count > table->version_count)) {
+            fprintf(stderr, "Rate snapshot is damaged\n");
+            unmap_csv(mapping, *length);
+            return NULL;
+        }
+    }
+
+    return mapping;
+}
+
+/**
+ *      Align rate snapshot offset
+ *      @brief Rounds a file offset up to the next multiple of @c RATE_SNAPSHOT_ALIGNMENT .
+ *      
+ *      @param offset The offset to be aligned.
+ *      @return The aligned offset.
+ */
+uint64_t align_rate_snapshot_offset(uint64_t offset) {
+    return (offset + RATE_SNAPSHOT_ALIGNMENT - 1) & ~((uint64_t) RATE_SNAPSHOT_ALIGNMENT - 1);
+}
+
+/**
+ *      Count rate nodes
+ *      @brief Recursively counts the nodes of a rate tree.
+ *      
+ *      @param node The root of the tree. May be @c NULL .
+ *      @return The number of nodes.
+ */
+size_t count_rate_nodes(rate_node *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    return count_rate_nodes(node->left) + 1 + count_rate_nodes(node->right);
+}
+
+/**
+ *      Count rate versions
+ *      @brief Recursively counts the rate versions of every node of a rate tree.
+ *      
+ *      @param node The root of the tree. May be @c NULL .
+ *      @return The number of versions.
+ */
+size_t count_rate_versions(rate_node *node) {
+    if (node == NULL) {
+        return 0;
+    }
+    return count_rate_versions(node->left) + node->version_count + count_rate_versions(node->right);
+}
+
+/**
+ *      Collect rate entries
+ *      @brief Recursively copies the rates of a tree and their versions into the arrays of an index in order, and tells every
+ *      node where its entry went.
+ *      
+ *      @param node The root of the tree. May be @c NULL .
+ *      @param index The index whose entries and versions are written, large enough for every node and version. Its version
+ *      count is advanced past the versions written.
+ *      @param count The number of entries already written.
+ *      @return The number of entries written afterwards.
+ */
+size_t collect_rate_entries(rate_node *node, rate_index *index, size_t count) {
+    if (node == NULL) {
+        return count;
+    }
+
+    count = collect_rate_entries(node->left, index, count);
+
+    copy_rate_entry(node, index, count);
+    node->entry_index = count;
+    count++;
+
+    return collect_rate_entries(node->right, index, count);
+}
+
+/**
+ *      Copy rate entry
+ *      @brief Copies the rate of a node into an entry of an index and its versions to the end of the index's versions.
+ *      
+ *      @param node The rate node.
+ *      @param index The index, with room for the entry and the versions.
+ *      @param position The position of the entry.
+ */
+void copy_rate_entry(rate_node *node, rate_index *index, size_t position) {
+    rate_entry *entry = &(index->entries[position]);
+    entry->code = node->code;
+    entry->rate = node->rate;
+    entry->first_version = (uint32_t) index->version_count;
+    entry->version_count = (uint32_t) node->version_count;
+    entry->region = node->region;
+    entry->time_band = node->time_band;
+
+    memcpy(&(index->versions[index->version_count]), node->versions, node->version_count * sizeof(rate_version));
+    index->version_count += node->version_count;
+}
+
+/**
+ *      Collect rate ranges
+ *      @brief Copies the range rows of a tree into the entries of an index after its rates, ordered by length and first
+ *      block, along with their last blocks.
+ *      
+ *      @param range_root The root of the tree of range rows. May be @c NULL .
+ *      @param index The index, with room for every range row after its rates.
+ *      @param count The number of range rows.
+ *      @return 1 if successful, 0 if there was not enough memory.
+ */
+int collect_rate_ranges(rate_node *range_root, rate_index *index, size_t count) {
+    if (count == 0) {
+        return 1;
+    }
+
+    rate_node **ranges = malloc(count * sizeof(rate_node *));
+    if (ranges == NULL) {
+        return 0;
+    }
+
+    collect_rate_nodes(range_root, ranges, 0);
+    qsort(ranges, count, sizeof(rate_node *), compare_rate_ranges);
+
+    for (size_t i = 0; i < count; i++) {
+        copy_rate_entry(ranges[i], index, index->entry_count + i);
+        index->range_highs[i] = ranges[i]->range_end.value;
+        ranges[i]->entry_index = index->entry_count + i;
+    }
+    index->range_count = count;
+
+    free(ranges);
+    return 1;
+}
+
+/**
+ *      Index rate ranges
+ *      @brief Finds where the range rows of every length start, and checks that they are ordered and don't overlap - the
+ *      arrays of a compiled rate table or rate snapshot could be damaged.
+ *      
+ *      @param index The index, with its range rows and their last blocks in place.
+ *      @return 1 if the range rows can be searched, 0 if not.
+ */
+int index_rate_ranges(rate_index *index) {
+    const rate_entry *ranges = &(index->entries[index->entry_count]);
+
+    memset(index->range_starts, 0, sizeof(index->range_starts));
+    index->range_length_mask = 0;
+
+    for (size_t i = 0; i < index->range_count; i++) {
+        unsigned int length = ranges[i].code.digits;
+
+        if ((length == 0) || (length > MAX_REGION_CODE_LENGTH) || (index->range_highs[i] < ranges[i].code.value) ||
+            (index->range_highs[i] >= power_of_ten(length))) {
+            return 0;
+        }
+        if ((i > 0) && ((ranges[i - 1].code.digits > length) ||
+            ((ranges[i - 1].code.digits == length) && (index->range_highs[i - 1] >= ranges[i].code.value)))) {
+            return 0;
+        }
+
+        index->range_starts[length + 1]++;
+        index->range_length_mask |= (uint16_t) (1u << length);
+    }
+
+    for (unsigned int length = 1; length <= MAX_REGION_CODE_LENGTH + 1; length++) {
+        index->range_starts[length] += index->range_starts[length - 1];
+    }
+
+    return 1;
+}
+
+/**
+ *      Build rate trie
+ * 
+ *      Every region code is inserted digit by digit, creating nodes as needed. The nodes are kept in a single growing array
+ *      instead of being allocated one by one, so the finished trie is compact and walking it stays within a few cache lines.
+ * 
+ *      @brief Builds the 10-way digit trie of a rate index from its entries.
+ *      
+ *      @param index The index whose entries are inserted.
+ *      @return 1 if successful, 0 if there was not enough memory.
+ */
+int build_rate_trie(rate_index *index) {
+    size_t capacity = index->entry_count + 1;
+
+    index->trie = calloc(capacity, sizeof(rate_trie_node));
+    if (index->trie == NULL) {
+        fprintf(stderr, "Not enough memory to build the rate trie\n");
+        return 0;
+    }
+    index->trie_node_count = 1;
+
+    for (size_t i = 0; i < index->entry_count; i++) {
+        unsigned char digits[MAX_PHONE_NUMBER_LENGTH];
+        unsigned int digit_count = split_phone_number_digits(index->entries[i].code, digits);
+        uint32_t current = 0;
+
+        for (unsigned int j = 0; j < digit_count; j++) {
+            if (index->trie[current].child[digits[j]] == 0) {
+                if (index->trie_node_count == capacity) {
+                    capacity *= 2;
+                    rate_trie_node *new_trie = realloc(index->trie, capacity * sizeof(rate_trie_node));
+                    if (new_trie == NULL) {
+                        fprintf(stderr, "Not enough memory to build the rate trie\n");
+                        return 0;
+                    }
+                    index->trie = new_trie;
+                }
+
+                memset(&(index->trie[index->trie_node_count]), 0, sizeof(rate_trie_node));
+                index->trie[current].child[digits[j]] = (uint32_t) index->trie_node_count;
+                index->trie_node_count++;
+            }
+            current = index->trie[current].child[digits[j]];
+        }
+
+        index->trie[current].entry = (uint32_t) (i + 1);
+    }
+
+    return 1;
+}
+
+/**
+ *      Search rate trie
+ *      @brief Finds the longest region code match of a number in a single walk down the digit trie, remembering the last
+ *      node on the way that a region code ends at.
+ *      
+ *      @param index The rate index.
+ *      @param callee_number The encoded number whose rate is to be found.
+ *      @return The matching rate entry, or @c NULL if no region code matches.
+ */
+const rate_entry *search_rate_trie(const rate_index *index, phone_number callee_number) {
+    unsigned char digits[MAX_PHONE_NUMBER_LENGTH];
+    unsigned int digit_count = split_phone_number_digits(callee_number, digits);
+
+    const rate_trie_node *trie = index->trie;
+    uint32_t current = 0;
+    uint32_t longest_match = 0;
+
+    for (unsigned int i = 0; i < digit_count; i++) {
+        current = trie[current].child[digits[i]];
+        if (current == 0) {
+            break;
+        }
+        if (trie[current].entry != 0) {
+            longest_match = trie[current].entry;
+        }
+    }
+
+    return (longest_match == 0) ? NULL : &(index->entries[longest_match - 1]);
+}
+
+/**
+ *      Split phone number digits
+ *      @brief Writes the digits of an encoded number into an array, most significant digit first.
+ *      
+ *      @param number The encoded number.
+ *      @param digits The destination, at least @c MAX_PHONE_NUMBER_LENGTH long.
+ *      @return The number of digits.
+ */
+unsigned int split_phone_number_digits(phone_number number, unsigned char *digits) {
+    uint64_t value = number.value;
+
+    for (unsigned int i = number.digits; i > 0; i--) {
+        digits[i - 1] = (unsigned char) (value % 10);
+        value /= 10;
+    }
+    return number.digits;
+}
+
+/**
+ *      Freeze rate index
+ * 
+ *      Every region code is padded with zeros to @c MAX_REGION_CODE_LENGTH digits. Padding keeps the order of
+ *      @c compare_phone_numbers , so the entries are already sorted by their padded keys. A region code is a prefix of a
+ *      number exactly if the number's padded first digits lie between the code's padded key and that key plus the padding's
+ *      range. The keys are laid out in Eytzinger order, where the children of position k are 2k and 2k + 1, so a search
+ *      touches the array from the front and the next levels can be prefetched. The parent of every entry, the longest other
+ *      region code it starts with, is found in a single pass over the sorted entries with a stack of open prefixes.
+ * 
+ *      @brief Compacts the rates of an index into contiguous, fixed width arrays for the frozen engine.
+ *      
+ *      @param index The index whose entries are frozen.
+ *      @return 1 if successful, 0 if there was not enough memory.
+ */
+int freeze_rate_index(rate_index *index) {
+    size_t entry_count = index->entry_count;
+    void *frozen_keys = NULL;
+
+    // The keys are aligned to cache lines so that each prefetch pulls in whole levels of the search
+    if (posix_memalign(&frozen_keys, 64, (entry_count + 1) * sizeof(uint64_t)) != 0) {
+        frozen_keys = NULL;
+    }
+    index->frozen_keys = frozen_keys;
+    index->frozen_ranks = malloc((entry_count + 1) * sizeof(uint32_t));
+    index->frozen_parents = malloc((entry_count + 1) * sizeof(uint32_t));
+    uint32_t *open_prefixes = malloc((entry_count + 1) * sizeof(uint32_t));
+
+    if ((index->frozen_keys == NULL) || (index->frozen_ranks == NULL) || (index->frozen_parents == NULL) || (open_prefixes == NULL)) {
+        fprintf(stderr, "Not enough memory to freeze the rate index\n");
+        free(open_prefixes);
+        return 0;
+    }
+
+    fill_eytzinger_keys(index, 1, 0);
+
+    size_t open_prefix_count = 0;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        uint64_t key = pad_rate_key(index->entries[i].code);
+
+        // Close every prefix this region code doesn't start with, the innermost remaining one is its parent
+        while (open_prefix_count > 0) {
+            phone_number prefix = index->entries[open_prefixes[open_prefix_count - 1]].code;
+            uint64_t prefix_key_end = pad_rate_key(prefix) + power_of_ten(MAX_REGION_CODE_LENGTH - prefix.digits) - 1;
+
+            if ((key <= prefix_key_end) && (prefix.digits < index->entries[i].code.digits)) {
+                break;
+            }
+            open_prefix_count--;
+        }
+
+        index->frozen_parents[i] = (open_prefix_count == 0) ? 0 : open_prefixes[open_prefix_count - 1] + 1;
+        open_prefixes[open_prefix_count++] = (uint32_t) i;
+    }
+
+    free(open_prefixes);
+    return 1;
+}
+
+/**
+ *      Fill eytzinger keys
+ *      @brief Recursively lays out the padded keys of a rate index in Eytzinger order by walking the implicit tree in order.
+ *      
+ *      @param index The index whose keys are filled in.
+ *      @param position The current position in the Eytzinger array, starting at 1.
+ *      @param rank The number of entries already placed.
+ *      @return The number of entries placed afterwards.
+ */
+size_t fill_eytzinger_keys(rate_index *index, size_t position, size_t rank) {
+    if (position > index->entry_count) {
+        return rank;
+    }
+
+    rank = fill_eytzinger_keys(index, 2 * position, rank);
+
+    index->frozen_keys[position] = pad_rate_key(index->entries[rank].code);
+    index->frozen_ranks[position] = (uint32_t) rank;
+    rank++;
+
+    return fill_eytzinger_keys(index, (2 * position) + 1, rank);
+}
+
+/**
+ *      Search rate frozen
+ * 
+ *      The search finds the last region code whose padded key is not larger than the number's first digits. If that code
+ *      is not a prefix of the number, the longest match can only be one of its own prefixes, so its parent chain is
+ *      followed until a prefix of the number turns up. The descent is branch free apart from the loop itself.
+ * 
+ *      @brief Finds the longest region code match of a number in the frozen arrays of a rate index.
+ *      
+ *      @param index The rate index.
+ *      @param callee_number The encoded number whose rate is to be found.
+ *      @return The matching rate entry, or @c NULL if no region code matches.
+ */
+const rate_entry *search_rate_frozen(const rate_index *index, phone_number callee_number) {
+    size_t entry_count = index->entry_count;
+    const uint64_t *keys = index->frozen_keys;
+
+    if ((callee_number.digits == 0) || (entry_count == 0)) {
+        return NULL;
+    }
+
+    uint64_t query = (callee_number.digits > MAX_REGION_CODE_LENGTH) ?
+                     callee_number.value / power_of_ten(callee_number.digits - MAX_REGION_CODE_LENGTH) :
+                     callee_number.value * power_of_ten(MAX_REGION_CODE_LENGTH - callee_number.digits);
+
+    size_t position = 1;
+    while (position <= entry_count) {
+        // Sixteen positions further down are four levels below, on the next cache lines
+        __builtin_prefetch(keys + (16 * position));
+        position = (2 * position) + (keys[position] <= query);
+    }
+
+    // Undo the final right turns to get to the first key larger than the query
+    position >>= __builtin_ffsll((long long) ~position);
+
+    size_t upper_bound = (position == 0) ? entry_count : index->frozen_ranks[position];
+    if (upper_bound == 0) {
+        return NULL;
+    }
+
+    size_t candidate = upper_bound;
+    while (candidate != 0) {
+        const rate_entry *entry = &(index->entries[candidate - 1]);
+        uint64_t key_end = pad_rate_key(entry->code) + power_of_ten(MAX_REGION_CODE_LENGTH - entry->code.digits) - 1;
+
+        if ((query <= key_end) && (entry->code.digits <= callee_number.digits)) {
+            return entry;
+        }
+        candidate = index->frozen_parents[candidate - 1];
+    }
+
+    return NULL;
+}
+
+/**
+ *      Pad rate key
+ *      @brief Pads an encoded region code with zeros to @c MAX_REGION_CODE_LENGTH digits.
+ *      
+ *      @param code The encoded region code.
+ *      @return The padded key.
+ */
+uint64_t pad_rate_key(phone_number code) {
+    return code.value * power_of_ten(MAX_REGION_CODE_LENGTH - code.digits);
+}
+
+/**
+ *      Build rate hash tables
+ * 
+ *      The region codes are counted by length first, so every table can be sized once to at least twice its number of
+ *      codes. Keeping the tables at most half full keeps the probe sequences short, and lengths no region code uses get no
+ *      table at all. Every region code also marks its length in the groups of numbers it can be a prefix of, so a lookup
+ *      only probes lengths that occur below the number's own first digits.
+ * 
+ *      @brief Builds the per length hash tables of a rate index from its entries.
+ *      
+ *      @param index The index whose entries are inserted.
+ *      @return 1 if successful, 0 if there was not enough memory.
+ */
+int build_rate_hash_tables(rate_index *index) {
+    size_t length_counts[MAX_REGION_CODE_LENGTH + 1] = {0};
+
+    for (size_t i = 0; i < index->entry_count; i++) {
+        phone_number code = index->entries[i].code;
+        uint64_t first_block = 0;
+        uint64_t block_count = 1;
+
+        length_counts[code.digits]++;
+        index->hash_length_mask |= (uint16_t) (1u << code.digits);
+
+        // A code shorter than a group is a prefix of every group it pads out to
+        if (code.digits < RATE_HASH_BLOCK_LENGTH) {
+            block_count = power_of_ten(RATE_HASH_BLOCK_LENGTH - code.digits);
+            first_block = code.value * block_count;
+        } else {
+            first_block = code.value / power_of_ten(code.digits - RATE_HASH_BLOCK_LENGTH);
+        }
+
+        for (uint64_t block = first_block; block < first_block + block_count; block++) {
+            index->hash_length_masks[block] |= (uint16_t) (1u << code.digits);
+        }
+    }
+
+    for (unsigned int length = 1; length <= MAX_REGION_CODE_LENGTH; length++) {
+        if (length_counts[length] == 0) {
+            continue;
+        }
 
-            return 1;
-        } else {
-            user_call_list *current = *head;
+        rate_hash_table *table = &(index->hash_tables[length]);
+        size_t slot_count = 2;
+        unsigned int shift = 63;
 
-            while (current != NULL) {
-                
-                if (get_call_node_datetime(current) > get_call_node_datetime(new_node)) {
-                    // We found the node directly after the new node
-                    current->previous->next = new_node;
-                    new_node->previous = current->previous;
-                    new_node->next = current;
-                    current->previous = new_node;                   
-
-                    return 1;
-                } else if (current->next == NULL) {
-                    // Appending to end of list
-
-                    current->next = new_node;
-                    new_node->previous = current;
-                    new_node->next = NULL;
-
-                    return 1;
-                }
-                current = current->next;
-            }
+        while (slot_count < 2 * length_counts[length]) {
+            slot_count *= 2;
+            shift--;
         }
+
+        table->slots = calloc(slot_count, sizeof(uint32_t));
+        if (table->slots == NULL) {
+            fprintf(stderr, "Not enough memory to build the rate hash tables\n");
+            return 0;
+        }
+        table->mask = slot_count - 1;
+        table->shift = shift;
     }
-    // Shouldn't happen
-    return 0;
+
+    for (size_t i = 0; i < index->entry_count; i++) {
+        const rate_hash_table *table = &(index->hash_tables[index->entries[i].code.digits]);
+        uint64_t slot = hash_region_code(table, index->entries[i].code.value);
+
+        while (table->slots[slot] != 0) {
+            slot = (slot + 1) & table->mask;
+        }
+        table->slots[slot] = (uint32_t) (i + 1);
+    }
+
+    return 1;
 }
 
 /**
- *      Get call node datetime
- *      @brief Get the call node datetime.
+ *      Search rate hash
+ *      @brief Finds the longest region code match of a number by probing the hash table of every region code length that
+ *      occurs among the prefixes of its first digits, longest first. The first prefix found is the longest match.
  *      
- *      @param node The call whose datetime is to be returned.
- *      @return The year of the call multiplied by 100 plus the month of the call.
+ *      @param index The rate index.
+ *      @param callee_number The encoded number whose rate is to be found.
+ *      @return The matching rate entry, or @c NULL if no region code matches.
  */
-size_t get_call_node_datetime(user_call_list *node) {
-    return (node == NULL) ? 0 : (node->year * 100) + node->month;
-}
+const rate_entry *search_rate_hash(const rate_index *index, phone_number callee_number) {
+    unsigned int longest_length = (callee_number.digits < MAX_REGION_CODE_LENGTH) ? callee_number.digits : MAX_REGION_CODE_LENGTH;
+    uint32_t lengths = index->hash_length_mask;
 
-/**
- *      Print user call list
- * 
- *      @brief Prints a slice of a call linked list. If both indexes are set to 0, prints the entire list instead.
- * 
- *      @param head The head of the linked list.
- *      @param start_index The starting index of the list slice.
- *      @param end_index The ending index of the list slice.
- */
-void print_call_list(user_call_list *head, size_t start_index, size_t end_index) {
-    if (head == NULL) {
-        fprintf(stderr, "Cannot print NULL list, aborting\n");
-        return;
-    } else if (start_index > end_index) {
-        fprintf(stderr, "Starting index larger than ending index, aborting");
-        return;
+    if (callee_number.digits >= RATE_HASH_BLOCK_LENGTH) {
+        lengths = index->hash_length_masks[callee_number.value / power_of_ten(callee_number.digits - RATE_HASH_BLOCK_LENGTH)];
     }
-    
-    
-    user_call_list *current = head;
-    if ((start_index == 0) && (end_index == 0)) {
-        // If no start and end indexes were given print the whole list
+    lengths &= (2u << longest_length) - 1;
 
-        while (current != NULL) {
-        printf( "The called number is: \"%s\", "
-                "The price of the call is: %.2f, "
-                "and it took place in month %lu of %lu.\n", current->callee, current->price, current->month, current->year);
-        current = current->next;
-        }    
-    } else {
-        // Print list from start index to end index
-        size_t i = 0;
+    while (lengths != 0) {
+        unsigned int length = 31 - (unsigned int) __builtin_clz(lengths);
+        lengths &= ~(1u << length);
 
-        while (current != NULL) {
-            if (i >= start_index) {
-                // If we've reached the start index, print the node
-                printf( "The called number is: \"%s\","
-                        "The price of the call is: %.2f,\n"
-                        "and it took place in month %lu of %lu.\n", current->callee, current->price, current->month, current->year);
-            }
+        const rate_hash_table *table = &(index->hash_tables[length]);
+        uint64_t prefix = callee_number.value / power_of_ten(callee_number.digits - length);
+        uint64_t slot = hash_region_code(table, prefix);
 
-            if (i > end_index) {
-                // If we've exceeded the end index, exit the while loop
-                break;
+        while (table->slots[slot] != 0) {
+            const rate_entry *entry = &(index->entries[table->slots[slot] - 1]);
+            if (entry->code.value == prefix) {
+                return entry;
             }
-            i++;
-            current = current->next;
+            slot = (slot + 1) & table->mask;
         }
     }
-    return;   
+
+    return NULL;
 }
 
 /**
- *      Delete call linked list     
+ *      Hash region code
+ *      @brief Finds the home slot of an encoded region code by Fibonacci hashing, which spreads the consecutive values
+ *      region codes tend to have over the whole table.
+ *      
+ *      @param table The hash table of the region code's length.
+ *      @param value The encoded value of the region code.
+ *      @return The home slot.
+ */
+uint64_t hash_region_code(const rate_hash_table *table, uint64_t value) {
+    return (value * UINT64_C(11400714819323198485)) >> table->shift;
+}
+
+/**
+ *      Init rate cache
+ *      @brief Sets up an empty rate cache in front of a rate index. If its slots cannot be allocated the cache still works,
+ *      but every lookup goes to the index.
+ *      
+ *      @param cache The cache to be set up.
+ *      @param index The rate index looked up on a miss.
+ */
+void init_rate_cache(rate_cache *cache, const rate_index *index) {
+    cache->index = index;
+    cache->slots = calloc(RATE_CACHE_SIZE, sizeof(rate_cache_slot));
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+/**
+ *      Delete rate cache
+ *      @brief Adds the hits and misses of a rate cache to the totals of the process and frees its slots.
+ *      
+ *      @param cache The cache to be deleted.
+ */
+void delete_rate_cache(rate_cache *cache) {
+    pthread_mutex_lock(&(rate_cache_totals.lock));
+    rate_cache_totals.hits += cache->hits;
+    rate_cache_totals.misses += cache->misses;
+    pthread_mutex_unlock(&(rate_cache_totals.lock));
+
+    free(cache->slots);
+    cache->slots = NULL;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+/**
+ *      Search rate cache
  * 
- *      @brief Deletes a call linked list, freeing the memory it took up.
+ *      Every callee can only be kept in the one slot its hash selects, and a miss replaces whatever was there before. Callees
+ *      without a rate match are remembered as well, so repeated calls to them don't search the index either.
  * 
- *      @param head A double pointer to the head of the list. Will be set to NULL.
- *      @return 1 if successful, 0 if not. 
+ *      @brief Finds the longest region code match of a number, looking it up in the index only if the callee is not cached.
+ *      
+ *      @param cache The rate cache of the calling thread.
+ *      @param callee_number The encoded number whose rate is to be found.
+ *      @return The matching rate entry, or @c NULL if no region code matches.
  */
-int delete_call_list(user_call_list **head) {
-    if (*head == NULL) {
-        fprintf(stderr, "Cannot delete NULL list, aborting\n");
-        return 0;
+const rate_entry *search_rate_cache(rate_cache *cache, phone_number callee_number) {
+    if (cache->slots == NULL) {
+        cache->misses++;
+        return search_rate_index(cache->index, callee_number);
     }
 
-    user_call_list *current = *head;
+    uint64_t key = (callee_number.value * 16) + callee_number.digits;
+    rate_cache_slot *slot = &(cache->slots[(key * UINT64_C(11400714819323198485)) >> (64 - __builtin_ctz(RATE_CACHE_SIZE))]);
 
-    while (*head != NULL) {
-        current = *head;
+    if ((slot->value == callee_number.value) && (slot->digits == callee_number.digits)) {
+        cache->hits++;
+        return (slot->entry == 0) ? NULL : &(cache->index->entries[slot->entry - 1]);
+    }
 
-        free(current->callee);                       
-        current->callee = NULL;
+    cache->misses++;
+    const rate_entry *entry = search_rate_index(cache->index, callee_number);
 
-        *head = (*head)->next;
-        free(current);
-        current = NULL;
+    slot->value = callee_number.value;
+    slot->digits = callee_number.digits;
+    slot->entry = (entry == NULL) ? 0 : (uint32_t) (entry - cache->index->entries) + 1;
+
+    return entry;
+}
+
+/**
+ *      Print rate cache summary
+ *      @brief Prints how many rate lookups of the process were answered by a rate cache. Nothing is printed if there were
+ *      no lookups.
+ *      
+ *      @param stream The stream to print to.
+ */
+void print_rate_cache_summary(FILE *stream) {
+    pthread_mutex_lock(&(rate_cache_totals.lock));
+
+    size_t lookups = rate_cache_totals.hits + rate_cache_totals.misses;
+    if (lookups > 0) {
+        fprintf(stream, "Rate cache: %lu of %lu lookups hit (%.1f%%)\n", rate_cache_totals.hits, lookups,
+                100.0 * (double) rate_cache_totals.hits / (double) lookups);
     }
-    
-    return 1;
+
+    pthread_mutex_unlock(&(rate_cache_totals.lock));
 }
 
 /*****************************************************************************************************************
- * AVL RATE TREE FUNCTIONS                                                                                       *
- ****************************************************************************************************************/
+ * REGION DICTIONARY FUNCTIONS                                                                                   *
+ *****************************************************************************************************************/
 
 /**
- *      Insert rate tree node
- * 
- *      @brief Recursively inserts a new rate node to the rate AVL tree. The tree is automatically rebalanced in the process.
- *      Interfacing with the rate AVL tree should only be done through this function and the traversals.
+ *      Intern region name
+ *      @brief Looks up the ID of a region name, adding the name to the region dictionary if it is new. IDs are handed out in
+ *      the order names are first seen, starting at 0.
  *      
- *      @param node A pointer to the tree root. May change due to rebalancing.
- *      @param region_code The region_code string, cannot be NULL.
- *      @param rate The rate associated with the region_code.
- * 
- *      @returns The tree's new root.
+ *      @param name The region name.
+ *      @return The ID of the region, or @c RATE_REGION_NONE if there was not enough memory.
  */
-rate_node *add_rate_node(rate_node *node, const char *region_code, double rate) {
-    if (region_code == NULL) {
-        fprintf(stderr, "Number string empty, aborting\n");
-        return NULL;
+uint32_t intern_region_name(const char *name) {
+    if (((regions.count + 1) * 2 > regions.slot_count) && !(grow_region_dictionary())) {
+        return RATE_REGION_NONE;
     }
 
-    if (node == NULL){
-        return make_rate_node(region_code, rate);
+    size_t slot = (size_t) hash_region_name(name) & (regions.slot_count - 1);
+
+    while (regions.slots[slot] != 0) {
+        uint32_t region = regions.slots[slot] - 1;
+
+        if (strcmp(regions.names[region], name) == 0) {
+            return region;
+        }
+        slot = (slot + 1) & (regions.slot_count - 1);
     }
 
-    if (strcmp(region_code, node->region_code) < 0) {
-        // Going left
-        node->left = add_rate_node(node->left, region_code, rate);
-    } else if (strcmp(region_code, node->region_code) > 0) {
-        // Going right
-        node->right = add_rate_node(node->right, region_code, rate);
-    } else {
-        // This should not happen
-        fprintf(stderr, "Error: region code \"%s\" already found in tree\n", region_code);
-        return node;
+    char *new_name = malloc((strlen(name) + 1) * sizeof(char));
+    if (new_name == NULL) {
+        return RATE_REGION_NONE;
     }
-    
-    // Update node height
-    node->height = 1 + max(get_rate_node_height(node->left), get_rate_node_height(node->right));
+    strcpy(new_name, name);
 
-    // Get node balance    
-    int balance = get_rate_node_balance(node);
+    regions.names[regions.count] = new_name;
+    regions.count++;
+    regions.slots[slot] = (uint32_t) regions.count;
 
-    // Imbalance is in left child's left subtree
-    if ((balance > 1) && (strcmp(region_code, node->left->region_code) < 0)) {
-        return right_rotate_rate(node);
-    }
+    return (uint32_t) (regions.count - 1);
+}
 
-    // Imbalance is in right child's right subtree
-    if ((balance < -1) && (strcmp(region_code, node->right->region_code) > 0)) {
-        return left_rotate_rate(node);
+/**
+ *      Grow region dictionary
+ *      @brief Doubles the number of slots of the region dictionary, or sets up its first @c REGION_DICTIONARY_SLOTS , and
+ *      hashes every name into the new slots.
+ *      
+ *      @return 1 if successful, 0 if there was not enough memory. The dictionary is unchanged then.
+ */
+int grow_region_dictionary(void) {
+    size_t slot_count = (regions.slot_count == 0) ? REGION_DICTIONARY_SLOTS : regions.slot_count * 2;
+
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    char **names = realloc(regions.names, (slot_count / 2) * sizeof(char *));
+
+    if (names != NULL) {
+        regions.names = names;
     }
-    
-    // Imbalance is in left child's right subtree
-    if ((balance > 1) && (strcmp(region_code, node->left->region_code) > 0)) {
-        node->left = left_rotate_rate(node->left);
-        return right_rotate_rate(node);
+    if ((slots == NULL) || (names == NULL)) {
+        free(slots);
+        return 0;
     }
 
-    // Imbalance is in right child's left subtree
-    if ((balance < -1) && (strcmp(region_code, node->right->region_code) < 0)) {
-        node->right = right_rotate_rate(node->right);
-        return left_rotate_rate(node);
+    for (size_t region = 0; region < regions.count; region++) {
+        size_t slot = (size_t) hash_region_name(regions.names[region]) & (slot_count - 1);
+
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = (uint32_t) (region + 1);
     }
 
-    // Return the current node, unchanged
-    return node;    
+    free(regions.slots);
+    regions.slots = slots;
+    regions.slot_count = slot_count;
+
+    return 1;
 }
 
 /**
- *      Make rate node
- *      @brief Initializes a new rate node and returns a pointer to it. Is called internally by @c add_rate_node.
+ *      Hash region name
+ *      @brief Hashes a region name with 64 bit FNV-1a.
  *      
- *      @param region_code The region_code string, cannot be NULL.
- *      @param rate The rate associated with the region_code.
- *      @returns A pointer to the new rate node, or NULL if there was an error.
+ *      @param name The region name.
+ *      @return The hash.
  */
-rate_node *make_rate_node(const char *region_code, double rate) {
-    if (region_code == NULL) {
-        fprintf(stderr, "Number string empty, aborting\n");
-        return NULL;
-    }
+uint64_t hash_region_name(const char *name) {
+    uint64_t hash = UINT64_C(14695981039346656037);
 
-    rate_node *newNode = malloc(sizeof(rate_node));
-    if (newNode == NULL) {
-        fprintf(stderr, "Not enough memory to create new rate node, aborting\n");
-        return NULL;
-    }
-    
-    newNode->region_code = malloc((strlen(region_code) + 1) * sizeof(char));
-    if (newNode->region_code == NULL) {
-        fprintf(stderr, "Not enough memory to initialize region code field, aborting\n");
-        free(newNode);
-        newNode = NULL;
-        return NULL;
-    } else {
-        strcpy(newNode->region_code, region_code);
+    for (const unsigned char *current = (const unsigned char *) name; *current != '\0'; current++) {
+        hash = (hash ^ *current) * UINT64_C(1099511628211);
     }
-    
-    newNode->rate = rate;
 
-    newNode->height = 1;
+    return hash;
+}
 
-    newNode->left = NULL;
-    newNode->right = NULL;
+/**
+ *      Get region name
+ *      @brief Gets the name of a region by its ID.
+ *      
+ *      @param region The ID of the region.
+ *      @return The name of the region, or @c NULL if there is no region with this ID.
+ */
+const char *get_region_name(uint32_t region) {
+    return (region < regions.count) ? regions.names[region] : NULL;
+}
 
-    return newNode;
+/**
+ *      Get region count
+ *      @brief Gets the number of regions in the region dictionary. Every ID is less than it.
+ *      
+ *      @return The number of regions.
+ */
+size_t get_region_count(void) {
+    return regions.count;
 }
 
 /**
- *      Right rotate rate node
- *      @brief Performs a right rotation around a given node's left child. Should only be called by the @c add_rate_node function.
+ *      Get region names length
+ *      @brief Gets the length of every region name put one after another, each with its terminating null character, as they
+ *      are stored in compiled rate tables and rate snapshots.
  *      
- *      @param node The node to be right rotated
- *      @returns The passed node's left child, which is the new subtree root.
+ *      @return The length in bytes.
  */
-rate_node *right_rotate_rate(rate_node *node) {
-    rate_node *leftChild = node->left;
-    rate_node * leftChildRight = leftChild->right;
+size_t get_region_names_length(void) {
+    size_t length = 0;
 
-    // Rotate around left child
-    leftChild->right = node;
-    node->left = leftChildRight;
+    for (size_t region = 0; region < regions.count; region++) {
+        length += strlen(regions.names[region]) + 1;
+    }
 
-    // Update heights
-    node->height = 1 + max(get_rate_node_height(node->left), get_rate_node_height(node->right));
-    leftChild->height = 1 + max(get_rate_node_height(leftChild->left), get_rate_node_height(leftChild->right));
+    return length;
+}
 
-    // The left child is now the subtree root
-    return leftChild;
+/**
+ *      Load region names
+ *      @brief Replaces the region dictionary with the region names of a compiled rate table or rate snapshot, so that each
+ *      name gets its ID back.
+ *      
+ *      @param names The region names in the order of their IDs, each terminated by a null character.
+ *      @param length The length of @c names in bytes.
+ *      @param count The number of regions.
+ *      @return 1 if successful, 0 if the names are cut off, repeated or there was not enough memory. The dictionary is empty
+ *      then.
+ */
+int load_region_names(const char *names, size_t length, size_t count) {
+    delete_region_dictionary();
+
+    size_t position = 0;
+
+    for (size_t region = 0; region < count; region++) {
+        const char *end = memchr(names + position, '\0', length - position);
+
+        // A repeated name would get the ID of its first occurrence
+        if ((end == NULL) || (intern_region_name(names + position) != region)) {
+            delete_region_dictionary();
+            return 0;
+        }
+        position = (size_t) (end - names) + 1;
+    }
+
+    return 1;
 }
 
 /**
- *      Left rotate rate node
- *      @brief Performs a left rotation around a given node's right child. Should only be called by the @c add_rate_node function.
+ *      Delete region dictionary
+ *      @brief Frees every region name and empties the region dictionary.
+ */
+void delete_region_dictionary(void) {
+    for (size_t region = 0; region < regions.count; region++) {
+        free(regions.names[region]);
+    }
+    free(regions.names);
+    free(regions.slots);
+
+    regions.names = NULL;
+    regions.count = 0;
+    regions.slots = NULL;
+    regions.slot_count = 0;
+}
+
+/**
+ *      Write region report
+ * 
+ *      Every call carries the ID of its region, so the calls are added up in an array indexed by it and nothing has to be
+ *      matched against the rates again. Each line holds a region name, the number of calls, their duration in seconds and
+ *      their price, regions without calls are left out.
+ * 
+ *      @brief Writes the number, duration and revenue of the calls of every user per region as csv.
  *      
- *      @param node The node to be left rotated
- *      @returns The passed node's right child, which is the new subtree root.
+ *      @param report The file the report is written to.
+ *      @param root The root of the user tree.
+ *      @return 1 if successful, 0 if there was not enough memory or writing failed.
  */
-rate_node *left_rotate_rate(rate_node *node) {
-        rate_node *rightChild = node->right;
-        rate_node * rightChildLeft = rightChild->left;
+int write_region_report(FILE *report, user_node *root) {
+    region_total *totals = calloc(regions.count + 1, sizeof(region_total));
+    if (totals == NULL) {
+        fprintf(stderr, "Not enough memory to add up the calls per region\n");
+        return 0;
+    }
 
-        // Rotate around right child
-        rightChild->left = node;
-        node->right = rightChildLeft;
+    add_region_totals(root, totals);
 
-        // Update heights
-        node->height = 1 + max(get_rate_node_height(node->left), get_rate_node_height(node->right));
-        rightChild->height = 1 + max(get_rate_node_height(rightChild->left), get_rate_node_height(rightChild->right));
+    for (size_t region = 0; region < regions.count; region++) {
+        if (totals[region].call_count > 0) {
+            fprintf(report, "%s,%lu,%lu,%.2f\n", regions.names[region], totals[region].call_count, totals[region].call_duration,
+                    totals[region].revenue);
+        }
+    }
+
+    free(totals);
 
-        // The right child is now the subtree root
-        return rightChild;
+    return !(ferror(report));
 }
 
 /**
- *      Traverse rates inorder
- *      @brief Traverses a given rate tree inorder. Useful for printing.
+ *      Add region totals
+ *      @brief Recursively adds the calls of every user in a tree to the totals of their regions. Calls without a rate match
+ *      are skipped.
  *      
- *      @param node The root of the tree
- *      @param visit The function to be performed upon visiting
+ *      @param node The root of the user tree. May be @c NULL .
+ *      @param totals The totals, indexed by region ID.
  */
-void traverse_rates_inorder(rate_node *node, void (*visit) (rate_node*)) {
-    if (node == NULL) return;
+void add_region_totals(user_node *node, region_total *totals) {
+    if (node == NULL) {
+        return;
+    }
 
-    traverse_rates_inorder(node->left, visit);
-    visit(node);
-    traverse_rates_inorder(node->right, visit);
+    for (user_call_list *call = node->call_list_head; call != NULL; call = call->next) {
+        if (call->region != RATE_REGION_NONE) {
+            totals[call->region].call_count++;
+            totals[call->region].call_duration += call->duration;
+            totals[call->region].revenue += call->price;
+        }
+    }
+
+    add_region_totals(node->left, totals);
+    add_region_totals(node->right, totals);
 }
 
+/*****************************************************************************************************************
+ * TIME BAND FUNCTIONS                                                                                           *
+ ****************************************************************************************************************/
+
 /**
- *      Traverse rates postorder
- *      @brief Traverses a given rate tree postorder. Useful for deletition.
+ *      Intern time band
+ *      @brief Finds the time band of a region code in a table, adding a band whose multipliers are all 1 if it has none yet.
  *      
- *      @param node The root of the tree
- *      @param visit The function to be performed upon visiting
+ *      @param table The time band table.
+ *      @param code The encoded region code.
+ *      @return The band of the region code, @c TIME_BAND_NONE if there was not enough memory.
  */
-void traverse_rates_postorder(rate_node *node, void (*visit) (rate_node*)) {
-    if (node == NULL) return;
+uint32_t intern_time_band(time_band_table *table, phone_number code) {
+    for (size_t band = 0; band < table->count; band++) {
+        if ((table->codes[band].value == code.value) && (table->codes[band].digits == code.digits)) {
+            return (uint32_t) (band + 1);
+        }
+    }
 
-    traverse_rates_postorder(node->left, visit);
-    traverse_rates_postorder(node->right, visit);
-    visit(node);
+    if (table->count + 1 >= UINT32_MAX) {
+        return TIME_BAND_NONE;
+    }
+
+    phone_number *codes = realloc(table->codes, (table->count + 1) * sizeof(phone_number));
+    if (codes == NULL) {
+        return TIME_BAND_NONE;
+    }
+    table->codes = codes;
+
+    double *multipliers = realloc(table->multipliers, (table->count + 1) * TIME_BAND_SLOT_COUNT * sizeof(double));
+    if (multipliers == NULL) {
+        return TIME_BAND_NONE;
+    }
+    table->multipliers = multipliers;
+
+    for (size_t slot = 0; slot < TIME_BAND_SLOT_COUNT; slot++) {
+        table->multipliers[(table->count * TIME_BAND_SLOT_COUNT) + slot] = 1;
+    }
+    table->codes[table->count] = code;
+    table->count++;
+
+    return (uint32_t) table->count;
 }
 
 /**
- *      Print rate node
- *      @brief Prints a single node in a rate AVL tree. Can be used for traversals.
+ *      Apply time bands
+ *      @brief Recursively gives every node of a rate tree its time band. Has to be called before the tree is pruned, so that
+ *      region codes with a band of their own are kept.
  *      
- *      @param node The node to be printed
+ *      @param node The root of the rate tree or of the tree of range rows. May be @c NULL .
+ *      @param table The time band table.
  */
-void print_rate_node(rate_node *node) {
+void apply_time_bands(rate_node *node, const time_band_table *table) {
     if (node == NULL) {
-        printf("Node is NULL\n");
         return;
     }
-    printf("Key: %s, Rate: %f\n", node->region_code, node->rate);
-    return;
+
+    node->time_band = find_time_band(table, node);
+
+    apply_time_bands(node->left, table);
+    apply_time_bands(node->right, table);
 }
 
 /**
- *      Delete rate node
- *      @brief Deletes a single node from a rate AVL tree. Can be used for (postorder) traversals.
+ *      Find time band
+ *      @brief Finds the band of the longest time band region code a rate node's region code starts with. A range row has
+ *      to start with it in both of its blocks.
  *      
- *      @param node The node to be deleted
+ *      @param table The time band table.
+ *      @param node The rate node.
+ *      @return The band, @c TIME_BAND_NONE if no time band region code matches.
  */
-void delete_rate_node(rate_node *node) {
-    if (node == NULL) {
-        fprintf(stderr, "Cannot delete NULL node\n");
-        return;
+uint32_t find_time_band(const time_band_table *table, const rate_node *node) {
+    uint32_t longest_band = TIME_BAND_NONE;
+    unsigned int longest_digits = 0;
+
+    for (size_t band = 0; band < table->count; band++) {
+        phone_number code = table->codes[band];
+
+        if ((code.digits <= longest_digits) || (code.digits > node->code.digits) ||
+            (phone_number_prefix(node->code, code.digits).value != code.value) ||
+            ((node->range_end.digits > 0) && (phone_number_prefix(node->range_end, code.digits).value != code.value))) {
+            continue;
+        }
+
+        longest_band = (uint32_t) (band + 1);
+        longest_digits = code.digits;
     }
-    free(node->region_code);
-    node->region_code = NULL;
-    node->left = NULL;
-    node->right = NULL;
 
-    free(node);
+    return longest_band;
 }
 
 /**
- *      Get rate node height
- *      @brief Get the rate node height
+ *      Add time band rates
+ * 
+ *      A band only reaches the rate nodes whose region code starts with it. A band code longer than the region code its
+ *      numbers are billed under would never be found, so such a code gets a rate node of its own that copies the versions
+ *      and region of the longest rate or range row it falls into. Band codes that no rate or range row covers or starts
+ *      with are reported and ignored.
+ * 
+ *      @brief Splits a rate node off for every time band region code that has none, so that @c apply_time_bands can give
+ *      the band to it. Has to be called before @c apply_time_bands .
  *      
- *      @param node The node whose height is to be checked
- *      @returns @c 0 if the node is @c NULL, otherwise its height
+ *      @param rate_root The root of the rate tree.
+ *      @param range_root The root of the tree of range rows. May be @c NULL .
+ *      @param table The time band table.
+ *      @return The rate tree's new root.
  */
-int get_rate_node_height(rate_node *node) {
+rate_node *add_time_band_rates(rate_node *rate_root, const rate_node *range_root, const time_band_table *table) {
+    for (size_t band = 0; band < table->count; band++) {
+        phone_number code = table->codes[band];
+        char code_string[MAX_PHONE_NUMBER_LENGTH + 1];
+        format_phone_number(code, code_string);
+
+        const rate_node *parent = search_by_longest_region_code_match(rate_root, code);
+        const rate_node *range_parent = search_rate_range_rows(range_root, code);
+
+        if ((range_parent != NULL) && ((parent == NULL) || (range_parent->code.digits > parent->code.digits))) {
+            parent = range_parent;
+        }
+
+        if ((parent != NULL) && (parent->range_end.digits == 0) && (parent->code.digits == code.digits)) {
+            // The band has a rate node of its own
+            continue;
+        }
+
+        if (parent == NULL) {
+            if (!(has_rate_row_under(rate_root, code)) && !(has_rate_row_under(range_root, code))) {
+                report_diagnostic(DIAGNOSTIC_INVALID_TIME_BAND, "Time band region code \"%s\" matches no rate and is ignored", code_string);
+            }
+            continue;
+        }
+
+        rate_root = add_rate_node(rate_root, code_string, parent->versions[0].rate, parent->versions[0].effective_date, parent->region);
+
+        rate_node *child = search_by_longest_region_code_match(rate_root, code);
+        for (size_t i = 1; (child != NULL) && (i < parent->version_count); i++) {
+            add_rate_version(child, parent->versions[i].rate, parent->versions[i].effective_date);
+        }
+    }
+
+    return rate_root;
+}
+
+/**
+ *      Search rate range rows
+ *      @brief Finds the longest range row in a tree of range rows that holds a region code.
+ *      
+ *      @param node The root of the tree of range rows. May be @c NULL .
+ *      @param code The encoded region code.
+ *      @return The longest range row whose blocks are at most as long as the code and hold its prefix, @c NULL if there is none.
+ */
+const rate_node *search_rate_range_rows(const rate_node *node, phone_number code) {
     if (node == NULL) {
-        return 0;
+        return NULL;
     }
-    return node->height;    
+
+    const rate_node *longest = NULL;
+
+    if (node->code.digits <= code.digits) {
+        uint64_t block = phone_number_prefix(code, node->code.digits).value;
+        if ((block >= node->code.value) && (block <= node->range_end.value)) {
+            longest = node;
+        }
+    }
+
+    const rate_node *left = search_rate_range_rows(node->left, code);
+    const rate_node *right = search_rate_range_rows(node->right, code);
+
+    if ((left != NULL) && ((longest == NULL) || (left->code.digits > longest->code.digits))) {
+        longest = left;
+    }
+    if ((right != NULL) && ((longest == NULL) || (right->code.digits > longest->code.digits))) {
+        longest = right;
+    }
+
+    return longest;
 }
 
 /**
- *      Get rate node balance
- *      @brief Get the rate node balance
+ *      Has rate row under
+ *      @brief Checks whether any node of a rate tree has a region code that starts with a given one.
  *      
- *      @param node The node whose balance is to be checked
- *      @returns @c 0 if the node is @c NULL, otherwise its balance
+ *      @param node The root of the rate tree or of the tree of range rows. May be @c NULL .
+ *      @param code The encoded region code.
+ *      @return 1 if a longer region code starts with @c code , 0 if not.
  */
-int get_rate_node_balance(rate_node *node) {
+int has_rate_row_under(const rate_node *node, phone_number code) {
     if (node == NULL) {
         return 0;
     }
-    return get_rate_node_height(node->left) - get_rate_node_height(node->right);    
+
+    return is_region_code_prefix(code, node->code) || has_rate_row_under(node->left, code) || has_rate_row_under(node->right, code);
 }
 
 /**
- *      Search rate tree
- *      @brief Recursively search through rate tree, based on a given region code.
+ *      Delete time band table
+ *      @brief Frees the region codes and multipliers of a time band table and leaves it empty.
  *      
- *      @param root The root of the tree to be searched.
- *      @param region_code The region code to search for. Cannot be @c NULL .
- *      @return The rate node with the appropriate region code, or @c NULL if no node was found.
+ *      @param table The time band table.
  */
-rate_node *search_rate_tree(rate_node *root, const char *region_code) {
-    if (region_code == NULL) {
-        fprintf(stderr, "Cannot search for NULL string, aborting\n");
-        return NULL;
-    }
-    
-    if (root == NULL) {
-        return NULL;
-    }
-    
+void delete_time_band_table(time_band_table *table) {
+    free(table->codes);
+    free(table->multipliers);
 
-    if ((strcmp(region_code, root->region_code) == 0)) {
-        return root;
-    }
-    
-    if (strcmp(region_code, root->region_code) < 0) {
-        return search_rate_tree(root->left, region_code);
-    } else {
-        return search_rate_tree(root->right, region_code);
-    }
-    
-    return NULL;
+    table->codes = NULL;
+    table->multipliers = NULL;
+    table->count = 0;
 }
 
 /*****************************************************************************************************************
@@ -1121,45 +5908,41 @@ rate_node *search_rate_tree(rate_node *root, const char *region_code) {
  *      Interfacing with the user AVL tree should only be done through this function and the traversals.
  *      
  *      @param node A pointer to the tree root. May change due to rebalancing.
- *      @param caller_number The user number string, cannot be NULL.
- *      @param callee_number The number being called, cannot be NULL.
- *      @param duration The duration of the call.
- *      @param year The year the call took place in.
- *      @param month The month the call took place in.
- *      @param rate_root The root of the rate tree that the rate plans are stored in.
+ *      @param call The call to be added, its caller is the user.
+ *      @param rates The rate cache of the parsing thread the calls are rated with.
  * 
  *      @returns The tree's new root.
  */
-user_node *add_user_node(user_node *node, const char *caller_number, char *callee_number, size_t duration, size_t year, size_t month, size_t day, rate_node *rate_root, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
-    if (caller_number == NULL) {
-        fprintf(stderr, "Number string empty, aborting\n");
-        return NULL;
-    }
+user_node *add_user_node(user_node *node, const decoded_call *call, rate_cache *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price) {
+    phone_number caller_number = call->caller;
 
     if (node == NULL){
 
         user_node *temp_new_user_node = make_user_node(caller_number);
+        if (temp_new_user_node == NULL) {
+            return NULL;
+        }
 
         // Inserting into the call linked list
-        insert_call(&(temp_new_user_node->call_list_head), callee_number, duration, year, month, day, rate_root, total_call_number, total_call_duration, total_call_price);
+        insert_call(&(temp_new_user_node->call_list_head), &(temp_new_user_node->last_call), call, rates, total_call_number, total_call_duration, total_call_price);
 
         calculate_user_stats(temp_new_user_node);
 
         return temp_new_user_node;
     }
 
-    if (strcmp(caller_number, node->number) < 0) {
+    if (compare_phone_numbers(caller_number, node->key) < 0) {
         // Going left
-        node->left = add_user_node(node->left, caller_number, callee_number, duration, year, month, day, rate_root, total_call_number, total_call_duration, total_call_price);
-    } else if (strcmp(caller_number, node->number) > 0) {
+        node->left = add_user_node(node->left, call, rates, total_call_number, total_call_duration, total_call_price);
+    } else if (compare_phone_numbers(caller_number, node->key) > 0) {
         // Going right
-        node->right = add_user_node(node->right, caller_number, callee_number, duration, year, month, day, rate_root, total_call_number, total_call_duration, total_call_price);
+        node->right = add_user_node(node->right, call, rates, total_call_number, total_call_duration, total_call_price);
     } else {
         // The user already has a node - in this case we just want to add to their call data linked list
         // printf("User present in tree, appending call data\n");
 
         // Inserting into the call linked list
-        insert_call(&(node->call_list_head), callee_number, duration, year, month, day, rate_root, total_call_number, total_call_duration, total_call_price);
+        insert_call(&(node->call_list_head), &(node->last_call), call, rates, total_call_number, total_call_duration, total_call_price);
 
         calculate_user_stats(node);
 
@@ -1173,23 +5956,23 @@ user_node *add_user_node(user_node *node, const char *caller_number, char *calle
     int balance = get_user_node_balance(node);
 
     // Imbalance is in left child's left subtree
-    if ((balance > 1) && (strcmp(caller_number, node->left->number) < 0)) {
+    if ((balance > 1) && (compare_phone_numbers(caller_number, node->left->key) < 0)) {
         return right_rotate_user(node);
     }
 
     // Imbalance is in right child's right subtree
-    if ((balance < -1) && (strcmp(caller_number, node->right->number) > 0)) {
+    if ((balance < -1) && (compare_phone_numbers(caller_number, node->right->key) > 0)) {
         return left_rotate_user(node);
     }
     
     // Imbalance is in left child's right subtree
-    if ((balance > 1) && (strcmp(caller_number, node->left->number) > 0)) {
+    if ((balance > 1) && (compare_phone_numbers(caller_number, node->left->key) > 0)) {
         node->left = left_rotate_user(node->left);
         return right_rotate_user(node);
     }
 
     // Imbalance is in right child's left subtree
-    if ((balance < -1) && (strcmp(caller_number, node->right->number) < 0)) {
+    if ((balance < -1) && (compare_phone_numbers(caller_number, node->right->key) < 0)) {
         node->right = right_rotate_user(node->right);
         return left_rotate_user(node);
     }
@@ -1198,33 +5981,134 @@ user_node *add_user_node(user_node *node, const char *caller_number, char *calle
     return node;    
 }
 
+/**
+ *      Merge user trees
+ * 
+ *      @brief Moves every node of a source user tree into a destination user tree. Users present in both trees get their call
+ *      lists merged and their stats recalculated. The source tree must not be used afterwards.
+ *      
+ *      @param destination The root of the tree the users are moved into. May be @c NULL .
+ *      @param source The root of the tree whose users are moved. May be @c NULL .
+ * 
+ *      @returns The destination tree's new root.
+ */
+user_node *merge_user_trees(user_node *destination, user_node *source) {
+    if (source == NULL) {
+        return destination;
+    }
+
+    // Detach the children before the node is relinked
+    user_node *source_left = source->left;
+    user_node *source_right = source->right;
+
+    source->left = NULL;
+    source->right = NULL;
+    source->height = 1;
+
+    destination = insert_user_node(destination, source);
+    destination = merge_user_trees(destination, source_left);
+    destination = merge_user_trees(destination, source_right);
+
+    return destination;
+}
+
+/**
+ *      Insert existing user node
+ * 
+ *      @brief Recursively inserts an already initialized, detached user node into the user AVL tree, rebalancing it in the
+ *      process. If the user is already present the new node's calls are merged into the existing node and the new node is freed.
+ *      
+ *      @param node A pointer to the tree root. May change due to rebalancing.
+ *      @param new_node The node to be inserted, cannot be NULL.
+ * 
+ *      @returns The tree's new root.
+ */
+user_node *insert_user_node(user_node *node, user_node *new_node) {
+    if (node == NULL) {
+        return new_node;
+    }
+
+    if (compare_phone_numbers(new_node->key, node->key) < 0) {
+        // Going left
+        node->left = insert_user_node(node->left, new_node);
+    } else if (compare_phone_numbers(new_node->key, node->key) > 0) {
+        // Going right
+        node->right = insert_user_node(node->right, new_node);
+    } else {
+        // The user already has a node - move the calls over and drop the duplicate
+        node->call_list_head = merge_call_lists(node->call_list_head, new_node->call_list_head);
+        node->last_call = node->call_list_head;
+        new_node->call_list_head = NULL;
+        new_node->last_call = NULL;
+
+        calculate_user_stats(node);
+
+        free(new_node->number);
+        free(new_node);
+
+        return node;
+    }
+
+    // Update node height
+    node->height = 1 + max(get_user_node_height(node->left), get_user_node_height(node->right));
+
+    // Get node balance    
+    int balance = get_user_node_balance(node);
+
+    // Imbalance is in left child's left subtree
+    if ((balance > 1) && (compare_phone_numbers(new_node->key, node->left->key) < 0)) {
+        return right_rotate_user(node);
+    }
+
+    // Imbalance is in right child's right subtree
+    if ((balance < -1) && (compare_phone_numbers(new_node->key, node->right->key) > 0)) {
+        return left_rotate_user(node);
+    }
+    
+    // Imbalance is in left child's right subtree
+    if ((balance > 1) && (compare_phone_numbers(new_node->key, node->left->key) > 0)) {
+        node->left = left_rotate_user(node->left);
+        return right_rotate_user(node);
+    }
+
+    // Imbalance is in right child's left subtree
+    if ((balance < -1) && (compare_phone_numbers(new_node->key, node->right->key) < 0)) {
+        node->right = right_rotate_user(node->right);
+        return left_rotate_user(node);
+    }
+
+    // Return the current node, unchanged
+    return node;
+}
+
 /**
  *      Make user node
  *      @brief Initializes a new user node and returns a pointer to it. Is called internally by @c add_user_node.
  *      
- *      @param caller_number The user's number string, cannot be NULL.
+ *      @param caller_number The user's encoded number.
  *      @returns A pointer to the new user node, or NULL if there was an error.
  */
-user_node *make_user_node(const char *caller_number) {
-    if (caller_number == NULL) {
-        fprintf(stderr, "Caller number string empty, aborting\n");
-        return NULL;
-    }
-
+user_node *make_user_node(phone_number caller_number) {
     user_node *newNode = malloc(sizeof(user_node));
     if (newNode == NULL) {
         fprintf(stderr, "Not enough memory to create new user node, aborting\n");
         return NULL;
     }
+
+    newNode->key = caller_number;
+
+    // The string form is only needed for the output files, so it is created once per user
+    char caller_number_string[MAX_PHONE_NUMBER_LENGTH + 1];
+    format_phone_number(caller_number, caller_number_string);
     
-    newNode->number = malloc((strlen(caller_number) + 1) * sizeof(char));
+    newNode->number = malloc((strlen(caller_number_string) + 1) * sizeof(char));
     if (newNode->number == NULL) {
         fprintf(stderr, "Not enough memory to initialize caller number field, aborting\n");
         free(newNode);
         newNode = NULL;
         return NULL;
     } else {
-        strcpy(newNode->number, caller_number);
+        strcpy(newNode->number, caller_number_string);
     }
     
     newNode->total_bill = 0;
@@ -1232,6 +6116,7 @@ user_node *make_user_node(const char *caller_number) {
     newNode->total_call_number = 0;
 
     newNode->call_list_head = NULL;
+    newNode->last_call = NULL;
 
     newNode->height = 1;
 
@@ -1366,6 +6251,7 @@ void delete_user_node(user_node *node) {
     node->number = NULL;
 
     delete_call_list(&(node->call_list_head));
+    node->last_call = NULL;
 
     node->left = NULL;
     node->right = NULL;
@@ -1458,7 +6344,7 @@ void generate_monthly_cdr_files(user_node *user) {
         char *filename = generate_cdr_filename(user->number, current_datetime);
 
         // Create a file for the current month
-        current_monthly_cdr_bill = open_monthly_cdr_bill(filename);
+        current_monthly_cdr_bill = open_monthly_cdr_bill(filename, "w");
         if (current_monthly_cdr_bill == NULL) {
             fprintf(stderr, "Opening file \"%s\" has failed, aborting program\n", filename);
             exit(1);
@@ -1466,30 +6352,12 @@ void generate_monthly_cdr_files(user_node *user) {
         
         // Keep writing to the same file until the call month changes
         while (current_datetime == get_call_node_datetime(current_user_call)) {
-            // Censor callee number
-            char *callee_number_censored = censor_calee_number(current_user_call->callee);
-
-            // Calculate call timecode
-            size_t call_seconds = calculate_call_seconds(current_user_call->duration);
-            size_t call_minutes = calculate_call_minutes(current_user_call->duration);
-            size_t call_hours = calculate_call_hours(current_user_call->duration);
-
             // Print to the file
-            fprintf(current_monthly_cdr_bill, "%s, %s, %ld:%02ld:%02ld, %ld-%ld-%ld\n", 
-                        user->number, 
-                        callee_number_censored, 
-                        call_hours, 
-                        call_minutes, 
-                        call_seconds,
-                        current_user_call->year,
-                        current_user_call->month,
-                        current_user_call->day);
+            write_cdr_row(current_monthly_cdr_bill, user->number, current_user_call);
 
             // None of these memory blocks are needed at this point
             free(filename);
             filename = NULL;
-            free(callee_number_censored);
-            callee_number_censored = NULL;
             
             // If there is no next call, finish up file handling and exit the function.
             if(current_user_call->next == NULL) {
@@ -1508,13 +6376,40 @@ void generate_monthly_cdr_files(user_node *user) {
     return;
 }
 
+/**
+ *      Write cdr row
+ *      @brief Writes a single call to a cdr file, with the callee's number censored.
+ *      
+ *      @param cdr_file The cdr file.
+ *      @param user_number The number of the user who made the call.
+ *      @param call The call to be written.
+ *      @return 1 if successful, 0 if writing failed.
+ */
+int write_cdr_row(FILE *cdr_file, const char *user_number, const user_call_list *call) {
+    // Censor callee number
+    char callee_number_censored[MAX_PHONE_NUMBER_LENGTH + 1];
+    censor_calee_number(call->callee, callee_number_censored);
+
+    // Calculate call timecode
+    size_t call_seconds = calculate_call_seconds(call->duration);
+    size_t call_minutes = calculate_call_minutes(call->duration);
+    size_t call_hours = calculate_call_hours(call->duration);
+
+    return fprintf(cdr_file, "%s, %s, %ld:%02ld:%02ld, %ld-%ld-%ld\n", 
+                user_number, 
+                callee_number_censored, 
+                call_hours, 
+                call_minutes, 
+                call_seconds,
+                call->year,
+                call->month,
+                call->day) >= 0;
+}
+
 void generate_monthly_bill_files(user_node *user) {
     // The current call being processed
     user_call_list *current_user_call = user->call_list_head;
 
-    // The file the call is to be logged in
-    FILE *current_monthly_bill = NULL;
-
     while (current_user_call != NULL) {
 
         size_t current_datetime = get_call_node_datetime(current_user_call);
@@ -1537,79 +6432,97 @@ void generate_monthly_bill_files(user_node *user) {
             current_user_call = current_user_call->next;
         }
 
-        // File and file contents generated here
-
-        size_t month = current_datetime % 100;
-
-        char month_string[20];
+        write_monthly_bill(user->number, current_datetime, total_monthly_calls, total_monthly_duration, total_mothly_bill);
+    }
+}
 
-        switch (month) {
-            case JANUARY:
-                strcpy(month_string, "January");
-                break;
-            case FEBRUARY:
-                strcpy(month_string, "February");
-                break;
-            case MARCH:
-                strcpy(month_string, "March");
-                break;
-            case APRIL:
-                strcpy(month_string, "April");
-                break;
-            case MAY:
-                strcpy(month_string, "May");
-                break;
-            case JUNE:
-                strcpy(month_string, "June");
-                break;
-            case JULY:
-                strcpy(month_string, "July");
-                break;
-            case AUGUST:
-                strcpy(month_string, "August");
-                break;
-            case SEPTEMBER:
-                strcpy(month_string, "September");
-                break;
-            case OCTOBER:
-                strcpy(month_string, "October");
-                break;
-            case NOVEMBER:
-                strcpy(month_string, "November");
-                break;
-            case DECEMBER:
-                strcpy(month_string, "December");
-                break;
-            default:
-                fprintf(stderr, "Error: Illegal month found, aborting\n");
-                exit(1);
-                break;
-        }
-        // Calculate call timecode
-        size_t total_call_seconds = calculate_call_seconds(total_monthly_duration);
-        size_t total_call_minutes = calculate_call_minutes(total_monthly_duration);
-        size_t total_call_hours = calculate_call_hours(total_monthly_duration);
+/**
+ *      Write monthly bill
+ *      @brief Writes a user's bill for a single month.
+ *      
+ *      @param user_number The user's number in @c string format.
+ *      @param datetime The year of the bill multiplied by 100, plus the month of the bill.
+ *      @param call_count The number of calls in the month.
+ *      @param call_duration The duration of the calls in the month.
+ *      @param bill The price of the calls in the month.
+ *      @return 1 if successfull, 0 if not.
+ */
+int write_monthly_bill(char *user_number, size_t datetime, size_t call_count, size_t call_duration, double bill) {
+    size_t month = datetime % 100;
 
-        char *filename = generate_monthly_bill_filename(user->number, current_datetime);
+    char month_string[20];
 
-        current_monthly_bill = open_monthly_cdr_bill(filename);
-        if (current_monthly_bill == NULL) {
-            fprintf(stderr, "Error generating bill for %s %lu for user %s\n", month_string, current_datetime, user->number);
-            continue;
-        }
-        
+    switch (month) {
+        case JANUARY:
+            strcpy(month_string, "January");
+            break;
+        case FEBRUARY:
+            strcpy(month_string, "February");
+            break;
+        case MARCH:
+            strcpy(month_string, "March");
+            break;
+        case APRIL:
+            strcpy(month_string, "April");
+            break;
+        case MAY:
+            strcpy(month_string, "May");
+            break;
+        case JUNE:
+            strcpy(month_string, "June");
+            break;
+        case JULY:
+            strcpy(month_string, "July");
+            break;
+        case AUGUST:
+            strcpy(month_string, "August");
+            break;
+        case SEPTEMBER:
+            strcpy(month_string, "September");
+            break;
+        case OCTOBER:
+            strcpy(month_string, "October");
+            break;
+        case NOVEMBER:
+            strcpy(month_string, "November");
+            break;
+        case DECEMBER:
+            strcpy(month_string, "December");
+            break;
+        default:
+            fprintf(stderr, "Error: Illegal month found, aborting\n");
+            exit(1);
+            break;
+    }
+    // Calculate call timecode
+    size_t total_call_seconds = calculate_call_seconds(call_duration);
+    size_t total_call_minutes = calculate_call_minutes(call_duration);
+    size_t total_call_hours = calculate_call_hours(call_duration);
 
-        fprintf(current_monthly_bill,   "Invoice for %s for Subscriber %s\n"
-                                        "Calls: %lu\n"
-                                        "Duration: %lu:%02lu:%02lu\n"
-                                        "Price: %.2f €", 
-                                        month_string, user->number,
-                                        total_monthly_calls,
-                                        total_call_hours, total_call_minutes, total_call_seconds,
-                                        total_mothly_bill);
+    char *filename = generate_monthly_bill_filename(user_number, datetime);
+    if (filename == NULL) {
+        return 0;
+    }
 
+    FILE *monthly_bill = open_monthly_cdr_bill(filename, "w");
+    if (monthly_bill == NULL) {
+        fprintf(stderr, "Error generating bill for %s %lu for user %s\n", month_string, datetime, user_number);
         free(filename);
-        close_monthly_cdr_bill(current_monthly_bill);
-        current_monthly_bill = NULL;
+        return 0;
     }
+    
+
+    fprintf(monthly_bill,   "Invoice for %s for Subscriber %s\n"
+                            "Calls: %lu\n"
+                            "Duration: %lu:%02lu:%02lu\n"
+                            "Price: %.2f €", 
+                            month_string, user_number,
+                            call_count,
+                            total_call_hours, total_call_minutes, total_call_seconds,
+                            bill);
+
+    free(filename);
+    close_monthly_cdr_bill(monthly_bill);
+
+    return 1;
 }
\ No newline at end of file
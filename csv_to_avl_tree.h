@@ -5,7 +5,11 @@
  *      
  *      @brief The external function header for the csv based phone billing project. It saves rate data in an AVL tree and user data in an
  *      AVL tree where each node is the head of a linked list containing the respective user's call data. Data is collected by parsing two
- *      csv files using @c fgets , @c strtok and @c sscanf . Invalid or corrupt data is logged and discarded with no attempt at recovery.
+ *      (optionally gzip compressed) csv files using @c mmap (or buffered reads for pipes), a SIMD csv field scanner and fixed layout decoders.
+ *      Large call records are parsed in newline aligned chunks on several threads and several call records are read at once,
+ *      the resulting partial user trees are merged afterwards.
+ *      Invalid or corrupt data is counted per category and discarded with no attempt at recovery, a summary of the errors is
+ *      printed at the end.
  * 
  *      https://github.com/NestorHiebl/c_phone_billing_system
  */
@@ -14,43 +18,519 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <zlib.h>
 
 #ifndef CSV_TO_AVL_TREE_FUNC
     #define CSV_TO_AVL_TREE_FUNC
 
         #define MAX_CSV_LINE 1024
 
+        /**
+         *      @def Max phone number length
+         * 
+         *      @brief The number of digits a phone number may have according to E.164.
+         */
+        #define MAX_PHONE_NUMBER_LENGTH 15
+
+        /**
+         *      @def Max region code length
+         * 
+         *      @brief The number of digits a region code may have. The frozen rate index pads every key to this length.
+         */
+        #define MAX_REGION_CODE_LENGTH 11
+
+        /**
+         *      @def Rate hash block length
+         * 
+         *      @brief The number of leading digits the hash engine groups region codes by to know which lengths are worth
+         *      probing. @c RATE_HASH_BLOCK_COUNT is the number of such groups.
+         */
+        #define RATE_HASH_BLOCK_LENGTH 3
+        #define RATE_HASH_BLOCK_COUNT 1000
+
+        /**
+         *      @def Rate cache size
+         * 
+         *      @brief The number of callees a rate cache remembers. Has to be a power of two.
+         */
+        #define RATE_CACHE_SIZE 16384
+
+        /**
+         *      @def Rate batch group length
+         * 
+         *      @brief The number of leading digits @c rate_call_batch groups callees by before looking them up.
+         *      @c RATE_BATCH_GROUP_COUNT is the number of such groups.
+         */
+        #define RATE_BATCH_GROUP_LENGTH 3
+        #define RATE_BATCH_GROUP_COUNT 1000
+
+        /**
+         *      @def Region dictionary slots
+         * 
+         *      @brief The number of hash slots the region dictionary starts out with. Has to be a power of two.
+         *      @c RATE_REGION_NONE is the region of calls without a rate match.
+         */
+        #define REGION_DICTIONARY_SLOTS 512
+        #define RATE_REGION_NONE UINT32_MAX
+
+        /**
+         *      @def Time band slots
+         * 
+         *      @brief The number of hours in a week. A time band holds a rate multiplier for each of them, starting with the
+         *      first hour of Monday. @c TIME_BAND_NONE is the band of region codes without time bands, it multiplies by 1 at
+         *      any time.
+         */
+        #define TIME_BAND_SLOT_COUNT 168
+        #define TIME_BAND_NONE 0
+
+        /**
+         *      @def Binary call record format
+         * 
+         *      @brief The magic bytes, version and byte order mark at the start of every binary call record file. The version
+         *      has to be increased whenever @c binary_call_header or @c binary_call_record change.
+         */
+        #define BINARY_CALL_MAGIC "CDRB"
+        #define BINARY_CALL_VERSION 1
+        #define BINARY_CALL_BYTE_ORDER 0x01020304
+
+        /**
+         *      @def Ingest checkpoint format
+         * 
+         *      @brief The magic bytes and version at the start of every ingest checkpoint file. The version has to be increased
+         *      whenever @c ingest_checkpoint_header or @c monthly_aggregate change.
+         */
+        #define INGEST_CHECKPOINT_MAGIC "CDRK"
+        #define INGEST_CHECKPOINT_VERSION 2
+
+        /**
+         *      @def Rate snapshot format
+         * 
+         *      @brief The magic bytes and version at the start of every rate snapshot file. The version has to be increased
+         *      whenever @c rate_snapshot_header , @c rate_entry , @c rate_version , the region names, the time bands or the frozen
+         *      arrays change.
+         *      Every array starts at a multiple of @c RATE_SNAPSHOT_ALIGNMENT bytes.
+         */
+        #define RATE_SNAPSHOT_MAGIC "CDRR"
+        #define RATE_SNAPSHOT_VERSION 5
+        #define RATE_SNAPSHOT_ALIGNMENT 64
+
+        /**
+         *      @def Minimum chunk size
+         * 
+         *      @brief The smallest share of a mapped call record, in bytes, that is worth handing to its own worker thread.
+         */
+        #define MIN_CHUNK_SIZE (1 << 20)
+
+        /**
+         *      @def Stream buffer size
+         * 
+         *      @brief The size of the buffer, in bytes, that non-seekable call records are read into at once.
+         */
+        #define STREAM_BUFFER_SIZE (1 << 20)
+
+        /**
+         *      @def Gzip buffer size
+         * 
+         *      @brief The size of zlib's input buffer and of the blocks that compressed csv files are inflated in, in bytes.
+         */
+        #define GZIP_BUFFER_SIZE (1 << 18)
+
+        /**
+         *      @def Csv block size
+         * 
+         *      @brief The number of bytes the csv scanner compares against its delimiters at once. One bit per byte has to fit
+         *      into the scanner's 64 bit delimiter mask.
+         */
+        #define CSV_BLOCK_SIZE 64
+
+        /**
+         *      @def Max csv fields
+         * 
+         *      @brief The number of fields per row whose offsets are recorded. Rows with more fields are still counted.
+         */
+        #define MAX_CSV_FIELDS 8
+
+        /**
+         *      @def Diagnostic samples
+         * 
+         *      @brief The number of messages kept per diagnostic category for the summary, and the length each is cut to.
+         */
+        #define DIAGNOSTIC_SAMPLE_COUNT 5
+        #define DIAGNOSTIC_MESSAGE_LENGTH 128
+
+        /**
+         *      @typedef Diagnostic category
+         * 
+         *      @brief The kinds of data errors that are counted instead of being logged one by one.
+         */
+        typedef enum diagnostic_category {
+
+            DIAGNOSTIC_MALFORMED_CALL_LINE,
+            DIAGNOSTIC_INVALID_DATE,
+            DIAGNOSTIC_INVALID_DURATION,
+            DIAGNOSTIC_INVALID_NUMBER,
+            DIAGNOSTIC_NO_RATE_MATCH,
+            DIAGNOSTIC_MALFORMED_RATE_LINE,
+            DIAGNOSTIC_INVALID_RATE,
+            DIAGNOSTIC_INVALID_REGION_CODE,
+            DIAGNOSTIC_DUPLICATE_REGION_CODE,
+            DIAGNOSTIC_INVALID_BINARY_RECORD,
+            DIAGNOSTIC_INVALID_EFFECTIVE_DATE,
+            DIAGNOSTIC_INVALID_TIME_BAND,
+            DIAGNOSTIC_CATEGORY_COUNT
+
+        } diagnostic_category;
+
+        /**
+         *      @typedef Diagnostic log
+         * 
+         *      @brief Error counts per category along with the first few messages of each.
+         * 
+         *      @param lock Keeps verbose lines on stderr whole, and guards the counts where they cannot be updated atomically.
+         *      @param verbose Whether every message is written to stderr as it is reported.
+         *      @param count The number of errors reported per category.
+         *      @param sample The first @c DIAGNOSTIC_SAMPLE_COUNT messages per category.
+         */
+        typedef struct diagnostic_log {
+
+            pthread_mutex_t lock;
+            int verbose;
+
+            size_t count[DIAGNOSTIC_CATEGORY_COUNT];
+            char sample[DIAGNOSTIC_CATEGORY_COUNT][DIAGNOSTIC_SAMPLE_COUNT][DIAGNOSTIC_MESSAGE_LENGTH];
+
+        } diagnostic_log;
+
+        /**
+         *      @typedef Phone number
+         * 
+         *      @brief A phone number or region code in integer form. E.164 numbers have at most 15 digits, so the value always
+         *      fits into 64 bits. The digit count is kept alongside it, since leading zeros of region codes and prefixes
+         *      would otherwise be lost.
+         * 
+         *      @param value The number's digits as an unsigned integer. 0 for anonymous numbers.
+         *      @param digits The number of digits. 0 for anonymous numbers.
+         */
+        typedef struct phone_number {
+
+            uint64_t value;
+            unsigned int digits;
+
+        } phone_number;
+
+        /**
+         *      @typedef Gzip csv stream
+         * 
+         *      @brief A compressed csv file that is being inflated into a pipe by a decompression thread.
+         * 
+         *      @param compressed The zlib handle of the compressed file.
+         *      @param write_end The writing end of the pipe the inflated data is written to.
+         *      @param csv The reading end of the pipe, as handed out by @c open_gzip_csv . Identifies the stream in @c close_csv .
+         *      @param thread The decompression thread, joined by @c close_csv .
+         *      @param inflated 1 once the whole file was inflated and written, 0 if decompression failed. Only valid after the
+         *      thread was joined.
+         *      @param next The next open stream in the @c gzip_csv_registry .
+         */
+        typedef struct gzip_csv_stream {
+
+            gzFile compressed;
+            int write_end;
+
+            FILE *csv;
+            pthread_t thread;
+            int inflated;
+
+            struct gzip_csv_stream *next;
+
+        } gzip_csv_stream;
+
+        /**
+         *      @typedef Gzip csv registry
+         * 
+         *      @brief Every compressed csv file that has been opened but not closed yet, so that @c close_csv can find the
+         *      decompression thread behind a file pointer.
+         * 
+         *      @param lock Guards the list, call records are opened by several reader threads.
+         *      @param streams The first open stream.
+         */
+        typedef struct gzip_csv_registry {
+
+            pthread_mutex_t lock;
+            gzip_csv_stream *streams;
+
+        } gzip_csv_registry;
+
+        /**
+         *      @typedef Decoded call
+         * 
+         *      @brief A single validated call, as read from a call csv row or a binary call record.
+         * 
+         *      @param caller The caller's encoded number, or an anonymous number.
+         *      @param callee The callee's encoded number.
+         *      @param duration The duration of the call in seconds.
+         * 
+         *      @param year The year the call took place in.
+         *      @param month The month the call took place in.
+         *      @param day The day the call took place on.
+         *      @param hour The hour the call started in.
+         *      @param minute The minute the call started in.
+         *      @param second The second the call started in.
+         * 
+         *      @param source The index of the call record the call was read from, in the order the call records were given.
+         *      @param line The row of the call csv or the number of the binary record the call was read from. Together with
+         *      @c source it orders calls that started in the same second.
+         */
+        typedef struct decoded_call {
+
+            phone_number caller;
+            phone_number callee;
+            size_t duration;
+
+            size_t year;
+            size_t month;
+            size_t day;
+            size_t hour;
+            size_t minute;
+            size_t second;
+
+            size_t source;
+            size_t line;
+
+        } decoded_call;
+
+        /**
+         *      @typedef Binary call header
+         * 
+         *      @brief The header at the start of a binary call record file. Records are stored in native byte order, so the
+         *      header carries a byte order mark and the record size to reject files written on other platforms.
+         * 
+         *      @param magic Always @c BINARY_CALL_MAGIC .
+         *      @param version The format version, @c BINARY_CALL_VERSION .
+         *      @param record_size The size of a single @c binary_call_record in bytes.
+         *      @param byte_order @c BINARY_CALL_BYTE_ORDER as written by the converting machine.
+         *      @param record_count The number of records following the header.
+         */
+        typedef struct binary_call_header {
+
+            char magic[4];
+            uint32_t version;
+            uint32_t record_size;
+            uint32_t byte_order;
+            uint64_t record_count;
+
+        } binary_call_header;
+
+        /**
+         *      @typedef Binary call record
+         * 
+         *      @brief A single call in a binary call record file. Fixed width, so records can be used straight from a mapping.
+         * 
+         *      @param caller The caller's number as an integer, 0 for anonymous callers.
+         *      @param callee The callee's number as an integer.
+         *      @param duration The duration of the call in seconds.
+         *      @param date The date of the call, packed as @c (year << 9) | (month << 5) | day .
+         *      @param time The time of day the call started at, in seconds since midnight.
+         *      @param reserved Always 0.
+         */
+        typedef struct binary_call_record {
+
+            uint64_t caller;
+            uint64_t callee;
+            uint32_t duration;
+            uint32_t date;
+            uint32_t time;
+            uint32_t reserved;
+
+        } binary_call_record;
+
+        /**
+         *      @typedef Ingest checkpoint header
+         * 
+         *      @brief The header of an ingest checkpoint file, which records how far into a call record an incremental run got.
+         *      It is followed by @c aggregate_count @c monthly_aggregate entries. Like binary call records, checkpoints are
+         *      stored in native byte order.
+         * 
+         *      @param magic Always @c INGEST_CHECKPOINT_MAGIC .
+         *      @param version The format version, @c INGEST_CHECKPOINT_VERSION .
+         *      @param byte_order @c BINARY_CALL_BYTE_ORDER as written by the checkpointing machine.
+         *      @param aggregate_size The size of a single @c monthly_aggregate in bytes.
+         * 
+         *      @param device The device of the call record file. Used to notice a replaced file.
+         *      @param inode The inode of the call record file. Used to notice a replaced file.
+         *      @param byte_offset The number of bytes of the call record that have been parsed, always at the end of a row.
+         *      @param line_count The number of rows of the call record that have been parsed.
+         * 
+         *      @param total_call_number Number of calls parsed so far.
+         *      @param total_call_duration Duration of the calls parsed so far.
+         *      @param total_call_price Price of the calls parsed so far.
+         *      @param aggregate_count The number of monthly aggregates following the header.
+         */
+        typedef struct ingest_checkpoint_header {
+
+            char magic[4];
+            uint32_t version;
+            uint32_t byte_order;
+            uint32_t aggregate_size;
+
+            uint64_t device;
+            uint64_t inode;
+            uint64_t byte_offset;
+            uint64_t line_count;
+
+            uint64_t total_call_number;
+            uint64_t total_call_duration;
+            double total_call_price;
+            uint64_t aggregate_count;
+
+        } ingest_checkpoint_header;
+
+        /**
+         *      @typedef Monthly aggregate
+         * 
+         *      @brief The totals of a single user's calls in a single month, which is everything a monthly bill is made of.
+         * 
+         *      @param caller The user's number in integer form.
+         *      @param caller_digits The number of digits of the user's number.
+         *      @param datetime The year multiplied by 100, plus the month.
+         *      @param call_count The number of calls.
+         *      @param call_duration The duration of the calls in seconds.
+         *      @param bill The price of the calls.
+         *      @param cdr_length The length of the month's cdr file once the counted calls were written. Rows past it were
+         *      appended by a run that never saved its checkpoint and are cut off before new calls are appended.
+         */
+        typedef struct monthly_aggregate {
+
+            uint64_t caller;
+            uint32_t caller_digits;
+            uint32_t datetime;
+            uint64_t call_count;
+            uint64_t call_duration;
+            double bill;
+            uint64_t cdr_length;
+
+        } monthly_aggregate;
+
+        /**
+         *      @typedef Ingest checkpoint
+         * 
+         *      @brief An ingest checkpoint in memory. The aggregates are kept sorted by caller, as ordered by
+         *      @c compare_phone_numbers , and by month.
+         * 
+         *      @param header The checkpoint header.
+         *      @param aggregates The monthly aggregates of every user.
+         */
+        typedef struct ingest_checkpoint {
+
+            ingest_checkpoint_header header;
+            monthly_aggregate *aggregates;
+
+        } ingest_checkpoint;
+
+        /**
+         *      @typedef Csv fields
+         * 
+         *      @brief The field offsets of a single csv row, as found by @c next_csv_row . Offsets are relative to the row's first
+         *      byte and do not include the delimiters.
+         * 
+         *      @param count The number of fields in the row, including the ones past @c MAX_CSV_FIELDS .
+         *      @param offset The offset of each field.
+         *      @param length The length of each field. Empty fields have a length of 0.
+         *      @param row_length The length of the row without its trailing newline.
+         */
+        typedef struct csv_fields {
+
+            size_t count;
+            size_t offset[MAX_CSV_FIELDS];
+            size_t length[MAX_CSV_FIELDS];
+            size_t row_length;
+
+        } csv_fields;
+
+        /**
+         *      @typedef Csv scanner
+         * 
+         *      @brief Splits a buffer of csv rows into fields without modifying it. Commas and newlines are found a block at a time
+         *      with SIMD compares and kept as a bit mask, so the scanner carries all of its state and is safe to use from several
+         *      threads at once, unlike @c strtok .
+         * 
+         *      @param buffer The buffer being scanned.
+         *      @param length The length of the buffer in bytes.
+         *      @param row_offset The offset of the next row to be returned.
+         *      @param block_offset The offset of the block the delimiter mask belongs to.
+         *      @param delimiter_mask The delimiters of the current block that have not been consumed yet, one bit per byte.
+         */
+        typedef struct csv_scanner {
+
+            const char *buffer;
+            size_t length;
+            size_t row_offset;
+            size_t block_offset;
+            uint64_t delimiter_mask;
+
+        } csv_scanner;
+
         /**
          *      @typedef Call linked list
          * 
          *      @brief The node for a single call.
          * 
-         *      @param callee The number that was called in @c string format, with the final 3 digits replaced with '*'.
+         *      @param callee The encoded number that was called. Its final 3 digits are only censored when it is written out.
          *      @param duration The duration of the call.
          *      @param price The call price in @c double format. Calculated from the duration and the appropriate node in the rate linked list.
+         *      @param region The region of the matching rate, @c RATE_REGION_NONE if no rate matched.
          * 
          *      @param year The year the call took place in.
          *      @param month The month the call took place in.
          *      @param day The day the call took place on.
+         *      @param hour The hour the call started in.
+         *      @param minute The minute the call started in.
+         *      @param second The second the call started in.
+         *      @param source The index of the call record the call was read from, see @c compare_call_nodes .
+         *      @param line The row the call was read from, see @c compare_call_nodes .
          * 
          *      @param previous The previous node. @c NULL for the head node.
          *      @param next The next node. @c NULL for the tail node.      
          */        
         typedef struct user_call_list {
             
-            char *callee;
+            phone_number callee;
             size_t duration;
             double price;
+            uint32_t region;
 
             size_t year;
             size_t month;
             size_t day;
+            size_t hour;
+            size_t minute;
+            size_t second;
+            size_t source;
+            size_t line;
 
             struct user_call_list  *previous;
             struct user_call_list *next;
 
         } user_call_list;
 
+        /**
+         *      @typedef Rate version
+         * 
+         *      @brief The rate a region code is billed at from a given date on, until the date of its next version.
+         * 
+         *      @param effective_date The first day the rate is in force on, encoded as @c yyyymmdd . 0 for rates without a date,
+         *      which are in force from the beginning.
+         *      @param rate The call rate.
+         */
+        typedef struct rate_version {
+
+            uint32_t effective_date;
+            double rate;
+
+        } rate_version;
+
         /**
          *      @typedef Rate tree node
          * 
@@ -58,8 +538,19 @@
          *      being loaded in. Note that there is no reference to the parent node because the tree is static after the data has been
          *      loaded in. No deletitions or other complex operations will take place.
          * 
-         *      @param region_code The number region code, formatted as a @c string to make longest match searches easier.
-         *      @param rate The call rate in @c double format. Determines the cost of a call to the region code per minute.
+         *      @param region_code The number region code, formatted as a @c string . Used to build the tree and for printing.
+         *      @param code The encoded region code. Used for longest match searches. The first block of a range row.
+         *      @param range_end The last block of a range row, which has as many digits as the first. 0 digits for region codes
+         *      that are not a range.
+         *      @param rate The call rate in @c double format. Determines the cost of a call to the region code per minute. If the
+         *      region code has several versions, the rate of the earliest one.
+         *      @param versions Every version of the rate, ordered by effective date. Holds at least one version.
+         *      @param version_count The number of versions.
+         *      @param region The region the code belongs to, as interned in the region dictionary. Later versions of the rate
+         *      keep the region of the first one.
+         *      @param time_band The time band of the longest time band region code the node's region code starts with,
+         *      @c TIME_BAND_NONE if there is none.
+         *      @param entry_index The position of the node's entry in the @c rate_index built from the tree.
          * 
          *      @param left The left child node.
          *      @param next The right child node.      
@@ -67,7 +558,14 @@
         typedef struct rate_node {
 
             char *region_code;
+            phone_number code;
+            phone_number range_end;
             double rate;
+            rate_version *versions;
+            size_t version_count;
+            uint32_t region;
+            uint32_t time_band;
+            size_t entry_index;
 
             int height;
 
@@ -75,13 +573,365 @@
             struct rate_node *right;
         } rate_node;
 
+        /**
+         *      @typedef Rate engine
+         * 
+         *      @brief The lookup structures a @c rate_index can find the longest region code match with.
+         */
+        typedef enum rate_engine {
+
+            RATE_ENGINE_AVL,
+            RATE_ENGINE_TRIE,
+            RATE_ENGINE_FROZEN,
+            RATE_ENGINE_HASH
+
+        } rate_engine;
+
+        /**
+         *      @typedef Rate entry
+         * 
+         *      @brief A single rate, as found by a rate index lookup. Entries are plain data without pointers, so every
+         *      engine can refer to them by their position.
+         * 
+         *      @param code The encoded region code.
+         *      @param rate The call rate of the earliest version, which is the only one for most region codes.
+         *      @param first_version The position of the entry's earliest version in the versions of the index.
+         *      @param version_count The number of versions, which follow each other ordered by effective date.
+         *      @param region The region the code belongs to.
+         *      @param time_band The time band the code is billed with, @c TIME_BAND_NONE if it has none.
+         */
+        typedef struct rate_entry {
+
+            phone_number code;
+            double rate;
+            uint32_t first_version;
+            uint32_t version_count;
+            uint32_t region;
+            uint32_t time_band;
+
+        } rate_entry;
+
+        /**
+         *      @typedef Rate trie node
+         * 
+         *      @brief A node of the 10-way digit trie. Nodes live in a single array and refer to each other by their position,
+         *      the root is node 0. Since the root is nobody's child, 0 also marks a missing child.
+         * 
+         *      @param child The node following each digit, 0 if no region code continues with it.
+         *      @param entry The position of the rate entry whose region code ends at this node plus one, 0 if none does.
+         */
+        typedef struct rate_trie_node {
+
+            uint32_t child[10];
+            uint32_t entry;
+
+        } rate_trie_node;
+
+        /**
+         *      @typedef Rate hash table
+         * 
+         *      @brief An open addressing hash table holding every region code of a single length, keyed by its encoded value.
+         *      Collisions are resolved by probing the following slots.
+         * 
+         *      @param slots The position of each slot's rate entry plus one, 0 if the slot is empty. @c NULL if no region code
+         *      has this length.
+         *      @param mask The number of slots minus one. The number of slots is a power of two.
+         *      @param shift How far a multiplied key is shifted to the right to get its home slot.
+         */
+        typedef struct rate_hash_table {
+
+            uint32_t *slots;
+            uint64_t mask;
+            unsigned int shift;
+
+        } rate_hash_table;
+
+        /**
+         *      @typedef Rate index
+         * 
+         *      @brief The structure calls are rated with. It is built from the rate tree once loading has finished and only read
+         *      afterwards, so it can be shared between threads.
+         * 
+         *      @param engine The lookup structure used by @c search_rate_index .
+         *      @param tree The root of the rate tree. Used by the AVL engine.
+         *      @param entries Every rate, in region code order, followed by every range row ordered by length and first block.
+         *      @param entry_count The number of rates, not counting range rows.
+         *      @param versions The versions of every rate, grouped by entry and ordered by effective date within each entry.
+         *      @param version_count The number of versions.
+         * 
+         *      @param trie The nodes of the digit trie. Used by the trie engine.
+         *      @param trie_node_count The number of trie nodes.
+         * 
+         *      @param frozen_keys The region codes padded to @c MAX_REGION_CODE_LENGTH digits, in Eytzinger order starting at
+         *      position 1. Used by the frozen engine.
+         *      @param frozen_ranks The position in @c entries of every key in @c frozen_keys .
+         *      @param frozen_parents The position plus one of the longest other region code every entry starts with, 0 if
+         *      there is none.
+         * 
+         *      @param hash_tables One hash table per region code length, indexed by the length. Used by the hash engine.
+         *      @param hash_length_masks For every group of numbers sharing their first @c RATE_HASH_BLOCK_LENGTH digits, a bit
+         *      for every region code length that occurs among their prefixes.
+         *      @param hash_length_mask A bit for every region code length in use, for numbers too short to have a group.
+         * 
+         *      @param range_count The number of range rows, whose entries follow the rates.
+         *      @param range_highs The last block of every range row, in the order of their entries.
+         *      @param range_starts The position among the range rows of the first one of each length, and of the end of the
+         *      range rows after the longest length. Ranges of length @c n are in @c range_starts[n] up to @c range_starts[n+1].
+         *      @param range_length_mask A bit for every length of range rows.
+         * 
+         *      @param time_bands @c TIME_BAND_SLOT_COUNT rate multipliers per time band, @c TIME_BAND_NONE first. The
+         *      multiplier of a band in a given hour of the week is at @c time_bands[band * TIME_BAND_SLOT_COUNT + slot] .
+         *      @param time_band_count The number of time bands, not counting @c TIME_BAND_NONE .
+         * 
+         *      @param compiled 1 if the entries, versions, ranges, time bands and frozen arrays belong to a @c compiled_rate_table and must not
+         *      be freed.
+         */
+        typedef struct rate_index {
+
+            rate_engine engine;
+            rate_node *tree;
+
+            rate_entry *entries;
+            size_t entry_count;
+            rate_version *versions;
+            size_t version_count;
+
+            size_t range_count;
+            uint64_t *range_highs;
+            size_t range_starts[MAX_REGION_CODE_LENGTH + 2];
+            uint16_t range_length_mask;
+
+            double *time_bands;
+            size_t time_band_count;
+
+            rate_trie_node *trie;
+            size_t trie_node_count;
+
+            uint64_t *frozen_keys;
+            uint32_t *frozen_ranks;
+            uint32_t *frozen_parents;
+
+            rate_hash_table hash_tables[MAX_REGION_CODE_LENGTH + 1];
+            uint16_t hash_length_masks[RATE_HASH_BLOCK_COUNT];
+            uint16_t hash_length_mask;
+
+            int compiled;
+
+        } rate_index;
+
+        /**
+         *      @typedef Compiled rate table
+         * 
+         *      @brief The entries and frozen arrays of a rate index, either written out as constant C source by @c rate_compile
+         *      so that a specialized executable can be linked with its rates, or found in a mapped rate snapshot.
+         * 
+         *      @param entry_count The number of rates, not counting range rows.
+         *      @param entries Every rate, in region code order, followed by the range rows as in @c rate_index .
+         *      @param range_count The number of range rows.
+         *      @param range_highs The last block of every range row.
+         *      @param time_band_count The number of time bands, not counting @c TIME_BAND_NONE .
+         *      @param time_bands The rate multipliers of every time band, as in @c rate_index .
+         *      @param version_count The number of rate versions.
+         *      @param versions The versions of every rate, as in @c rate_index .
+         *      @param region_count The number of regions.
+         *      @param region_names_length The length of @c region_names in bytes.
+         *      @param region_names The name of every region in the order of their IDs, each terminated by a null character.
+         *      @param frozen_keys The padded region codes in Eytzinger order, as in @c rate_index .
+         *      @param frozen_ranks The position in @c entries of every key.
+         *      @param frozen_parents The position plus one of the longest other region code every entry starts with.
+         *      @param source The name of the rate csv the table was compiled from, @c NULL for a rate snapshot.
+         */
+        typedef struct compiled_rate_table {
+
+            size_t entry_count;
+            const rate_entry *entries;
+            size_t range_count;
+            const uint64_t *range_highs;
+            size_t time_band_count;
+            const double *time_bands;
+            size_t version_count;
+            const rate_version *versions;
+            size_t region_count;
+            size_t region_names_length;
+            const char *region_names;
+            const uint64_t *frozen_keys;
+            const uint32_t *frozen_ranks;
+            const uint32_t *frozen_parents;
+            const char *source;
+
+        } compiled_rate_table;
+
+        /**
+         *      @typedef Rate snapshot header
+         * 
+         *      @brief The header at the start of a rate snapshot file, which holds the arrays of a frozen rate index in native
+         *      byte order so they can be used straight from a mapping. Like a binary call record it carries a byte order mark
+         *      and the entry size to reject files written on other platforms.
+         * 
+         *      @param magic Always @c RATE_SNAPSHOT_MAGIC .
+         *      @param version The format version, @c RATE_SNAPSHOT_VERSION .
+         *      @param entry_size The size of a single @c rate_entry in bytes.
+         *      @param byte_order @c BINARY_CALL_BYTE_ORDER as written by the snapshotting machine.
+         *      @param entry_count The number of rates, not counting range rows.
+         *      @param range_count The number of range rows.
+         *      @param time_band_count The number of time bands, not counting @c TIME_BAND_NONE .
+         *      @param version_count The number of rate versions.
+         *      @param region_count The number of regions.
+         *      @param region_names_length The length of the region names in bytes.
+         *      @param keys_offset The file offset of the padded keys in Eytzinger order, @c entry_count + 1 of them.
+         *      @param entries_offset The file offset of the rate entries, followed by the entries of the range rows.
+         *      @param ranks_offset The file offset of the ranks, @c entry_count + 1 of them.
+         *      @param parents_offset The file offset of the parents.
+         *      @param versions_offset The file offset of the rate versions.
+         *      @param range_highs_offset The file offset of the last blocks of the range rows.
+         *      @param time_bands_offset The file offset of the rate multipliers of every time band, @c TIME_BAND_NONE included.
+         *      @param region_names_offset The file offset of the region names, which are null terminated and in the order of
+         *      their IDs.
+         */
+        typedef struct rate_snapshot_header {
+
+            char magic[4];
+            uint32_t version;
+            uint32_t entry_size;
+            uint32_t byte_order;
+            uint64_t entry_count;
+            uint64_t range_count;
+            uint64_t time_band_count;
+            uint64_t version_count;
+            uint64_t region_count;
+            uint64_t region_names_length;
+            uint64_t keys_offset;
+            uint64_t entries_offset;
+            uint64_t ranks_offset;
+            uint64_t parents_offset;
+            uint64_t versions_offset;
+            uint64_t range_highs_offset;
+            uint64_t time_bands_offset;
+            uint64_t region_names_offset;
+
+        } rate_snapshot_header;
+
+        /**
+         *      @typedef Rate cache slot
+         * 
+         *      @brief A callee whose rate has been looked up, together with the result.
+         * 
+         *      @param value The encoded value of the callee.
+         *      @param digits The number of digits of the callee, 0 if the slot is empty.
+         *      @param entry The position of the matching rate entry plus one, 0 if no region code matched.
+         */
+        typedef struct rate_cache_slot {
+
+            uint64_t value;
+            uint32_t digits;
+            uint32_t entry;
+
+        } rate_cache_slot;
+
+        /**
+         *      @typedef Rate cache
+         * 
+         *      @brief Remembers the rate lookups of recently seen callees in front of a rate index. The index is shared, but every
+         *      parsing thread has its own cache, so no locking is needed.
+         * 
+         *      @param index The rate index looked up on a miss.
+         *      @param slots @c RATE_CACHE_SIZE slots, each callee can only be in the one its hash selects. @c NULL if there was not
+         *      enough memory, every lookup then goes to the index.
+         *      @param hits The number of lookups answered by the cache.
+         *      @param misses The number of lookups that went to the index.
+         */
+        typedef struct rate_cache {
+
+            const rate_index *index;
+            rate_cache_slot *slots;
+            size_t hits;
+            size_t misses;
+
+        } rate_cache;
+
+        /**
+         *      @typedef Rate cache statistics
+         * 
+         *      @brief The hits and misses of every rate cache deleted so far, for the summary at the end of a run.
+         * 
+         *      @param lock Guards the counters, caches are deleted by several threads.
+         *      @param hits The number of lookups answered by a cache.
+         *      @param misses The number of lookups that went to the index.
+         */
+        typedef struct rate_cache_statistics {
+
+            pthread_mutex_t lock;
+            size_t hits;
+            size_t misses;
+
+        } rate_cache_statistics;
+
+        /**
+         *      @typedef Region dictionary
+         * 
+         *      @brief Interns region names, so that every region can be referred to by a small integer ID - its position in
+         *      @c names . Names are found by hashing into @c slots with linear probing. It is only written while rates are
+         *      loaded, before any parsing threads are started.
+         * 
+         *      @param names The name of every region, ordered by ID.
+         *      @param count The number of regions.
+         *      @param slots The ID plus one of the region in each slot, 0 if the slot is empty. Kept at most half full.
+         *      @param slot_count The number of slots, a power of two. @c names has room for half as many regions.
+         */
+        typedef struct region_dictionary {
+
+            char **names;
+            size_t count;
+            uint32_t *slots;
+            size_t slot_count;
+
+        } region_dictionary;
+
+        /**
+         *      @typedef Time band table
+         * 
+         *      @brief The time bands read from a time band csv, one per region code listed in it. Bands are numbered from 1
+         *      on in the order their region codes first appear, @c TIME_BAND_NONE is not part of the table.
+         * 
+         *      @param codes The region code of every band, band 1 first.
+         *      @param multipliers @c TIME_BAND_SLOT_COUNT rate multipliers per band, band 1 first. Hours of the week the csv
+         *      does not list keep a multiplier of 1.
+         *      @param count The number of bands.
+         */
+        typedef struct time_band_table {
+
+            phone_number *codes;
+            double *multipliers;
+            size_t count;
+
+        } time_band_table;
+
+        /**
+         *      @typedef Region total
+         * 
+         *      @brief The calls billed to a single region, as written to the region report.
+         * 
+         *      @param call_count The number of calls.
+         *      @param call_duration The duration of the calls in seconds.
+         *      @param revenue The price of the calls.
+         */
+        typedef struct region_total {
+
+            size_t call_count;
+            size_t call_duration;
+            double revenue;
+
+        } region_total;
+
         /**
          *      @typedef User tree node
          * 
          *      @brief The user node. It contains the head of a linked list with all of the respective user's calls.
          * 
-         *      @param number The user's unique number in @c string format. Used as the sole identifier for the user.
+         *      @param key The user's unique encoded number. Used as the sole identifier for the user.
+         *      @param number The user's number in @c string format. Used for the output filenames.
          *      @param call_list_head The head of the user's full list of calls.
+         *      @param last_call The call inserted last, where @c insert_call starts looking for the next call's position.
          * 
          *      @param total_call_number Total number of calls the user has made. Only used for final stat calculation.
          *      @param total_call_duration Total duration the user's calls. Only used for final stat calculation.
@@ -95,9 +945,11 @@
          */
         typedef struct user_node {
             
+            phone_number key;
             char *number;
 
             user_call_list *call_list_head;
+            user_call_list *last_call;
 
             size_t total_call_number;
             size_t total_call_duration;
@@ -110,31 +962,192 @@
 
         } user_node;
 
+        /**
+         *      @typedef Call csv chunk
+         * 
+         *      @brief A newline aligned byte range of a mapped call record, together with the partial results of the worker
+         *      thread that parses it.
+         * 
+         *      @param start The first byte of the chunk.
+         *      @param end One past the last byte of the chunk.
+         *      @param line_count The number of rows in the chunk.
+         *      @param first_line The number of the chunk's first row in the whole file. Used for logging and ordering.
+         *      @param source The index of the call record the chunk belongs to.
+         * 
+         *      @param rates The rate index. Shared between all workers and only read.
+         *      @param root The root of the chunk's partial user tree.
+         * 
+         *      @param total_call_number Number of calls parsed from the chunk.
+         *      @param total_call_duration Duration of the calls parsed from the chunk.
+         *      @param total_call_price Price of the calls parsed from the chunk.
+         */
+        typedef struct call_csv_chunk {
+
+            const char *start;
+            const char *end;
+            size_t line_count;
+            size_t first_line;
+            size_t source;
+
+            const rate_index *rates;
+            user_node *root;
+
+            size_t total_call_number;
+            size_t total_call_duration;
+            double total_call_price;
+
+        } call_csv_chunk;
+
+        /**
+         *      @typedef Call record list
+         * 
+         *      @brief The filenames of every call record that is to be parsed, as collected by @c add_call_records .
+         * 
+         *      @param filenames The filenames, owned by the list.
+         *      @param count The number of filenames.
+         *      @param capacity The number of filenames there is room for.
+         */
+        typedef struct call_record_list {
+
+            char **filenames;
+            size_t count;
+            size_t capacity;
+
+        } call_record_list;
+
+        /**
+         *      @typedef Call record reader
+         * 
+         *      @brief The state of a thread that reads call records from a shared list, together with its partial results.
+         * 
+         *      @param records The list of call records. Shared between all readers and only read.
+         *      @param next_record The index of the next unparsed call record. Shared between all readers.
+         *      @param next_record_lock Guards @c next_record .
+         * 
+         *      @param rates The rate index. Shared between all readers and only read.
+         *      @param root The root of the reader's partial user tree.
+         *      @param failed_records The number of call records the reader could not read completely.
+         * 
+         *      @param total_call_number Number of calls parsed by the reader.
+         *      @param total_call_duration Duration of the calls parsed by the reader.
+         *      @param total_call_price Price of the calls parsed by the reader.
+         */
+        typedef struct call_record_reader {
+
+            call_record_list *records;
+            size_t *next_record;
+            pthread_mutex_t *next_record_lock;
+
+            const rate_index *rates;
+            user_node *root;
+            size_t failed_records;
+
+            size_t total_call_number;
+            size_t total_call_duration;
+            double total_call_price;
+
+        } call_record_reader;
+
 
         
 
         // Functions for file handling
 
         FILE *open_csv(const char* filename);
+        FILE *open_gzip_csv(const char *filename);
+        void *decompress_gzip_csv(void *stream);
         int close_csv(FILE *filepointer);
+        char *map_csv(FILE *filepointer, size_t *length);
+        int unmap_csv(char *mapping, size_t length);
+
+        size_t add_call_records(call_record_list *records, const char *path);
+        size_t add_call_record_filename(call_record_list *records, const char *filename);
+        int is_call_record_entry(const struct dirent *entry);
+        void delete_call_record_list(call_record_list *records);
+        user_node *parse_call_records(call_record_list *records, const rate_index *rates, size_t thread_count, size_t *failed_records, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        void *read_call_records(void *reader);
 
-        rate_node *parse_rate_csv(FILE *filename);
-        user_node *parse_call_csv(FILE *filename, rate_node *rate_root, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        rate_node *parse_rate_csv(FILE *filename, rate_node **range_root);
+        int parse_time_band_csv(FILE *filename, time_band_table *table);
+        user_node *parse_call_csv(FILE *filename, size_t source, const rate_index *rates, size_t thread_count, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        user_node *parse_call_stream(FILE *stream, size_t source, const rate_index *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        user_node *parse_call_chunks(const char *mapping, size_t mapping_length, size_t source, size_t thread_count, const rate_index *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        void *count_call_chunk_lines(void *chunk);
+        void *parse_call_chunk(void *chunk);
+        user_node *parse_call_range(const char *start, const char *end, size_t source, size_t *line_counter, user_node *root, rate_cache *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        user_node *parse_call_line(const char *row, const csv_fields *fields, size_t source, size_t line_counter, user_node *root, rate_cache *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        int decode_call_row(const char *row, const csv_fields *fields, size_t line_counter, decoded_call *call);
 
         char *generate_cdr_filename(char *user_number, size_t datetime);
         char *generate_monthly_bill_filename(char *user_number, size_t datetime);
-        FILE *open_monthly_cdr_bill(char *filename);
+        FILE *open_monthly_cdr_bill(char *filename, const char *mode);
         int close_monthly_cdr_bill(FILE *filepointer);
     
+        // Binary call record functions
+
+        size_t convert_call_csv(FILE *csv, FILE *binary);
+        user_node *load_binary_call_record(FILE *binary, const rate_index *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        void init_binary_call_header(binary_call_header *header, uint64_t record_count);
+        int check_binary_call_header(const binary_call_header *header, size_t length);
+        int encode_binary_call(const decoded_call *call, binary_call_record *record);
+        int decode_binary_call(const binary_call_record *record, decoded_call *call);
+
+        // Incremental ingest functions
+
+        int load_ingest_checkpoint(const char *filename, ingest_checkpoint *checkpoint);
+        int save_ingest_checkpoint(const char *filename, const ingest_checkpoint *checkpoint);
+        void reset_ingest_checkpoint(ingest_checkpoint *checkpoint);
+        void delete_ingest_checkpoint(ingest_checkpoint *checkpoint);
+        int parse_call_csv_incremental(FILE *call_record, const rate_index *rates, ingest_checkpoint *checkpoint, user_node **root);
+        void delete_checkpoint_files(const ingest_checkpoint *checkpoint);
+        int update_ingest_checkpoint(ingest_checkpoint *checkpoint, user_node *root);
+        int collect_monthly_aggregates(user_node *node, monthly_aggregate **aggregates, user_call_list ***first_calls, size_t *count, size_t *capacity);
+        int append_monthly_cdr_file(char *user_number, size_t datetime, user_call_list *first_call, uint64_t committed_length, uint64_t *cdr_length);
+        int compare_monthly_aggregates(const monthly_aggregate *a, const monthly_aggregate *b);
+
+        // Csv scanning functions
+
+        void init_csv_scanner(csv_scanner *scanner, const char *buffer, size_t length);
+        uint64_t scan_csv_block(const char *block, size_t length);
+        const char *next_csv_row(csv_scanner *scanner, csv_fields *fields);
+        void close_csv_field(csv_fields *fields, size_t position);
+        char *copy_csv_field(const char *row, const csv_fields *fields, size_t index, char *buffer);
+        int count_trailing_zeros(uint64_t mask);
+
+        // Diagnostics functions
+
+        void set_diagnostic_verbosity(int verbose);
+        size_t add_diagnostic_count(diagnostic_category category);
+        int diagnostic_message_needed(diagnostic_category category);
+        void count_diagnostic(diagnostic_category category);
+        void report_diagnostic(diagnostic_category category, const char *format, ...);
+        size_t get_diagnostic_count(diagnostic_category category);
+        const char *get_diagnostic_category_name(diagnostic_category category);
+        void print_diagnostic_summary(FILE *stream);
+
         // Pattern checking functions
 
         char *validate_phone_number(char **phone_number);
+        int encode_phone_number(const char *number, size_t length, phone_number *encoded);
+        char *format_phone_number(phone_number number, char *buffer);
+        int compare_phone_numbers(phone_number a, phone_number b);
+        phone_number phone_number_prefix(phone_number number, unsigned int length);
+        uint64_t power_of_ten(unsigned int exponent);
+        unsigned int count_digits(uint64_t value);
         char *validate_region_code(char **region_code);
+        char *validate_region_code_range(char *range, char *buffer);
         char *validate_rate(char *rate);
 
-        rate_node *search_by_longest_region_code_match(rate_node *root, const char *callee_number);
+        int decode_call_datetime(const char *datetime, size_t length, size_t *year, size_t *month, size_t *day, size_t *hour, size_t *minute, size_t *second);
+        int decode_call_duration(const char *duration, size_t length, size_t *decoded_duration);
+        int decode_effective_date(const char *date, size_t length, uint32_t *encoded_date);
+        uint32_t encode_rate_date(size_t year, size_t month, size_t day);
+        int decode_time_band_span(const char *span, size_t length, size_t lowest, size_t highest, size_t *first, size_t *last);
+        size_t get_time_band_slot(size_t year, size_t month, size_t day, size_t hour);
+
+        rate_node *search_by_longest_region_code_match(rate_node *root, phone_number callee_number);
         
-        char *censor_calee_number(const char *callee_number);
+        char *censor_calee_number(phone_number callee_number, char *buffer);
         size_t calculate_call_seconds(size_t duration);
         size_t calculate_call_minutes(size_t duration);
         size_t calculate_call_hours(size_t duration);
@@ -143,15 +1156,19 @@
 
         // Call linked list functions
 
-        int insert_call(user_call_list **head, char *callee_number, size_t duration, size_t year, size_t month, size_t day, rate_node *rate_root, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        int insert_call(user_call_list **head, user_call_list **last, const decoded_call *call, rate_cache *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
         void print_call_list(user_call_list *head, size_t start_index, size_t end_index);
         int delete_call_list(user_call_list **head);
+        user_call_list *merge_call_lists(user_call_list *first, user_call_list *second);
         size_t get_call_node_datetime(user_call_list *node);
+        uint64_t get_call_node_timestamp(const user_call_list *node);
+        int compare_call_nodes(const user_call_list *a, const user_call_list *b);
 
         // Rate AVL Tree functions
 
-        rate_node *add_rate_node(rate_node *node, const char *region_code, double rate);
-        rate_node *make_rate_node(const char *region_code, double rate);
+        rate_node *add_rate_node(rate_node *node, const char *region_code, double rate, uint32_t effective_date, uint32_t region);
+        rate_node *make_rate_node(const char *region_code, double rate, uint32_t effective_date, uint32_t region);
+        int add_rate_version(rate_node *node, double rate, uint32_t effective_date);
 
         int get_rate_node_height(rate_node *node);
         int get_rate_node_balance(rate_node *node);
@@ -164,12 +1181,87 @@
         void print_rate_node(rate_node *node);
         void delete_rate_node(rate_node *node);
 
-        rate_node *search_rate_tree(rate_node *root, const char *region_code);
+        rate_node *search_rate_tree(rate_node *root, phone_number region_code);
+        rate_node *prune_rate_tree(rate_node *root, rate_node *range_root, size_t *pruned_count);
+        uint32_t get_rate_range_lengths(rate_node *range_root);
+        rate_node *remove_overlapping_ranges(rate_node *range_root);
+        int compare_rate_ranges(const void *a, const void *b);
+        int compare_region_code_strings(const void *a, const void *b);
+        size_t collect_rate_nodes(rate_node *node, rate_node **nodes, size_t count);
+        rate_node *link_rate_nodes(rate_node **nodes, size_t count);
+        int is_region_code_prefix(phone_number prefix, phone_number code);
+        int have_same_rates(const rate_node *a, const rate_node *b);
         
+        // Rate index functions
+
+        int build_rate_index(rate_index *index, rate_node *root, rate_node *range_root, const time_band_table *time_bands, rate_engine engine);
+        int load_rate_index_from_csv(const char *rate_filename, const char *time_band_filename, rate_engine engine, rate_index *index, rate_node **rate_root, rate_node **range_root);
+        void delete_rate_index(rate_index *index);
+        const rate_entry *search_rate_index(const rate_index *index, phone_number callee_number);
+        double find_rate_in_force(const rate_index *index, const rate_entry *entry, uint32_t date);
+        double get_time_band_multiplier(const rate_index *index, const rate_entry *entry, size_t slot);
+        size_t rate_call_batch(const rate_index *index, const phone_number *callees, const size_t *durations, const uint32_t *dates, const uint8_t *time_slots, size_t count, double *prices);
+        uint64_t get_leading_digits(phone_number number, unsigned int length);
+        int parse_rate_engine(const char *name, rate_engine *engine);
+        int load_compiled_rate_index(rate_index *index, const compiled_rate_table *table, rate_engine engine);
+        int write_compiled_rate_table(FILE *source, const rate_index *index, const char *rate_filename);
+        void write_c_string_literal(FILE *source, const char *string);
+        void init_rate_snapshot_header(rate_snapshot_header *header, uint64_t entry_count, uint64_t range_count, uint64_t version_count, uint64_t time_band_count, uint64_t region_count, uint64_t region_names_length);
+        int check_rate_snapshot_header(const rate_snapshot_header *header, size_t length);
+        int write_rate_snapshot(FILE *snapshot, const rate_index *index);
+        char *map_rate_snapshot(FILE *snapshot, size_t *length, compiled_rate_table *table);
+        uint64_t align_rate_snapshot_offset(uint64_t offset);
+        size_t count_rate_nodes(rate_node *node);
+        size_t count_rate_versions(rate_node *node);
+        size_t collect_rate_entries(rate_node *node, rate_index *index, size_t count);
+        void copy_rate_entry(rate_node *node, rate_index *index, size_t position);
+        int collect_rate_ranges(rate_node *range_root, rate_index *index, size_t count);
+        int index_rate_ranges(rate_index *index);
+        const rate_entry *search_rate_ranges(const rate_index *index, phone_number callee_number, const rate_entry *longest_match);
+        int build_rate_trie(rate_index *index);
+        const rate_entry *search_rate_trie(const rate_index *index, phone_number callee_number);
+        unsigned int split_phone_number_digits(phone_number number, unsigned char *digits);
+        int freeze_rate_index(rate_index *index);
+        size_t fill_eytzinger_keys(rate_index *index, size_t position, size_t rank);
+        const rate_entry *search_rate_frozen(const rate_index *index, phone_number callee_number);
+        uint64_t pad_rate_key(phone_number code);
+        int build_rate_hash_tables(rate_index *index);
+        const rate_entry *search_rate_hash(const rate_index *index, phone_number callee_number);
+        uint64_t hash_region_code(const rate_hash_table *table, uint64_t value);
+        void init_rate_cache(rate_cache *cache, const rate_index *index);
+        void delete_rate_cache(rate_cache *cache);
+        const rate_entry *search_rate_cache(rate_cache *cache, phone_number callee_number);
+        void print_rate_cache_summary(FILE *stream);
+
+        // Region dictionary functions
+
+        uint32_t intern_region_name(const char *name);
+        int grow_region_dictionary(void);
+        uint64_t hash_region_name(const char *name);
+        const char *get_region_name(uint32_t region);
+        size_t get_region_count(void);
+        size_t get_region_names_length(void);
+        int load_region_names(const char *names, size_t length, size_t count);
+        void delete_region_dictionary(void);
+        int write_region_report(FILE *report, user_node *root);
+        void add_region_totals(user_node *node, region_total *totals);
+
+        // Time band functions
+
+        uint32_t intern_time_band(time_band_table *table, phone_number code);
+        rate_node *add_time_band_rates(rate_node *rate_root, const rate_node *range_root, const time_band_table *table);
+        const rate_node *search_rate_range_rows(const rate_node *node, phone_number code);
+        int has_rate_row_under(const rate_node *node, phone_number code);
+        void apply_time_bands(rate_node *node, const time_band_table *table);
+        uint32_t find_time_band(const time_band_table *table, const rate_node *node);
+        void delete_time_band_table(time_band_table *table);
+
         // User AVL Tree functions
 
-        user_node *add_user_node(user_node *node, const char *caller_number, char *callee_number, size_t duration, size_t year, size_t month, size_t day, rate_node *rate_root, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
-        user_node *make_user_node(const char *number);
+        user_node *add_user_node(user_node *node, const decoded_call *call, rate_cache *rates, size_t *total_call_number, size_t *total_call_duration, double *total_call_price);
+        user_node *make_user_node(phone_number number);
+        user_node *merge_user_trees(user_node *destination, user_node *source);
+        user_node *insert_user_node(user_node *node, user_node *new_node);
         
         int get_user_node_height(user_node *node);
         int get_user_node_balance(user_node *node);
@@ -187,7 +1279,9 @@
         
         void calculate_user_stats(user_node *user);
         void generate_monthly_bill_files(user_node *user);
+        int write_monthly_bill(char *user_number, size_t datetime, size_t call_count, size_t call_duration, double bill);
         void generate_monthly_cdr_files(user_node *user);
+        int write_cdr_row(FILE *cdr_file, const char *user_number, const user_call_list *call);
 
         enum months { JANUARY = 1, FEBRUARY, MARCH, APRIL, MAY, JUNE, JULY, AUGUST, SEPTEMBER, OCTOBER, NOVEMBER, DECEMBER };
 
@@ -23,15 +23,48 @@
  */
 //#define DEBUG
 
+/**
+ *      @def Compiled rates
+ * 
+ *      @brief Defined on the command line to link the executable with a rate table generated by rate_compile. Option -r
+ *      becomes optional, without it the compiled rates are used.
+ */
+#ifdef COMPILED_RATES
+    extern const compiled_rate_table compiled_rates;
+#endif
+
+/**
+ *      Print usage
+ *      @brief Prints the correct usage of the executable and its optional arguments.
+ */
+void print_usage(void) {
+    printf( "Usage: [Executable] -r [Call rate CSV file] -c [Call record CSV file]\n"
+            "Generate monthly bill and CDR files for every calling party in the call "
+            "record file based on the call rate file. The rate filename has to be passed "
+            "with option -r and the call record filename has to be passed with option -c. "
+            "Pass \"-\" as the call record filename to read it from standard input. Option -c can be repeated and also accepts "
+            "directories and quoted glob patterns, all call records are billed together.\n"
+            "Optional arguments:\n"
+            "\t-h\tHelp\n"
+            "\t-t\tNumber of threads used to parse the call record, or of call records read at once (default 1)\n"
+            "\t-b\tBinary call record file, created by cdr_convert, to be loaded instead of option -c\n"
+            "\t-s\tRate snapshot file, created by rate_snapshot, to be mapped instead of option -r\n"
+            "\t-e\tRate lookup engine, \"trie\", \"frozen\", \"hash\" or \"avl\" (default trie, frozen with option -s)\n"
+            "\t-i\tIngest checkpoint file. Only calls appended to the call record since the last run are parsed\n"
+            "\t-d\tRegion report file, the number, duration and revenue of the calls billed in this run per region are written to it\n"
+            "\t-w\tTime band CSV file, the rates of its region codes are multiplied by its multiplier for the hour of the week a call starts in\n"
+            "\t-v\tLog every invalid line as it is found instead of a summary at the end\n");
+
+    #ifdef COMPILED_RATES
+        printf("Built with the rates compiled from \"%s\", which are used unless option -r or -s is passed. The default "
+               "engine is \"frozen\", \"avl\" needs option -r.\n", compiled_rates.source);
+    #endif
+}
+
 int main(int argc, char **argv){
 
     if (argc < 2) {
-        printf(     "Usage: [Executable] -r [Call rate CSV file] -c [Call record CSV file]\n"
-                    "Generate monthly bill and CDR files for every calling party in the call "
-                    "record file based on the call rate file. The rate filename has to be passed "
-                    "with option -r and the call record filename has to be passed with option -c.\n"
-                    "Optional arguments:\n"
-                    "\t-h\tHelp\n");
+        print_usage();
             
             return EXIT_SUCCESS;
     }    
@@ -39,8 +72,19 @@ int main(int argc, char **argv){
 
     char c = 0;
 
-    FILE *call_rates = NULL;
-    FILE *call_record = NULL;
+    const char *rate_filename = NULL;
+    const char *time_band_filename = NULL;
+    call_record_list call_records = { .filenames = NULL, .count = 0, .capacity = 0 };
+    FILE *binary_record = NULL;
+    FILE *rate_snapshot = NULL;
+    const char *checkpoint_filename = NULL;
+    const char *region_report_filename = NULL;
+    #ifdef COMPILED_RATES
+        rate_engine engine = RATE_ENGINE_FROZEN;
+    #else
+        rate_engine engine = RATE_ENGINE_TRIE;
+    #endif
+    int engine_chosen = 0;
 
     /**
     *       @property Total call number
@@ -60,32 +104,82 @@ int main(int argc, char **argv){
     */
     double total_call_price = 0;
 
-    while ((c = getopt(argc, argv, "hr:c:")) != -1) {
+    /**
+    *       @property Failed records
+    *       @brief The number of call records that could not be read completely.
+    */
+    size_t failed_records = 0;
+
+    /**
+    *       @property Thread count
+    *       @brief The number of worker threads used to parse the call record.
+    */
+    size_t thread_count = 1;
+
+    while ((c = getopt(argc, argv, "hr:c:t:b:s:e:i:d:w:v")) != -1) {
         switch (c) {
         case 'h':
-            printf( "Usage: [Executable] -r [Call rate CSV file] -c [Call record CSV file]\n"
-                    "Generate monthly bill and CDR files for every calling party in the call "
-                    "record file based on the call rate file. The rate filename has to be passed "
-                    "with option -r and the call record filename has to be passed with option -c.\n"
-                    "Optional arguments:\n"
-                    "\t-h\tHelp\n");
+            print_usage();
             return EXIT_SUCCESS;
             break;
 
         case 'r':
-            call_rates = open_csv(optarg);
-            if (call_rates == NULL) {
-                fprintf(stderr, "Could not open rate record \"%s\" - invalid filename\n", optarg);
-                return EXIT_FAILURE;
-            }
+            rate_filename = optarg;
             break;
 
         case 'c':
-            call_record = open_csv(optarg);
-            if (call_record == NULL) {
+            if (add_call_records(&call_records, optarg) == 0) {
                 fprintf(stderr, "Could not open call record \"%s\" - invalid filename\n", optarg);
                 return EXIT_FAILURE;
-            }            
+            }
+            break;
+
+        case 'b':
+            binary_record = fopen(optarg, "rb");
+            if (binary_record == NULL) {
+                fprintf(stderr, "Could not open binary call record \"%s\" - invalid filename\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 's':
+            rate_snapshot = fopen(optarg, "rb");
+            if (rate_snapshot == NULL) {
+                fprintf(stderr, "Could not open rate snapshot \"%s\" - invalid filename\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case 't':
+            thread_count = strtoul(optarg, NULL, 10);
+            if (thread_count == 0) {
+                fprintf(stderr, "Invalid thread count \"%s\"\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+            
+        case 'e':
+            if (!(parse_rate_engine(optarg, &engine))) {
+                fprintf(stderr, "Unknown rate engine \"%s\"\n", optarg);
+                return EXIT_FAILURE;
+            }
+            engine_chosen = 1;
+            break;
+
+        case 'i':
+            checkpoint_filename = optarg;
+            break;
+
+        case 'd':
+            region_report_filename = optarg;
+            break;
+
+        case 'w':
+            time_band_filename = optarg;
+            break;
+
+        case 'v':
+            set_diagnostic_verbosity(1);
             break;
             
         default:
@@ -94,26 +188,114 @@ int main(int argc, char **argv){
         }
     }
 
-    if ((call_rates == NULL) || (call_record == NULL)) {
+    #ifdef COMPILED_RATES
+        int rates_available = 1;
+    #else
+        int rates_available = ((rate_filename != NULL) || (rate_snapshot != NULL));
+    #endif
+
+    if (!(rates_available) || ((call_records.count == 0) && (binary_record == NULL))) {
         fprintf(stderr, "Error loading files, aborting execution\n");
         return EXIT_FAILURE;
     }
 
-    printf("\nParsing rate record:\n");
-    rate_node *rate_root = parse_rate_csv(call_rates);
-    if (rate_root == NULL) {
-        fprintf(stderr, "Error: No valid data was found in the rate record. Aborting execution\n");
+    if ((time_band_filename != NULL) && ((rate_snapshot != NULL) || (rate_filename == NULL))) {
+        fprintf(stderr, "Time bands are stored along with prebuilt rates, pass them to rate_snapshot or rate_compile instead\n");
         return EXIT_FAILURE;
     }
 
-    #ifdef DEBUG
-        printf("The rates found in their respetive file:\n");
-        traverse_rates_inorder(rate_root, print_rate_node);
-    #endif
+    if ((checkpoint_filename != NULL) && ((binary_record != NULL) || (call_records.count != 1))) {
+        fprintf(stderr, "Incremental runs need exactly one call record passed with option -c, aborting execution\n");
+        return EXIT_FAILURE;
+    }
+
+    /**
+    *       @property Ingest checkpoint
+    *       @brief How far into the call record the last incremental run got, along with its monthly totals.
+    */
+    ingest_checkpoint checkpoint = { .aggregates = NULL };
+
+    if ((checkpoint_filename != NULL) && !(load_ingest_checkpoint(checkpoint_filename, &checkpoint))) {
+        return EXIT_FAILURE;
+    }
+
+    rate_node *rate_root = NULL;
+    rate_node *range_root = NULL;
+    rate_index rates;
+
+    /**
+    *       @property Rate snapshot mapping
+    *       @brief The mapped rate snapshot the rate index refers to, if one was passed with option -s.
+    */
+    char *rate_snapshot_mapping = NULL;
+    size_t rate_snapshot_length = 0;
+
+    if (rate_snapshot != NULL) {
+        printf("\nMapping rate snapshot:\n");
+        compiled_rate_table snapshot_table;
+
+        // The snapshot already holds the frozen engine's arrays, nothing has to be built for it
+        if (!(engine_chosen)) {
+            engine = RATE_ENGINE_FROZEN;
+        }
+
+        rate_snapshot_mapping = map_rate_snapshot(rate_snapshot, &rate_snapshot_length, &snapshot_table);
+        fclose(rate_snapshot);
+
+        if ((rate_snapshot_mapping == NULL) || !(load_compiled_rate_index(&rates, &snapshot_table, engine))) {
+            fprintf(stderr, "Error: The rate snapshot could not be used. Aborting execution\n");
+            return EXIT_FAILURE;
+        }
+    } else if (rate_filename == NULL) {
+        #ifdef COMPILED_RATES
+            printf("\nUsing the rates compiled from \"%s\"\n", compiled_rates.source);
+            if (!(load_compiled_rate_index(&rates, &compiled_rates, engine))) {
+                return EXIT_FAILURE;
+            }
+        #endif
+    } else {
+        printf("\nParsing rate record:\n");
+        if (!(load_rate_index_from_csv(rate_filename, time_band_filename, engine, &rates, &rate_root, &range_root))) {
+            print_diagnostic_summary(stderr);
+            fprintf(stderr, "Error: The rates could not be loaded. Aborting execution\n");
+            return EXIT_FAILURE;
+        }
+
+        #ifdef DEBUG
+            printf("The rates found in their respetive file:\n");
+            traverse_rates_inorder(rate_root, print_rate_node);
+            traverse_rates_inorder(range_root, print_rate_node);
+        #endif
+    }
+
+    user_node *user_root = NULL;
+
+    if (checkpoint_filename != NULL) {
+        printf("\nParsing new calls in the call record:\n");
+        FILE *call_record = open_csv(call_records.filenames[0]);
+        if (call_record == NULL) {
+            fprintf(stderr, "Could not open call record \"%s\" - invalid filename\n", call_records.filenames[0]);
+            return EXIT_FAILURE;
+        }
+        int parsed = parse_call_csv_incremental(call_record, &rates, &checkpoint, &user_root);
+        if (!(close_csv(call_record)) || !(parsed)) {
+            failed_records++;
+        }
+    } else if (binary_record != NULL) {
+        printf("\nLoading binary call record:\n");
+        user_root = load_binary_call_record(binary_record, &rates, &total_call_number, &total_call_duration, &total_call_price);
+    } else {
+        printf("\nParsing call record:\n");
+        user_root = parse_call_records(&call_records, &rates, thread_count, &failed_records, &total_call_number, &total_call_duration, &total_call_price);
+    }
+    print_diagnostic_summary(stderr);
+
+    if (failed_records > 0) {
+        fprintf(stderr, "Error: %lu call record(s) could not be read completely, no bills were written. Aborting execution\n", failed_records);
+        return EXIT_FAILURE;
+    }
 
-    printf("\nParsing call record:\n");
-    user_node *user_root = parse_call_csv(call_record, rate_root, &total_call_number, &total_call_duration, &total_call_price);
-    if (user_root == NULL) {
+    if ((user_root == NULL) && (checkpoint_filename == NULL)) {
         fprintf(stderr, "Error: No valid data was found in the call record. Aborting execution\n");
         return EXIT_FAILURE;
     }
@@ -123,23 +305,58 @@ int main(int argc, char **argv){
         traverse_users_inorder(user_root, print_user_node);
     #endif
 
-    close_csv(call_rates);
-    close_csv(call_record);
+    delete_call_record_list(&call_records);
+    if (binary_record != NULL) {
+        fclose(binary_record);
+    }
 
     // Just to be safe
     traverse_users_preorder(user_root, calculate_user_stats);
 
-    printf("\nGenerating cdr files...\n");
-    traverse_users_preorder(user_root, generate_monthly_cdr_files);
-    printf("Generating bill files...\n\n");
-    traverse_users_preorder(user_root, generate_monthly_bill_files);
+    if (checkpoint_filename != NULL) {
+        printf("\nAppending to cdr files and generating bill files...\n\n");
+
+        // Only the cdr files and bills of months with new calls are written, the saved checkpoint commits them
+        if (!(update_ingest_checkpoint(&checkpoint, user_root)) || !(save_ingest_checkpoint(checkpoint_filename, &checkpoint))) {
+            fprintf(stderr, "Error: The ingest checkpoint could not be updated\n");
+            return EXIT_FAILURE;
+        }
+
+        total_call_number = (size_t) checkpoint.header.total_call_number;
+        total_call_duration = (size_t) checkpoint.header.total_call_duration;
+        total_call_price = checkpoint.header.total_call_price;
+        delete_ingest_checkpoint(&checkpoint);
+    } else {
+        printf("\nGenerating cdr files...\n");
+        traverse_users_preorder(user_root, generate_monthly_cdr_files);
+        printf("Generating bill files...\n\n");
+        traverse_users_preorder(user_root, generate_monthly_bill_files);
+    }
+
+    if (region_report_filename != NULL) {
+        printf("Generating region report...\n\n");
+        FILE *region_report = fopen(region_report_filename, "w");
+
+        if ((region_report == NULL) || !(write_region_report(region_report, user_root)) || (fclose(region_report) != 0)) {
+            fprintf(stderr, "Error: The region report \"%s\" could not be written\n", region_report_filename);
+            return EXIT_FAILURE;
+        }
+    }
 
     printf( "Total number of calls: %li\n"
             "Total duration of calls: %li (seconds)\n"
             "Total price of calls: %.2f €\n", total_call_number, total_call_duration, total_call_price);
+    print_rate_cache_summary(stderr);
 
+    delete_rate_index(&rates);
+    if (rate_snapshot_mapping != NULL) {
+        unmap_csv(rate_snapshot_mapping, rate_snapshot_length);
+    }
     traverse_rates_postorder(rate_root, delete_rate_node);
     rate_root = NULL;
+    traverse_rates_postorder(range_root, delete_rate_node);
+    range_root = NULL;
+    delete_region_dictionary();
     traverse_users_postorder(user_root, delete_user_node);
     user_root = NULL;
 
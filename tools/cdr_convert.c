@@ -0,0 +1,60 @@
+/**
+ *      @file cdr_convert.c
+ *      @author Nestor Hiebl
+ *      @date December 23, 2020
+ *
+ *      @brief One-time converter from a call record csv to a binary call record file, which the main executable can load
+ *      with option -b instead of parsing the csv again on every run.
+ *
+ *      https://github.com/NestorHiebl/c_phone_billing_system
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../csv_to_avl_tree.h"
+
+int main(int argc, char **argv) {
+
+    if (argc != 3) {
+        printf( "Usage: [Executable] [Call record CSV file] [Binary call record file]\n"
+                "Validate every call in the call record and store the valid ones in a fixed width binary file.\n");
+        return (argc == 1) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    FILE *call_record = open_csv(argv[1]);
+    if (call_record == NULL) {
+        fprintf(stderr, "Could not open call record \"%s\" - invalid filename\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    FILE *binary_record = fopen(argv[2], "wb");
+    if (binary_record == NULL) {
+        fprintf(stderr, "Could not open binary call record \"%s\" for writing\n", argv[2]);
+        close_csv(call_record);
+        return EXIT_FAILURE;
+    }
+
+    size_t record_count = convert_call_csv(call_record, binary_record);
+    print_diagnostic_summary(stderr);
+
+    int read_completely = close_csv(call_record);
+
+    if (fclose(binary_record) != 0) {
+        fprintf(stderr, "Closing binary call record failed\n");
+        return EXIT_FAILURE;
+    }
+
+    if (!(read_completely)) {
+        fprintf(stderr, "Error: The call record could not be read completely\n");
+        return EXIT_FAILURE;
+    }
+
+    if (record_count == 0) {
+        fprintf(stderr, "Error: No valid calls were converted\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("Converted %lu calls\n", record_count);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,353 @@
+/**
+ *      @file cdr_generate.c
+ *      @author Nestor Hiebl
+ *      @date December 23, 2020
+ *
+ *      @brief Generator for synthetic call record csv files in the format the main executable parses. Callers are drawn
+ *      from a Zipf distribution whose most frequent caller is "Anonymous", like in real call records, so a few users make
+ *      most of the calls. Calls are spread evenly over a span of months and written in chronological order. A share of the
+ *      rows can be made invalid in every way the parser rejects. The output only depends on the options, so the same seed
+ *      always produces the same file.
+ *
+ *      https://github.com/NestorHiebl/c_phone_billing_system
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#define DEFAULT_USER_COUNT 10000
+#define DEFAULT_CALLS_PER_USER 100
+#define DEFAULT_ZIPF_EXPONENT 1.0
+#define DEFAULT_MONTH_SPAN 6
+#define DEFAULT_START_YEAR 2018
+#define DEFAULT_START_MONTH 7
+#define DEFAULT_INVALID_RATIO 0.0
+#define DEFAULT_SEED 1
+
+#define MEAN_CALL_DURATION 120.0
+#define MAX_REGION_CODES 65536
+#define MAX_REGION_CODE_LENGTH 11
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+/**
+ *      @typedef Generator random state
+ *      @brief The state of a xorshift64* generator. Much faster than @c rand and identical on every platform.
+ */
+typedef struct generator_random {
+
+    uint64_t state;
+
+} generator_random;
+
+/**
+ *      Next random
+ *      @brief Advances the generator and returns 64 random bits.
+ */
+uint64_t next_random(generator_random *random) {
+    random->state ^= random->state >> 12;
+    random->state ^= random->state << 25;
+    random->state ^= random->state >> 27;
+    return random->state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ *      Next random unit
+ *      @brief Returns a random double in [0, 1).
+ */
+double next_random_unit(generator_random *random) {
+    return (double) (next_random(random) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ *      Build zipf table
+ *      @brief Builds the cumulative distribution of a Zipf distribution over @c rank_count ranks. Rank 0 is the most
+ *      frequent one. An exponent of 0 gives a uniform distribution.
+ *
+ *      @return The table, or @c NULL if there is not enough memory.
+ */
+double *build_zipf_table(size_t rank_count, double exponent) {
+    double *cumulative = malloc(rank_count * sizeof(double));
+    if (cumulative == NULL) {
+        return NULL;
+    }
+
+    double sum = 0;
+    for (size_t i = 0; i < rank_count; i++) {
+        sum += 1.0 / pow((double) (i + 1), exponent);
+        cumulative[i] = sum;
+    }
+
+    for (size_t i = 0; i < rank_count; i++) {
+        cumulative[i] /= sum;
+    }
+    cumulative[rank_count - 1] = 1.0;
+
+    return cumulative;
+}
+
+/**
+ *      Draw zipf rank
+ *      @brief Draws a rank from a Zipf distribution by binary searching its cumulative table.
+ */
+size_t draw_zipf_rank(const double *cumulative, size_t rank_count, generator_random *random) {
+    double target = next_random_unit(random);
+    size_t low = 0;
+    size_t high = rank_count - 1;
+
+    while (low < high) {
+        size_t middle = low + ((high - low) / 2);
+        if (cumulative[middle] < target) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ *      Load region codes
+ *      @brief Reads the region codes of a rate csv, so that generated callees mostly have a rate match.
+ *
+ *      @return The number of region codes that were read.
+ */
+size_t load_region_codes(const char *filename, char (*region_codes)[MAX_REGION_CODE_LENGTH + 1]) {
+    FILE *rates = fopen(filename, "r");
+    if (rates == NULL) {
+        return 0;
+    }
+
+    size_t region_code_count = 0;
+    char line[1024];
+
+    while ((region_code_count < MAX_REGION_CODES) && (fgets(line, sizeof(line), rates) != NULL)) {
+        size_t length = strspn(line, "0123456789");
+        if ((length > 0) && (length <= MAX_REGION_CODE_LENGTH) && (line[length] == ',')) {
+            memcpy(region_codes[region_code_count], line, length);
+            region_codes[region_code_count][length] = '\0';
+            region_code_count++;
+        }
+    }
+
+    fclose(rates);
+    return region_code_count;
+}
+
+/**
+ *      Write caller
+ *      @brief Writes the number of the user with the given rank. Rank 0 is "Anonymous", the others are spread over the
+ *      number range by an odd multiplier that is coprime to 10^10, which keeps every number unique.
+ */
+int write_caller(char *buffer, size_t rank) {
+    if (rank == 0) {
+        return sprintf(buffer, "Anonymous");
+    }
+    return sprintf(buffer, "43%010llu", (unsigned long long) (((uint64_t) rank * 7919ULL) % 10000000000ULL));
+}
+
+/**
+ *      Write callee
+ *      @brief Writes a callee number made of a random region code and random digits, 10 to 13 digits long.
+ */
+int write_callee(char *buffer, char (*region_codes)[MAX_REGION_CODE_LENGTH + 1], size_t region_code_count, generator_random *random) {
+    const char *region_code = region_codes[next_random(random) % region_code_count];
+    size_t length = strlen(region_code);
+    size_t digit_count = 10 + (next_random(random) % 4);
+
+    memcpy(buffer, region_code, length);
+    for (size_t i = length; i < digit_count; i++) {
+        buffer[i] = (char) ('0' + (next_random(random) % 10));
+    }
+    if (length > digit_count) {
+        digit_count = length;
+    }
+    buffer[digit_count] = '\0';
+
+    return (int) digit_count;
+}
+
+void print_usage(void) {
+    printf( "Usage: cdr_generate [Options] [Output CSV file]\n"
+            "Write a synthetic call record to the given file, or to standard output if none is given.\n"
+            "Options:\n"
+            "\t-u\tNumber of users (default %d)\n"
+            "\t-n\tAverage number of calls per user (default %d)\n"
+            "\t-z\tZipf exponent of the caller distribution, 0 for uniform (default %.1f)\n"
+            "\t-m\tNumber of months the calls are spread over (default %d)\n"
+            "\t-y\tFirst month, formatted as yyyy-mm (default %d-%02d)\n"
+            "\t-i\tShare of invalid rows between 0 and 1 (default %.1f)\n"
+            "\t-r\tRate csv to take the callees' region codes from\n"
+            "\t-s\tRandom seed (default %d)\n",
+            DEFAULT_USER_COUNT, DEFAULT_CALLS_PER_USER, DEFAULT_ZIPF_EXPONENT, DEFAULT_MONTH_SPAN, DEFAULT_START_YEAR,
+            DEFAULT_START_MONTH, DEFAULT_INVALID_RATIO, DEFAULT_SEED);
+}
+
+int main(int argc, char **argv) {
+
+    size_t user_count = DEFAULT_USER_COUNT;
+    size_t calls_per_user = DEFAULT_CALLS_PER_USER;
+    double zipf_exponent = DEFAULT_ZIPF_EXPONENT;
+    int month_span = DEFAULT_MONTH_SPAN;
+    int start_year = DEFAULT_START_YEAR;
+    int start_month = DEFAULT_START_MONTH;
+    double invalid_ratio = DEFAULT_INVALID_RATIO;
+    const char *rate_filename = NULL;
+    uint64_t seed = DEFAULT_SEED;
+
+    int c = 0;
+
+    while ((c = getopt(argc, argv, "hu:n:z:m:y:i:r:s:")) != -1) {
+        switch (c) {
+        case 'h':
+            print_usage();
+            return EXIT_SUCCESS;
+        case 'u':
+            user_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            calls_per_user = strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            zipf_exponent = strtod(optarg, NULL);
+            break;
+        case 'm':
+            month_span = atoi(optarg);
+            break;
+        case 'y':
+            if (sscanf(optarg, "%d-%d", &start_year, &start_month) != 2) {
+                start_month = 0;
+            }
+            break;
+        case 'i':
+            invalid_ratio = strtod(optarg, NULL);
+            break;
+        case 'r':
+            rate_filename = optarg;
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ((user_count == 0) || (calls_per_user == 0) || (month_span <= 0) || (start_month < 1) || (start_month > 12) ||
+        (zipf_exponent < 0) || (invalid_ratio < 0) || (invalid_ratio > 1)) {
+        fprintf(stderr, "Invalid option value\n");
+        print_usage();
+        return EXIT_FAILURE;
+    }
+
+    static char region_codes[MAX_REGION_CODES][MAX_REGION_CODE_LENGTH + 1] = { "43", "49", "1", "44", "33", "39", "41", "386", "385", "420" };
+    size_t region_code_count = 10;
+
+    if (rate_filename != NULL) {
+        region_code_count = load_region_codes(rate_filename, region_codes);
+        if (region_code_count == 0) {
+            fprintf(stderr, "No region codes found in \"%s\"\n", rate_filename);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *output = stdout;
+    if (optind < argc) {
+        output = fopen(argv[optind], "w");
+        if (output == NULL) {
+            fprintf(stderr, "Could not open \"%s\" for writing\n", argv[optind]);
+            return EXIT_FAILURE;
+        }
+    }
+    setvbuf(output, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+    // Rank 0 of the distribution is the anonymous caller
+    size_t rank_count = user_count + 1;
+    double *cumulative = build_zipf_table(rank_count, zipf_exponent);
+    if (cumulative == NULL) {
+        fprintf(stderr, "Not enough memory for %lu users\n", user_count);
+        return EXIT_FAILURE;
+    }
+
+    generator_random random = { .state = (seed * 0x9E3779B97F4A7C15ULL) | 1 };
+
+    // The calls are spread evenly between the start of the first month and the end of the last one
+    struct tm first_day = { .tm_year = start_year - 1900, .tm_mon = start_month - 1, .tm_mday = 1, .tm_hour = 12, .tm_isdst = -1 };
+    struct tm end_day = { .tm_year = start_year - 1900, .tm_mon = start_month - 1 + month_span, .tm_mday = 1, .tm_hour = 12, .tm_isdst = -1 };
+    double span_seconds = difftime(mktime(&end_day), mktime(&first_day));
+
+    size_t row_count = user_count * calls_per_user;
+    double seconds_per_row = span_seconds / (double) row_count;
+
+    long cached_day = -1;
+    char day_string[16];
+
+    for (size_t row = 0; row < row_count; row++) {
+        long offset = (long) ((double) row * seconds_per_row);
+        long day = offset / 86400;
+        long second_of_day = offset % 86400;
+
+        // The date only has to be calculated again when the day changes
+        if (day != cached_day) {
+            struct tm date = first_day;
+            date.tm_mday += (int) day;
+            mktime(&date);
+            strftime(day_string, sizeof(day_string), "%Y-%m-%d", &date);
+            cached_day = day;
+        }
+
+        char caller[32];
+        char callee[32];
+        write_caller(caller, draw_zipf_rank(cumulative, rank_count, &random));
+        write_callee(callee, region_codes, region_code_count, &random);
+
+        unsigned long duration = (unsigned long) (-log(1.0 - next_random_unit(&random)) * MEAN_CALL_DURATION);
+        int hour = (int) (second_of_day / 3600);
+        int minute = (int) ((second_of_day / 60) % 60);
+        int second = (int) (second_of_day % 60);
+
+        if ((invalid_ratio > 0) && (next_random_unit(&random) < invalid_ratio)) {
+            // Cycle through the kinds of invalid rows the parser rejects
+            switch (next_random(&random) % 6) {
+            case 0:
+                fprintf(output, "%s,%s,%lu\n", caller, callee, duration);
+                break;
+            case 1:
+                fprintf(output, "%s,%s,%lu,%s %02d:%02d:%02d,extra\n", caller, callee, duration, day_string, hour, minute, second);
+                break;
+            case 2:
+                fprintf(output, "%s,%s,%lu,%.4s-13-45 %02d:%02d:%02d\n", caller, callee, duration, day_string, hour, minute, second);
+                break;
+            case 3:
+                fprintf(output, "%s,%s,%lux,%s %02d:%02d:%02d\n", caller, callee, duration, day_string, hour, minute, second);
+                break;
+            case 4:
+                fprintf(output, "%s,%s99999999,%lu,%s %02d:%02d:%02d\n", caller, callee, duration, day_string, hour, minute, second);
+                break;
+            default:
+                fprintf(output, "\n");
+                break;
+            }
+            continue;
+        }
+
+        fprintf(output, "%s,%s,%lu,%s %02d:%02d:%02d\n", caller, callee, duration, day_string, hour, minute, second);
+    }
+
+    free(cumulative);
+
+    if ((fflush(output) != 0) || ((output != stdout) && (fclose(output) != 0))) {
+        fprintf(stderr, "Writing the call record failed\n");
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+/**
+ *      @file rate_compile.c
+ *      @author Nestor Hiebl
+ *      @date December 23, 2020
+ *
+ *      @brief Compiles a rate csv into C source holding its frozen rate index as constant arrays. Linked into the main
+ *      executable built with @c COMPILED_RATES defined, the rates no longer have to be parsed, validated or sorted into a
+ *      tree at startup.
+ *
+ *      https://github.com/NestorHiebl/c_phone_billing_system
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../csv_to_avl_tree.h"
+
+int main(int argc, char **argv) {
+
+    if ((argc != 3) && (argc != 4)) {
+        printf( "Usage: [Executable] [Call rate CSV file] [C source file] [Optional time band CSV file]\n"
+                "Validate every rate in the rate record and write them to a C source file as a constant, precomputed lookup table.\n");
+        return (argc == 1) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    rate_node *rate_root = NULL;
+    rate_node *range_root = NULL;
+    rate_index rates;
+
+    int loaded = load_rate_index_from_csv(argv[1], (argc == 4) ? argv[3] : NULL, RATE_ENGINE_FROZEN, &rates, &rate_root, &range_root);
+    print_diagnostic_summary(stderr);
+
+    if (!(loaded)) {
+        return EXIT_FAILURE;
+    }
+
+    FILE *source = fopen(argv[2], "w");
+    if (source == NULL) {
+        fprintf(stderr, "Could not open C source file \"%s\" for writing\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    int written = write_compiled_rate_table(source, &rates, argv[1]);
+
+    if ((fclose(source) != 0) || !(written)) {
+        fprintf(stderr, "Writing C source file \"%s\" failed\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    printf("Compiled %lu rates, %lu number block ranges and %lu time bands\n", rates.entry_count, rates.range_count, rates.time_band_count);
+
+    delete_rate_index(&rates);
+    traverse_rates_postorder(rate_root, delete_rate_node);
+    traverse_rates_postorder(range_root, delete_rate_node);
+    delete_region_dictionary();
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,56 @@
+/**
+ *      @file rate_snapshot.c
+ *      @author Nestor Hiebl
+ *      @date December 23, 2020
+ *
+ *      @brief One-time converter from a rate csv to a rate snapshot file holding its frozen rate index, which the main
+ *      executable can map with option -s instead of parsing, validating and sorting the rates on every run.
+ *
+ *      https://github.com/NestorHiebl/c_phone_billing_system
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../csv_to_avl_tree.h"
+
+int main(int argc, char **argv) {
+
+    if ((argc != 3) && (argc != 4)) {
+        printf( "Usage: [Executable] [Call rate CSV file] [Rate snapshot file] [Optional time band CSV file]\n"
+                "Validate every rate in the rate record and store them as a precomputed lookup table in a binary file.\n");
+        return (argc == 1) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    rate_node *rate_root = NULL;
+    rate_node *range_root = NULL;
+    rate_index rates;
+
+    int loaded = load_rate_index_from_csv(argv[1], (argc == 4) ? argv[3] : NULL, RATE_ENGINE_FROZEN, &rates, &rate_root, &range_root);
+    print_diagnostic_summary(stderr);
+
+    if (!(loaded)) {
+        return EXIT_FAILURE;
+    }
+
+    FILE *snapshot = fopen(argv[2], "wb");
+    if (snapshot == NULL) {
+        fprintf(stderr, "Could not open rate snapshot \"%s\" for writing\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    int written = write_rate_snapshot(snapshot, &rates);
+
+    if ((fclose(snapshot) != 0) || !(written)) {
+        fprintf(stderr, "Writing rate snapshot \"%s\" failed\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    printf("Stored %lu rates, %lu number block ranges and %lu time bands\n", rates.entry_count, rates.range_count, rates.time_band_count);
+
+    delete_rate_index(&rates);
+    traverse_rates_postorder(rate_root, delete_rate_node);
+    traverse_rates_postorder(range_root, delete_rate_node);
+    delete_region_dictionary();
+
+    return EXIT_SUCCESS;
+}